@@ -0,0 +1,172 @@
+#include "file_index_builder.hpp"
+
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+using namespace logging;
+
+namespace fileindex
+{
+
+RunRegistry::RunRegistry(const std::string& directory): directory(directory)
+{
+}
+
+std::string RunRegistry::newRunPath()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    boost::filesystem::path path(directory);
+    path /= "run_" + std::to_string(runPaths.size());
+    runPaths.push_back(path.string());
+    return runPaths.back();
+}
+
+std::vector<std::string> RunRegistry::getRunPaths() const
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return runPaths;
+}
+
+FileIndexBuilder::FileIndexBuilder(ConcurrentQueue<std::string>& filesForProcessingQueue,
+                                   RunRegistry& runRegistry, size_t memoryBudget, bool withPositions,
+                                   const textnorm::Tokenizer& tokenizer, const UrlMapping* urlMapping):
+    FileProcessor(filesForProcessingQueue), partialIndex(withPositions), tokenizer(tokenizer),
+    runRegistry(runRegistry), memoryBudget(memoryBudget), urlMapping(urlMapping)
+{
+}
+
+FileIndexBuilder::~FileIndexBuilder()
+{
+}
+
+void FileIndexBuilder::mergeThreadResources()
+{
+    if (!partialIndex.empty())
+    {
+        spill();
+    }
+}
+
+bool FileIndexBuilder::process(const std::string& path)
+{
+    Log::debug("Indexing file ", path);
+
+    std::string stem = boost::filesystem::path(path).stem().string();
+    if (stem.empty() || stem.find_first_not_of("0123456789") != std::string::npos)
+    {
+        Log::warn("Skipping file without numeric document id ", path);
+        return false;
+    }
+    uint32_t document = std::stoul(stem);
+
+    if (!readFile(path, data))
+    {
+        Log::warn("Failed to open file ", path);
+        return false;
+    }
+
+    // Html pages are indexed by their text, other files are the text already extracted from pages
+    std::string extension = boost::filesystem::path(path).extension().string();
+    bool isPage = extension == ".html" || extension == ".htm";
+
+    documentWordsPositions.clear();
+    uint32_t position = 0;
+    auto addWord = [this, &position](const textnorm::TokenView& word) {
+        documentWordsPositions[word.str()].push_back(position++);
+    };
+    if (isPage)
+    {
+        tokenizer.forEachToken(extractText(data), token, addWord);
+    }
+    else
+    {
+        tokenizer.forEachToken(data, token, addWord);
+    }
+    partialIndex.addDocument(document, documentWordsPositions);
+
+    if (urlMapping != nullptr)
+    {
+        if (isPage)
+        {
+            addFields(document, data);
+        }
+        else if (readFile(urlMapping->getPagePath(document), page))
+        {
+            addFields(document, page);
+        }
+        else
+        {
+            Log::warn("Failed to open html page of document ", document);
+        }
+    }
+
+    if (partialIndex.memoryUsage() >= memoryBudget)
+    {
+        spill();
+    }
+    return true;
+}
+
+bool FileIndexBuilder::readFile(const std::string& path, std::vector<char>& data)
+{
+    std::ifstream infile;
+    infile.open(path, std::ios::binary);
+
+    if (!infile.is_open())
+    {
+        return false;
+    }
+
+    infile.seekg(0, std::ios::end);
+    size_t fileSizeInBytes = infile.tellg();
+
+    Log::debug("File size in bytes: ", fileSizeInBytes);
+
+    data.resize(fileSizeInBytes);
+    infile.seekg(0, std::ios::beg);
+    infile.read(data.data(), fileSizeInBytes);
+    return true;
+}
+
+void FileIndexBuilder::addFields(uint32_t document, const std::vector<char>& page)
+{
+    fieldWordsFrequencies.clear();
+    tokenizer.forEachToken(extractTitle(page), token, [this](const textnorm::TokenView& word) {
+        ++fieldWordsFrequencies[word.str()];
+    });
+    if (!fieldWordsFrequencies.empty())
+    {
+        partialIndex.addFieldWords(TitleField, document, fieldWordsFrequencies);
+    }
+
+    std::string pageUrl = urlMapping->getUrl(document);
+    if (pageUrl.empty())
+    {
+        return;
+    }
+    for (const Anchor& anchor : extractAnchors(pageUrl, page))
+    {
+        int64_t target = urlMapping->findDocument(anchor.url);
+        if (target < 0 || target == document)
+        {
+            continue;
+        }
+        fieldWordsFrequencies.clear();
+        tokenizer.forEachToken(anchor.text, token, [this](const textnorm::TokenView& word) {
+            ++fieldWordsFrequencies[word.str()];
+        });
+        if (!fieldWordsFrequencies.empty())
+        {
+            partialIndex.addFieldWords(AnchorField, target, fieldWordsFrequencies);
+        }
+    }
+}
+
+void FileIndexBuilder::spill()
+{
+    std::string runPath = runRegistry.newRunPath();
+    Log::info("Spilling ", partialIndex.memoryUsage(), " bytes to run ", runPath);
+    partialIndex.writeRun(runPath);
+}
+
+} // namespace fileindex
@@ -0,0 +1,76 @@
+#ifndef FILE_INDEX_BUILDER_HPP
+#define FILE_INDEX_BUILDER_HPP
+
+#include <mutex>
+#include <vector>
+
+#include "filecrawler/fileprocessor.hpp"
+#include "textnorm/tokenizer.hpp"
+
+#include "html_fields.hpp"
+#include "posting_run.hpp"
+
+namespace fileindex
+{
+
+using filecrawler::FileProcessor;
+using filecrawler::ConcurrentQueue;
+
+// Hands out run file names in a temporary directory and remembers all written runs
+class RunRegistry
+{
+public:
+    explicit RunRegistry(const std::string& directory);
+
+    std::string newRunPath();
+
+    std::vector<std::string> getRunPaths() const;
+
+private:
+    std::string directory;
+    std::vector<std::string> runPaths;
+    mutable std::mutex registryMutex;
+};
+
+// Indexes files named DOCUMENT_ID.ext into a PartialIndex,
+// spilling it as a sorted run whenever memoryBudget bytes are used.
+// Words are normalized by the tokenizer and numbered in the document from 0 to get their positions.
+// Html pages are indexed by their text without markup. Given the urls mapping, words of
+// the page title are indexed in the title field and words of links to other documents
+// in the anchor field of the linked document, taking the page of an extracted text file
+// from the pages directory of the mapping.
+class FileIndexBuilder : public FileProcessor
+{
+public:
+    FileIndexBuilder(ConcurrentQueue<std::string>& filesForProcessingQueue,
+                     RunRegistry& runRegistry, size_t memoryBudget, bool withPositions,
+                     const textnorm::Tokenizer& tokenizer, const UrlMapping* urlMapping = nullptr);
+
+    ~FileIndexBuilder();
+
+private:
+    void mergeThreadResources();
+
+    bool process(const std::string& path);
+
+    static bool readFile(const std::string& path, std::vector<char>& data);
+
+    void addFields(uint32_t document, const std::vector<char>& page);
+
+    void spill();
+
+    PartialIndex partialIndex;
+    const textnorm::Tokenizer& tokenizer;
+    std::string token;
+    std::vector<char> data;
+    std::vector<char> page;
+    std::unordered_map<std::string, std::vector<uint32_t>> documentWordsPositions;
+    std::unordered_map<std::string, uint32_t> fieldWordsFrequencies;
+    RunRegistry& runRegistry;
+    size_t memoryBudget;
+    const UrlMapping* urlMapping;
+};
+
+} // namespace fileindex
+
+#endif // FILE_INDEX_BUILDER_HPP
@@ -0,0 +1,126 @@
+#include "html_fields.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/regex.hpp>
+
+#include "crawler/url_utils.hpp"
+
+namespace fileindex
+{
+
+const boost::regex anchorEndRegex("<\\s*/\\s*a\\s*>", boost::regex::normal | boost::regbase::icase);
+
+const boost::regex invisibleRegex("<!--.*?-->|<\\s*(script|style)[^>]*>.*?<\\s*/\\s*\\1\\s*>",
+                                  boost::regex::normal | boost::regbase::icase);
+
+const boost::regex titleRegex("<\\s*title[^>]*>(.*?)<\\s*/\\s*title\\s*>",
+                              boost::regex::normal | boost::regbase::icase);
+
+const boost::regex tagRegex("<[^>]*>|&#?[0-9a-zA-Z]+;");
+
+UrlMapping::UrlMapping(const std::string& path, const std::string& pagesDirectory):
+    pagesDirectory(pagesDirectory)
+{
+    std::ifstream input(path);
+    if (!input.is_open())
+    {
+        throw std::runtime_error("Can't open urls mapping " + path);
+    }
+    std::string filename;
+    std::string url;
+    while (input >> filename >> url)
+    {
+        size_t stemLength = filename.find('.');
+        if (stemLength == 0 || filename.find_first_not_of("0123456789") != stemLength)
+        {
+            continue;
+        }
+        uint32_t document = std::stoul(filename.substr(0, stemLength));
+        documents[normalize(url)] = document;
+        urls[document] = url;
+        pageNames[document] = filename;
+    }
+}
+
+int64_t UrlMapping::findDocument(const std::string& url) const
+{
+    auto it = documents.find(normalize(url));
+    return it == documents.end() ? -1 : static_cast<int64_t>(it->second);
+}
+
+std::string UrlMapping::getUrl(uint32_t document) const
+{
+    auto it = urls.find(document);
+    return it == urls.end() ? std::string() : it->second;
+}
+
+std::string UrlMapping::getPagePath(uint32_t document) const
+{
+    auto it = pageNames.find(document);
+    if (pagesDirectory.empty() || it == pageNames.end())
+    {
+        return std::string();
+    }
+    return (boost::filesystem::path(pagesDirectory) / it->second).string();
+}
+
+std::string UrlMapping::normalize(const std::string& url)
+{
+    size_t schemeEnd = url.find("://");
+    std::string normalized = url.substr(schemeEnd == std::string::npos ? 0 : schemeEnd + 3);
+    normalized = normalized.substr(0, normalized.find('#'));
+    while (!normalized.empty() && normalized.back() == '/')
+    {
+        normalized.resize(normalized.size() - 1);
+    }
+    return normalized;
+}
+
+std::string extractTitle(const std::vector<char>& data)
+{
+    boost::match_results<std::vector<char>::const_iterator> matches;
+    if (!boost::regex_search(data.begin(), data.end(), matches, titleRegex))
+    {
+        return std::string();
+    }
+    return stripTags(std::string(matches[1].first, matches[1].second));
+}
+
+std::string extractText(const std::vector<char>& data)
+{
+    return stripTags(boost::regex_replace(std::string(data.begin(), data.end()), invisibleRegex, " "));
+}
+
+std::string stripTags(const std::string& text)
+{
+    return boost::regex_replace(text, tagRegex, " ");
+}
+
+std::vector<Anchor> extractAnchors(const std::string& pageUrl, const std::vector<char>& data)
+{
+    std::vector<Anchor> anchors;
+    std::string page(data.begin(), data.end());
+    boost::sregex_iterator it(page.begin(), page.end(), NCrawler::link_regex);
+    boost::sregex_iterator end;
+    for (; it != end; ++it)
+    {
+        std::vector<NCrawler::URL> urls = NCrawler::getUrls(pageUrl, it->str());
+        size_t textBegin = page.find('>', it->position() + it->length());
+        boost::smatch matches;
+        if (urls.empty() || textBegin == std::string::npos
+            || !boost::regex_search(page.cbegin() + textBegin + 1, page.cend(), matches, anchorEndRegex))
+        {
+            continue;
+        }
+        Anchor anchor;
+        anchor.url = urls.front();
+        anchor.text = stripTags(std::string(page.cbegin() + textBegin + 1, matches[0].first));
+        anchors.push_back(anchor);
+    }
+    return anchors;
+}
+
+} // namespace fileindex
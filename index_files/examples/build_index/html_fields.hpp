@@ -0,0 +1,59 @@
+#ifndef HTML_FIELDS_HPP
+#define HTML_FIELDS_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fileindex
+{
+
+// URLs and html pages of documents from the mapping written by flatten, lines "N.html URL".
+// URLs are compared without the scheme, the fragment and trailing slashes.
+class UrlMapping
+{
+public:
+    UrlMapping(const std::string& path, const std::string& pagesDirectory);
+
+    // -1 if the URL is not in the mapping
+    int64_t findDocument(const std::string& url) const;
+
+    // Empty if the document is not in the mapping
+    std::string getUrl(uint32_t document) const;
+
+    // Path of the html page of the document in the pages directory,
+    // empty if the document is not in the mapping or no directory is given
+    std::string getPagePath(uint32_t document) const;
+
+private:
+    static std::string normalize(const std::string& url);
+
+    std::string pagesDirectory;
+    std::unordered_map<std::string, uint32_t> documents;
+    std::unordered_map<uint32_t, std::string> urls;
+    std::unordered_map<uint32_t, std::string> pageNames;
+};
+
+struct Anchor
+{
+    std::string url;
+    std::string text;
+};
+
+// Text of the title element of the page, empty if it has none
+std::string extractTitle(const std::vector<char>& data);
+
+// Text of the page without scripts, styles and comments
+std::string extractText(const std::vector<char>& data);
+
+// Text with markup tags and character references replaced by spaces
+std::string stripTags(const std::string& text);
+
+// Links of the page found and resolved against pageUrl by the crawler's getUrls,
+// with the text up to the closing </a> of every link
+std::vector<Anchor> extractAnchors(const std::string& pageUrl, const std::vector<char>& data);
+
+} // namespace fileindex
+
+#endif // HTML_FIELDS_HPP
@@ -0,0 +1,82 @@
+#include "index_builder.hpp"
+
+#include <memory>
+#include <boost/filesystem.hpp>
+
+#include "filecrawler/filefinder.hpp"
+
+#include "file_index_builder.hpp"
+#include "html_fields.hpp"
+#include "run_merger.hpp"
+
+namespace fileindex
+{
+
+using filecrawler::FileFinder;
+
+IndexBuilder::IndexBuilder(size_t threadsNumber, size_t memoryBudget, const std::string& temporaryDirectory,
+                           bool withPositions, const std::string& urlMappingPath, const std::string& pagesDirectory,
+                           const textnorm::NormalizerOptions& normalizerOptions):
+    threadsNumber(threadsNumber), memoryBudget(memoryBudget), temporaryDirectory(temporaryDirectory),
+    withPositions(withPositions), urlMappingPath(urlMappingPath), pagesDirectory(pagesDirectory),
+    tokenizer(normalizerOptions)
+{
+}
+
+IndexBuilder::~IndexBuilder()
+{
+}
+
+size_t IndexBuilder::build(const std::vector<std::string>& paths, boost::regex fileFilterRegex,
+                           const std::string& dictionaryPath, const std::string& indexPath)
+{
+    boost::filesystem::create_directories(temporaryDirectory);
+
+    std::unique_ptr<UrlMapping> urlMapping;
+    if (!urlMappingPath.empty())
+    {
+        urlMapping.reset(new UrlMapping(urlMappingPath, pagesDirectory));
+    }
+
+    RunRegistry runRegistry(temporaryDirectory);
+    ConcurrentQueue<std::string> filesForProcessingQueue;
+    FileFinder fileFinder(filesForProcessingQueue, fileFilterRegex);
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        fileFinder.addPathForProcessing(paths[i]);
+    }
+    fileFinder.start();
+
+    std::vector<std::shared_ptr<FileIndexBuilder>> fileIndexBuilders;
+    for (size_t i = 0; i < threadsNumber; ++i)
+    {
+        fileIndexBuilders.emplace_back(
+            new FileIndexBuilder(filesForProcessingQueue, runRegistry, memoryBudget / threadsNumber, withPositions,
+                                 tokenizer, urlMapping.get()));
+    }
+
+    for (size_t i = 0; i < threadsNumber; ++i)
+    {
+        fileIndexBuilders[i]->start();
+    }
+
+    fileFinder.wait();
+    for (size_t i = 0; i < threadsNumber; ++i)
+    {
+        fileIndexBuilders[i]->wait();
+    }
+
+    std::vector<std::string> runPaths = runRegistry.getRunPaths();
+    Log::info("Merging ", runPaths.size(), " runs");
+
+    size_t wordsNumber = RunMerger(runPaths, withPositions).merge(dictionaryPath, indexPath);
+
+    for (size_t i = 0; i < runPaths.size(); ++i)
+    {
+        boost::filesystem::remove(runPaths[i]);
+    }
+
+    return wordsNumber;
+}
+
+} // namespace fileindex
@@ -0,0 +1,43 @@
+#ifndef INDEX_BUILDER_HPP
+#define INDEX_BUILDER_HPP
+
+#include <string>
+#include <vector>
+#include <boost/regex.hpp>
+
+#include "textnorm/tokenizer.hpp"
+
+namespace fileindex
+{
+
+// Builds irindexer dictionary and index from a collection that may not fit into memory:
+// threads index files into partial indexes, spill them as sorted runs
+// and the runs are merged in one pass at the end. Title and anchor fields are indexed
+// when the urls mapping of the documents is given, from the html pages in pagesDirectory
+// unless the indexed files are the pages themselves.
+class IndexBuilder
+{
+public:
+    IndexBuilder(size_t threadsNumber, size_t memoryBudget, const std::string& temporaryDirectory,
+                 bool withPositions, const std::string& urlMappingPath = std::string(),
+                 const std::string& pagesDirectory = std::string(),
+                 const textnorm::NormalizerOptions& normalizerOptions = textnorm::NormalizerOptions());
+
+    ~IndexBuilder();
+
+    size_t build(const std::vector<std::string>& paths, boost::regex fileFilterRegex,
+                 const std::string& dictionaryPath, const std::string& indexPath);
+
+private:
+    size_t threadsNumber;
+    size_t memoryBudget;
+    std::string temporaryDirectory;
+    bool withPositions;
+    std::string urlMappingPath;
+    std::string pagesDirectory;
+    textnorm::Tokenizer tokenizer;
+};
+
+} // namespace fileindex
+
+#endif // INDEX_BUILDER_HPP
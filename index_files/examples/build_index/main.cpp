@@ -0,0 +1,111 @@
+#include <iostream>
+#include <boost/regex.hpp>
+#include <boost/program_options.hpp>
+
+#include "filecrawler/logger.hpp"
+
+#include "index_builder.hpp"
+
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+    size_t threadsNumber;
+    size_t memoryBudgetMegabytes;
+    std::string fileFilter;
+    std::string dictionaryPath;
+    std::string indexPath;
+    std::string temporaryDirectory;
+    std::string urlMappingPath;
+    std::string pagesDirectory;
+    std::vector<std::string> paths;
+    po::options_description generic("Generic options");
+    generic.add_options()
+        ("help", "produce help message")
+        ("threads,t", po::value<size_t>(&threadsNumber)->default_value(3), "set threads number")
+        ("memory,m", po::value<size_t>(&memoryBudgetMegabytes)->default_value(1024),
+            "set memory budget for partial indexes in megabytes")
+        ("filter", po::value<std::string>(&fileFilter)->default_value(".*\\.txt"), "set file name regex")
+        ("dictionary", po::value<std::string>(&dictionaryPath)->default_value("dictionary.txt"),
+            "set output dictionary file")
+        ("index", po::value<std::string>(&indexPath)->default_value("index.txt"), "set output index file")
+        ("tmp", po::value<std::string>(&temporaryDirectory)->default_value("index_runs"),
+            "set directory for sorted runs")
+        ("positions", "store positions of words in documents for phrase queries")
+        ("fields", po::value<std::string>(&urlMappingPath),
+            "index title and anchor text fields of html pages, given the urls mapping of flatten")
+        ("pages", po::value<std::string>(&pagesDirectory),
+            "set directory of the html pages of flatten to take the fields from when indexing extracted text")
+        ("stemming", "strip English plural endings of words, irindexer has to stem queries too")
+        ("stop-words", "skip the most frequent English words, irindexer has to skip them in queries too")
+        ("verbose,v", "set verbose")
+    ;
+
+    po::positional_options_description p;
+    p.add("path", -1);
+
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("path", po::value<std::vector<std::string>>(&paths), "input path")
+    ;
+
+    po::options_description cmdline_options;
+    cmdline_options.add(generic).add(hidden);
+
+    po::variables_map vm;
+
+    try
+    {
+        po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    }
+    catch (po::error& e)
+    {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << "Usage: " << argv[0] << " PATH" << std::endl;
+        std::cout << generic << std::endl;
+        return 1;
+    }
+
+    if (threadsNumber == 0)
+    {
+        std::cerr << "Wrong number of threads" << std::endl;
+        return 1;
+    }
+
+    if (!vm.count("path"))
+    {
+        std::cout << "Usage: " << argv[0] << " PATH" << std::endl;
+        std::cerr << "Try '" << argv[0] << " --help' for more information" << std::endl;
+        return 1;
+    }
+
+    if (vm.count("verbose"))
+    {
+        logging::Log::info.setVerbose(true);
+    }
+
+    if (vm.count("fields") && !vm.count("pages") && !boost::regex_match("1.html", boost::regex(fileFilter)))
+    {
+        std::cerr << "--fields needs --pages with the html pages of the extracted text files" << std::endl;
+        return 1;
+    }
+
+    textnorm::NormalizerOptions normalizerOptions;
+    normalizerOptions.stemming = vm.count("stemming") > 0;
+    normalizerOptions.stopWords = vm.count("stop-words") > 0;
+    fileindex::IndexBuilder indexBuilder(threadsNumber, memoryBudgetMegabytes << 20, temporaryDirectory,
+                                         vm.count("positions") > 0, urlMappingPath, pagesDirectory,
+                                         normalizerOptions);
+    size_t wordsNumber = indexBuilder.build(paths, boost::regex(fileFilter), dictionaryPath, indexPath);
+
+    logging::Log::info("Indexed ", wordsNumber, " words into ", dictionaryPath, " and ", indexPath);
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include "posting_run.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace fileindex
+{
+
+// Rough per-entry costs of hash table nodes and vector growth
+const size_t termOverhead = 64;
+const size_t postingOverhead = sizeof(Posting) * 3 / 2;
+
+const size_t runBufferSize = 1 << 20;
+
+const char* getDocumentFieldName(DocumentField field)
+{
+    static const char* names[documentFieldsNumber] = {"body", "title", "anchor"};
+    return names[field];
+}
+
+PartialIndex::PartialIndex(bool withPositions): withPositions(withPositions), memoryUsageEstimate(0)
+{
+}
+
+void PartialIndex::addDocument(uint32_t document,
+                               const std::unordered_map<std::string, std::vector<uint32_t>>& wordsPositions)
+{
+    for (auto it = wordsPositions.begin(); it != wordsPositions.end(); ++it)
+    {
+        std::vector<Posting>& postings = termPostings[BodyField][it->first];
+        if (postings.empty())
+        {
+            memoryUsageEstimate += it->first.size() + termOverhead;
+        }
+        postings.push_back(Posting(document, it->second.size()));
+        memoryUsageEstimate += postingOverhead;
+        if (withPositions)
+        {
+            std::vector<uint32_t>& positions = termPositions[it->first];
+            positions.insert(positions.end(), it->second.begin(), it->second.end());
+            memoryUsageEstimate += it->second.size() * sizeof(uint32_t) * 3 / 2;
+        }
+    }
+}
+
+void PartialIndex::addFieldWords(DocumentField field, uint32_t document,
+                                 const std::unordered_map<std::string, uint32_t>& wordsFrequencies)
+{
+    if (field == BodyField)
+    {
+        throw std::runtime_error("Body words are added with their positions");
+    }
+    for (auto it = wordsFrequencies.begin(); it != wordsFrequencies.end(); ++it)
+    {
+        std::vector<Posting>& postings = termPostings[field][it->first];
+        if (postings.empty())
+        {
+            memoryUsageEstimate += it->first.size() + termOverhead;
+        }
+        postings.push_back(Posting(document, it->second));
+        memoryUsageEstimate += postingOverhead;
+    }
+}
+
+size_t PartialIndex::memoryUsage() const
+{
+    return memoryUsageEstimate;
+}
+
+bool PartialIndex::empty() const
+{
+    for (size_t field = 0; field < documentFieldsNumber; ++field)
+    {
+        if (!termPostings[field].empty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PartialIndex::writeRun(const std::string& path)
+{
+    std::vector<char> outputBuffer(runBufferSize);
+    std::ofstream output;
+    output.rdbuf()->pubsetbuf(&outputBuffer[0], outputBuffer.size());
+    output.open(path, std::ios::binary);
+
+    if (!output.is_open())
+    {
+        throw std::runtime_error("Can't open run file " + path);
+    }
+
+    typedef std::pair<const std::string*, DocumentField> TermField;
+    std::vector<TermField> terms;
+    for (size_t field = 0; field < documentFieldsNumber; ++field)
+    {
+        for (auto it = termPostings[field].begin(); it != termPostings[field].end(); ++it)
+        {
+            terms.push_back(TermField(&it->first, static_cast<DocumentField>(field)));
+        }
+    }
+    std::sort(terms.begin(), terms.end(), [](const TermField& lhs, const TermField& rhs)
+    {
+        int comparison = lhs.first->compare(*rhs.first);
+        return comparison < 0 || (comparison == 0 && lhs.second < rhs.second);
+    });
+
+    std::vector<size_t> order;
+    std::vector<size_t> positionsOffsets;
+    std::vector<Posting> sortedPostings;
+    std::vector<uint32_t> sortedPositions;
+    for (const TermField& termField : terms)
+    {
+        const std::string* term = termField.first;
+        DocumentField field = termField.second;
+        bool fieldPositions = withPositions && field == BodyField;
+        const std::vector<Posting>& postings = termPostings[field][*term];
+
+        // Postings were added in the order documents were processed
+        order.resize(postings.size());
+        positionsOffsets.resize(postings.size());
+        size_t positionsOffset = 0;
+        for (size_t i = 0; i < postings.size(); ++i)
+        {
+            order[i] = i;
+            positionsOffsets[i] = positionsOffset;
+            positionsOffset += postings[i].frequency;
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t lhs, size_t rhs) { return postings[lhs] < postings[rhs]; });
+
+        const std::vector<uint32_t>& positions = termPositions[*term];
+        sortedPostings.clear();
+        sortedPositions.clear();
+        for (size_t i : order)
+        {
+            // Anchors of several pages to one document make one posting
+            if (field != BodyField && !sortedPostings.empty() &&
+                sortedPostings.back().document == postings[i].document)
+            {
+                sortedPostings.back().frequency += postings[i].frequency;
+                continue;
+            }
+            sortedPostings.push_back(postings[i]);
+            if (fieldPositions)
+            {
+                sortedPositions.insert(sortedPositions.end(), positions.begin() + positionsOffsets[i],
+                                       positions.begin() + positionsOffsets[i] + postings[i].frequency);
+            }
+        }
+
+        uint32_t termLength = term->size();
+        uint8_t fieldNumber = field;
+        uint32_t postingsNumber = sortedPostings.size();
+        output.write(reinterpret_cast<const char*>(&termLength), sizeof(termLength));
+        output.write(term->data(), termLength);
+        output.write(reinterpret_cast<const char*>(&fieldNumber), sizeof(fieldNumber));
+        output.write(reinterpret_cast<const char*>(&postingsNumber), sizeof(postingsNumber));
+        output.write(reinterpret_cast<const char*>(&sortedPostings[0]), postingsNumber * sizeof(Posting));
+        if (fieldPositions && !sortedPositions.empty())
+        {
+            output.write(reinterpret_cast<const char*>(&sortedPositions[0]),
+                         sortedPositions.size() * sizeof(uint32_t));
+        }
+    }
+
+    if (!output)
+    {
+        throw std::runtime_error("Failed to write run file " + path);
+    }
+
+    for (size_t field = 0; field < documentFieldsNumber; ++field)
+    {
+        termPostings[field].clear();
+    }
+    termPositions.clear();
+    memoryUsageEstimate = 0;
+}
+
+RunReader::RunReader(const std::string& path, bool withPositions):
+    withPositions(withPositions), inputBuffer(runBufferSize), currentField(BodyField)
+{
+    input.rdbuf()->pubsetbuf(&inputBuffer[0], inputBuffer.size());
+    input.open(path, std::ios::binary);
+
+    if (!input.is_open())
+    {
+        throw std::runtime_error("Can't open run file " + path);
+    }
+}
+
+bool RunReader::next()
+{
+    uint32_t termLength;
+    if (!input.read(reinterpret_cast<char*>(&termLength), sizeof(termLength)))
+    {
+        return false;
+    }
+    currentTerm.resize(termLength);
+    input.read(&currentTerm[0], termLength);
+
+    uint8_t fieldNumber = BodyField;
+    input.read(reinterpret_cast<char*>(&fieldNumber), sizeof(fieldNumber));
+    if (fieldNumber >= documentFieldsNumber)
+    {
+        throw std::runtime_error("Unknown field in run file");
+    }
+    currentField = static_cast<DocumentField>(fieldNumber);
+
+    uint32_t postingsNumber;
+    input.read(reinterpret_cast<char*>(&postingsNumber), sizeof(postingsNumber));
+    currentPostings.resize(postingsNumber);
+    input.read(reinterpret_cast<char*>(&currentPostings[0]), postingsNumber * sizeof(Posting));
+
+    currentPositions.clear();
+    if (withPositions && currentField == BodyField)
+    {
+        size_t positionsNumber = 0;
+        for (const Posting& posting : currentPostings)
+        {
+            positionsNumber += posting.frequency;
+        }
+        currentPositions.resize(positionsNumber);
+        if (positionsNumber > 0)
+        {
+            input.read(reinterpret_cast<char*>(&currentPositions[0]), positionsNumber * sizeof(uint32_t));
+        }
+    }
+
+    if (!input)
+    {
+        throw std::runtime_error("Truncated run file");
+    }
+    return true;
+}
+
+const std::string& RunReader::term() const
+{
+    return currentTerm;
+}
+
+DocumentField RunReader::field() const
+{
+    return currentField;
+}
+
+const std::vector<Posting>& RunReader::postings() const
+{
+    return currentPostings;
+}
+
+const std::vector<uint32_t>& RunReader::positions() const
+{
+    return currentPositions;
+}
+
+} // namespace fileindex
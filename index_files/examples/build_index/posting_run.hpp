@@ -0,0 +1,98 @@
+#ifndef POSTING_RUN_HPP
+#define POSTING_RUN_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace fileindex
+{
+
+// Fields of documents as named in irindexer text index lines "WORD_INDEX@title DOCUMENT:FREQUENCY ...".
+// The body is the whole text of the document and the only field with positions.
+enum DocumentField
+{
+    BodyField = 0,
+    TitleField = 1,
+    AnchorField = 2,
+    documentFieldsNumber
+};
+
+const char* getDocumentFieldName(DocumentField field);
+
+struct Posting
+{
+    Posting(): document(0), frequency(0) {}
+
+    Posting(uint32_t document, uint32_t frequency): document(document), frequency(frequency) {}
+
+    bool operator < (const Posting& other) const
+    {
+        return document < other.document;
+    }
+
+    uint32_t document;
+    uint32_t frequency;
+};
+
+// Inverted index of the documents processed by one thread since the last spill.
+// Spilled as a run: records (term, field, postings[, positions]) sorted by term and field,
+// postings sorted by document. Positions of a body posting are as many as its frequency
+// and follow in the same order.
+class PartialIndex
+{
+public:
+    explicit PartialIndex(bool withPositions);
+
+    void addDocument(uint32_t document, const std::unordered_map<std::string, std::vector<uint32_t>>& wordsPositions);
+
+    // Words of a field other than the body. A document may get words of its anchor field
+    // from many pages, their frequencies add up.
+    void addFieldWords(DocumentField field, uint32_t document,
+                       const std::unordered_map<std::string, uint32_t>& wordsFrequencies);
+
+    size_t memoryUsage() const;
+
+    bool empty() const;
+
+    void writeRun(const std::string& path);
+
+private:
+    bool withPositions;
+    std::unordered_map<std::string, std::vector<Posting>> termPostings[documentFieldsNumber];
+    std::unordered_map<std::string, std::vector<uint32_t>> termPositions;
+    size_t memoryUsageEstimate;
+};
+
+// Sequential reader of one run
+class RunReader
+{
+public:
+    RunReader(const std::string& path, bool withPositions);
+
+    bool next();
+
+    const std::string& term() const;
+
+    DocumentField field() const;
+
+    const std::vector<Posting>& postings() const;
+
+    // Empty if the run has no positions or the field is not the body
+    const std::vector<uint32_t>& positions() const;
+
+private:
+    bool withPositions;
+    std::ifstream input;
+    std::vector<char> inputBuffer;
+    std::string currentTerm;
+    DocumentField currentField;
+    std::vector<Posting> currentPostings;
+    std::vector<uint32_t> currentPositions;
+};
+
+} // namespace fileindex
+
+#endif // POSTING_RUN_HPP
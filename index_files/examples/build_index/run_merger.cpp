@@ -0,0 +1,142 @@
+#include "run_merger.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+
+#include "filecrawler/logger.hpp"
+
+using namespace logging;
+
+namespace fileindex
+{
+
+const size_t outputBufferSize = 1 << 20;
+
+RunMerger::RunMerger(const std::vector<std::string>& runPaths, bool withPositions): withPositions(withPositions)
+{
+    for (size_t i = 0; i < runPaths.size(); ++i)
+    {
+        runReaders.push_back(std::make_shared<RunReader>(runPaths[i], withPositions));
+    }
+}
+
+size_t RunMerger::merge(const std::string& dictionaryPath, const std::string& indexPath)
+{
+    std::vector<char> dictionaryBuffer(outputBufferSize);
+    std::ofstream dictionary;
+    dictionary.rdbuf()->pubsetbuf(&dictionaryBuffer[0], dictionaryBuffer.size());
+    dictionary.open(dictionaryPath);
+
+    std::vector<char> indexBuffer(outputBufferSize);
+    std::ofstream index;
+    index.rdbuf()->pubsetbuf(&indexBuffer[0], indexBuffer.size());
+    index.open(indexPath);
+
+    if (!dictionary.is_open() || !index.is_open())
+    {
+        throw std::runtime_error("Can't open output files " + dictionaryPath + ", " + indexPath);
+    }
+
+    // Runs are ordered by term and then by field, the body first
+    typedef std::tuple<std::string, int, size_t> HeapEntry;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+    for (size_t i = 0; i < runReaders.size(); ++i)
+    {
+        if (runReaders[i]->next())
+        {
+            heap.push(HeapEntry(runReaders[i]->term(), runReaders[i]->field(), i));
+        }
+    }
+
+    // Posting with the offset of its positions in the merged positions
+    typedef std::pair<Posting, size_t> MergedPosting;
+
+    size_t wordIndex = 0;
+    std::vector<MergedPosting> postings;
+    std::vector<uint32_t> positions;
+    std::string line;
+    while (!heap.empty())
+    {
+        std::string term = std::get<0>(heap.top());
+        uint64_t frequency = 0;
+        while (!heap.empty() && std::get<0>(heap.top()) == term)
+        {
+            int field = std::get<1>(heap.top());
+            bool fieldPositions = withPositions && field == BodyField;
+            postings.clear();
+            positions.clear();
+            while (!heap.empty() && std::get<0>(heap.top()) == term && std::get<1>(heap.top()) == field)
+            {
+                size_t reader = std::get<2>(heap.top());
+                heap.pop();
+                const std::vector<Posting>& runPostings = runReaders[reader]->postings();
+                size_t positionsOffset = positions.size();
+                for (const Posting& posting : runPostings)
+                {
+                    postings.push_back(MergedPosting(posting, positionsOffset));
+                    positionsOffset += posting.frequency;
+                }
+                const std::vector<uint32_t>& runPositions = runReaders[reader]->positions();
+                positions.insert(positions.end(), runPositions.begin(), runPositions.end());
+                if (runReaders[reader]->next())
+                {
+                    heap.push(HeapEntry(runReaders[reader]->term(), runReaders[reader]->field(), reader));
+                }
+            }
+            // Every run is sorted by document and runs hold disjoint documents,
+            // except anchors which come from the pages linking to the document
+            std::sort(postings.begin(), postings.end(),
+                      [](const MergedPosting& lhs, const MergedPosting& rhs) { return lhs.first < rhs.first; });
+
+            line = std::to_string(wordIndex);
+            if (field != BodyField)
+            {
+                line += '@';
+                line += getDocumentFieldName(static_cast<DocumentField>(field));
+            }
+            for (size_t i = 0; i < postings.size(); ++i)
+            {
+                Posting posting = postings[i].first;
+                while (field != BodyField && i + 1 < postings.size() &&
+                       postings[i + 1].first.document == posting.document)
+                {
+                    posting.frequency += postings[++i].first.frequency;
+                }
+                line += ' ';
+                line += std::to_string(posting.document);
+                line += ':';
+                line += std::to_string(posting.frequency);
+                if (fieldPositions)
+                {
+                    for (uint32_t j = 0; j < posting.frequency; ++j)
+                    {
+                        line += (j == 0) ? ':' : ',';
+                        line += std::to_string(positions[postings[i].second + j]);
+                    }
+                }
+                if (field == BodyField)
+                {
+                    frequency += posting.frequency;
+                }
+            }
+            line += '\n';
+            index << line;
+        }
+        dictionary << term << ' ' << wordIndex << ' ' << frequency << '\n';
+        ++wordIndex;
+    }
+
+    if (!dictionary || !index)
+    {
+        throw std::runtime_error("Failed to write output files " + dictionaryPath + ", " + indexPath);
+    }
+
+    Log::info("Merged ", runReaders.size(), " runs into ", wordIndex, " words");
+    return wordIndex;
+}
+
+} // namespace fileindex
@@ -0,0 +1,32 @@
+#ifndef RUN_MERGER_HPP
+#define RUN_MERGER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "posting_run.hpp"
+
+namespace fileindex
+{
+
+// K-way merge of sorted runs into irindexer text dictionary and index.
+// Words are numbered in lexicographic order, dictionary frequency is
+// the total number of occurrences of the word in bodies. Runs with positions are merged
+// into postings "document:frequency:position,...". Title and anchor postings of the word
+// follow in lines "wordIndex@title ..." and "wordIndex@anchor ...".
+class RunMerger
+{
+public:
+    RunMerger(const std::vector<std::string>& runPaths, bool withPositions);
+
+    size_t merge(const std::string& dictionaryPath, const std::string& indexPath);
+
+private:
+    bool withPositions;
+    std::vector<std::shared_ptr<RunReader>> runReaders;
+};
+
+} // namespace fileindex
+
+#endif // RUN_MERGER_HPP
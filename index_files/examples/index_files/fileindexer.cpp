@@ -1,7 +1,6 @@
 #include "fileindexer.hpp"
 
 #include <fstream>
-#include <cctype>
 #include <array>
 #include <boost/optional.hpp>
 
@@ -51,22 +50,9 @@ bool FileIndexer::process(const std::string& path)
     infile.seekg(0, std::ios::beg);
     infile.read(&data[0], fileSizeInBytes);
 
-    std::string currentWord;
-    for (size_t i = 0; i <= data.size(); ++i)
-    {
-        if (i != data.size() && isalnum(data[i]))
-        {
-            currentWord += tolower(data[i]);
-        }
-        else
-        {
-            if (!currentWord.empty())
-            {
-                ++localWordsFrequencyTable[currentWord];
-                currentWord.clear();
-            }
-        }
-    }
+    tokenizer.forEachToken(data, token, [this](const textnorm::TokenView& word) {
+        ++localWordsFrequencyTable[word.str()];
+    });
     return true;
 }
 
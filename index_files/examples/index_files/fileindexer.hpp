@@ -4,6 +4,7 @@
 #include <thread>
 
 #include "filecrawler/fileprocessor.hpp"
+#include "textnorm/tokenizer.hpp"
 
 #include "concurrent_frequency_table.hpp"
 
@@ -26,6 +27,8 @@ private:
 
     bool process(const std::string& path);
 
+    textnorm::Tokenizer tokenizer;
+    std::string token;
     std::unordered_map<std::string, int> localWordsFrequencyTable;
     ConcurrentFrequencyTable& wordsFrequencyTable;
 };
@@ -6,6 +6,7 @@
 #include <sstream>
 
 #include "filecrawler/concurrent_queue.hpp"
+#include "textnorm/tokenizer.hpp"
 
 #include "html_utils.hpp"
 
@@ -37,23 +38,15 @@ struct DocumentInfo {
     size_t size;
 };
 
+// Words of at least two characters, normalized as by the indexers, so pages differing
+// only in case or punctuation get the same simhash
 std::vector<std::string> tokenize(const std::string& text) {
-    std::vector<std::string> tokens;
-    std::string word;
-    for (size_t i = 0; i < text.size(); ++i) {
-        if (isspace(text[i]) || !isprint(text[i])) {
-            if (word.length() > 1) {
-                tokens.push_back(word);
-                word = "";
-            }
-        } else {
-            word += text[i];
-        }
-    }
-    if (!word.empty()) {
-        tokens.push_back(word);
-    }
-    return std::move(tokens);
+    static const textnorm::Tokenizer tokenizer = [] {
+        textnorm::NormalizerOptions options;
+        options.minLength = 2;
+        return textnorm::Tokenizer(options);
+    }();
+    return tokenizer.tokenize(text);
 }
 
 class SimhashCalculator {
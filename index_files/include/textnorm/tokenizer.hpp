@@ -0,0 +1,428 @@
+#ifndef TEXTNORM_TOKENIZER_HPP
+#define TEXTNORM_TOKENIZER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace textnorm
+{
+
+// Normalized token, valid until the tokenizer writes the next one into its buffer
+struct TokenView
+{
+    TokenView(const char* data, size_t size): data(data), size(size) {}
+
+    std::string str() const
+    {
+        return std::string(data, size);
+    }
+
+    const char* data;
+    size_t size;
+};
+
+struct NormalizerOptions
+{
+    NormalizerOptions(): stemming(false), stopWords(false), minLength(1) {}
+
+    // Strips English plural endings
+    bool stemming;
+    // Drops the most frequent English words
+    bool stopWords;
+    // Shorter tokens, in characters, are dropped
+    size_t minLength;
+    // ASCII punctuation kept inside words as is, like operators of query words.
+    // Tokens with these characters are neither stemmed nor dropped as stop words.
+    std::string wordCharacters;
+};
+
+// Case folding and word characters of Unicode code points. Latin, Greek and Cyrillic
+// below U+0500 are looked up in tables, punctuation and symbols above are delimiter ranges.
+class UnicodeTable
+{
+public:
+    static const UnicodeTable& instance()
+    {
+        static const UnicodeTable table;
+        return table;
+    }
+
+    bool isDelimiter(uint32_t codePoint) const
+    {
+        if (codePoint < tableSize)
+        {
+            return delimiter[codePoint];
+        }
+        return (codePoint >= 0x2000 && codePoint <= 0x2BFF) || (codePoint >= 0x2E00 && codePoint <= 0x2E7F)
+            || (codePoint >= 0x3000 && codePoint <= 0x303F) || (codePoint >= 0xFE10 && codePoint <= 0xFE1F)
+            || (codePoint >= 0xFE30 && codePoint <= 0xFE6F) || (codePoint >= 0xFF00 && codePoint <= 0xFF0F)
+            || (codePoint >= 0xFF1A && codePoint <= 0xFF20) || (codePoint >= 0xFF3B && codePoint <= 0xFF40)
+            || (codePoint >= 0xFF5B && codePoint <= 0xFF65) || (codePoint >= 0xFFF0 && codePoint <= 0xFFFF)
+            || (codePoint >= 0x1F000 && codePoint <= 0x1FAFF);
+    }
+
+    uint32_t toLower(uint32_t codePoint) const
+    {
+        if (codePoint < tableSize)
+        {
+            return lower[codePoint];
+        }
+        if (codePoint >= 0xFF21 && codePoint <= 0xFF3A)
+        {
+            return codePoint + 0x20;
+        }
+        return codePoint;
+    }
+
+private:
+    static const uint32_t tableSize = 0x500;
+
+    UnicodeTable()
+    {
+        for (uint32_t codePoint = 0; codePoint < tableSize; ++codePoint)
+        {
+            lower[codePoint] = codePoint;
+            delimiter[codePoint] = false;
+        }
+        for (uint32_t codePoint = 0; codePoint < 0x80; ++codePoint)
+        {
+            delimiter[codePoint] = !isalnumAscii(codePoint);
+            if (codePoint >= 'A' && codePoint <= 'Z')
+            {
+                lower[codePoint] = codePoint + 0x20;
+            }
+        }
+        // Controls, no-break space and Latin-1 punctuation and symbols, but ª µ º
+        for (uint32_t codePoint = 0x80; codePoint < 0xC0; ++codePoint)
+        {
+            delimiter[codePoint] = codePoint != 0xAA && codePoint != 0xB5 && codePoint != 0xBA;
+        }
+        delimiter[0xD7] = delimiter[0xF7] = true;
+        delimiter[0x37E] = delimiter[0x387] = delimiter[0x482] = true;
+
+        lowerRange(0xC0, 0xDE, 0x20);
+        lower[0xD7] = 0xD7;
+        lowerPairs(0x100, 0x12F);
+        lower[0x130] = 'i';
+        lowerPairs(0x132, 0x137);
+        lowerPairs(0x139, 0x148);
+        lowerPairs(0x14A, 0x177);
+        lower[0x178] = 0xFF;
+        lowerPairs(0x179, 0x17E);
+        lowerPairs(0x1CD, 0x1DC);
+        lowerPairs(0x1DE, 0x1EF);
+        lowerPairs(0x1F8, 0x21F);
+        lowerPairs(0x222, 0x233);
+
+        lower[0x386] = 0x3AC;
+        lowerRange(0x388, 0x38A, 0x25);
+        lower[0x38C] = 0x3CC;
+        lowerRange(0x38E, 0x38F, 0x3F);
+        lowerRange(0x391, 0x3A9, 0x20);
+        lower[0x3A2] = 0x3A2;
+        lowerPairs(0x3D8, 0x3EF);
+
+        lowerRange(0x400, 0x40F, 0x50);
+        lowerRange(0x410, 0x42F, 0x20);
+        lowerPairs(0x460, 0x481);
+        lowerPairs(0x48A, 0x4BF);
+        lower[0x4C0] = 0x4CF;
+        lowerPairs(0x4C1, 0x4CE);
+        lowerPairs(0x4D0, 0x4FF);
+    }
+
+    static bool isalnumAscii(uint32_t c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    void lowerRange(uint32_t first, uint32_t last, uint32_t offset)
+    {
+        for (uint32_t codePoint = first; codePoint <= last; ++codePoint)
+        {
+            lower[codePoint] = codePoint + offset;
+        }
+    }
+
+    // Upper case letters at first, first + 2, ... followed by their lower case
+    void lowerPairs(uint32_t first, uint32_t last)
+    {
+        for (uint32_t codePoint = first; codePoint < last; codePoint += 2)
+        {
+            lower[codePoint] = codePoint + 1;
+        }
+    }
+
+    uint32_t lower[tableSize];
+    bool delimiter[tableSize];
+};
+
+// Splits UTF-8 text into words of letters and digits, folds their case and optionally
+// stems them and drops stop words. Bytes are classified by a table and ASCII letters
+// are lowercased by it, only multibyte sequences are decoded. Malformed sequences are
+// delimiters. The tokenizer is immutable and may be shared by threads: every caller
+// passes its own buffer for the token, which keeps its capacity between tokens and texts,
+// so tokenization allocates nothing once the buffer has grown to the longest word.
+class Tokenizer
+{
+public:
+    explicit Tokenizer(const NormalizerOptions& options = NormalizerOptions()): options(options)
+    {
+        const UnicodeTable& unicode = UnicodeTable::instance();
+        for (size_t c = 0; c < 256; ++c)
+        {
+            lower[c] = static_cast<char>(c);
+            if (c < 0x80)
+            {
+                classes[c] = unicode.isDelimiter(c) ? DelimiterByte : WordByte;
+                lower[c] = static_cast<char>(unicode.toLower(c));
+            }
+            else if (c >= 0xC2 && c <= 0xDF)
+            {
+                classes[c] = LeadByte2;
+            }
+            else if (c >= 0xE0 && c <= 0xEF)
+            {
+                classes[c] = LeadByte3;
+            }
+            else if (c >= 0xF0 && c <= 0xF4)
+            {
+                classes[c] = LeadByte4;
+            }
+            else
+            {
+                classes[c] = DelimiterByte;
+            }
+        }
+        for (char c : options.wordCharacters)
+        {
+            if (static_cast<unsigned char>(c) < 0x80 && classes[static_cast<unsigned char>(c)] == DelimiterByte)
+            {
+                classes[static_cast<unsigned char>(c)] = OperatorByte;
+            }
+        }
+    }
+
+    const NormalizerOptions& getOptions() const
+    {
+        return options;
+    }
+
+    // Passes every normalized token of [begin, end) to callback as a TokenView into token
+    template <typename Callback>
+    void forEachToken(const char* begin, const char* end, std::string& token, Callback callback) const
+    {
+        const UnicodeTable& unicode = UnicodeTable::instance();
+        const unsigned char* position = reinterpret_cast<const unsigned char*>(begin);
+        const unsigned char* last = reinterpret_cast<const unsigned char*>(end);
+        TokenState state;
+        token.clear();
+        while (position != last)
+        {
+            unsigned char c = *position;
+            switch (classes[c])
+            {
+            case WordByte:
+                token += lower[c];
+                ++state.length;
+                ++position;
+                continue;
+            case OperatorByte:
+                token += static_cast<char>(c);
+                ++state.length;
+                state.hasOperators = true;
+                ++position;
+                continue;
+            case DelimiterByte:
+                finishToken(token, state, callback);
+                ++position;
+                continue;
+            default:
+                break;
+            }
+
+            size_t sequenceLength = classes[c] - LeadByte2 + 2;
+            uint32_t codePoint = 0;
+            if (!decode(position, last, sequenceLength, codePoint) || unicode.isDelimiter(codePoint))
+            {
+                finishToken(token, state, callback);
+                ++position;
+                continue;
+            }
+            appendUtf8(unicode.toLower(codePoint), token);
+            ++state.length;
+            position += sequenceLength;
+        }
+        finishToken(token, state, callback);
+    }
+
+    // Text is a vector<char> or a string
+    template <typename Text, typename Callback>
+    void forEachToken(const Text& text, std::string& token, Callback callback) const
+    {
+        const char* begin = text.empty() ? nullptr : &text[0];
+        forEachToken(begin, begin + text.size(), token, callback);
+    }
+
+    template <typename Text>
+    std::vector<std::string> tokenize(const Text& text) const
+    {
+        std::vector<std::string> tokens;
+        std::string token;
+        forEachToken(text, token, [&tokens](const TokenView& view) { tokens.push_back(view.str()); });
+        return tokens;
+    }
+
+    // English stop words in lexicographic order
+    static const char* const* getStopWords(size_t& stopWordsNumber)
+    {
+        static const char* const stopWords[] = {
+            "a", "an", "and", "are", "as", "at", "be", "but", "by", "for", "if", "in", "into", "is", "it",
+            "no", "not", "of", "on", "or", "such", "that", "the", "their", "then", "there", "these", "they",
+            "this", "to", "was", "will", "with"
+        };
+        stopWordsNumber = sizeof(stopWords) / sizeof(stopWords[0]);
+        return stopWords;
+    }
+
+private:
+    enum ByteClass
+    {
+        DelimiterByte,
+        WordByte,
+        OperatorByte,
+        LeadByte2,
+        LeadByte3,
+        LeadByte4
+    };
+
+    struct TokenState
+    {
+        TokenState(): length(0), hasOperators(false) {}
+
+        size_t length;
+        bool hasOperators;
+    };
+
+    // Code point of the sequence at position, false if it is truncated, overlong or a surrogate
+    static bool decode(const unsigned char* position, const unsigned char* last, size_t sequenceLength,
+                       uint32_t& codePoint)
+    {
+        static const uint32_t leadMasks[5] = {0, 0, 0x1F, 0x0F, 0x07};
+        static const uint32_t minimums[5] = {0, 0, 0x80, 0x800, 0x10000};
+        if (static_cast<size_t>(last - position) < sequenceLength)
+        {
+            return false;
+        }
+        codePoint = position[0] & leadMasks[sequenceLength];
+        for (size_t i = 1; i < sequenceLength; ++i)
+        {
+            if ((position[i] & 0xC0) != 0x80)
+            {
+                return false;
+            }
+            codePoint = (codePoint << 6) | (position[i] & 0x3F);
+        }
+        return codePoint >= minimums[sequenceLength] && codePoint <= 0x10FFFF
+            && (codePoint < 0xD800 || codePoint > 0xDFFF);
+    }
+
+    static void appendUtf8(uint32_t codePoint, std::string& token)
+    {
+        if (codePoint < 0x80)
+        {
+            token += static_cast<char>(codePoint);
+        }
+        else if (codePoint < 0x800)
+        {
+            token += static_cast<char>(0xC0 | (codePoint >> 6));
+            token += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            token += static_cast<char>(0xE0 | (codePoint >> 12));
+            token += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            token += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            token += static_cast<char>(0xF0 | (codePoint >> 18));
+            token += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            token += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            token += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    template <typename Callback>
+    void finishToken(std::string& token, TokenState& state, Callback& callback) const
+    {
+        if (token.empty())
+        {
+            return;
+        }
+        bool keep = state.length >= options.minLength;
+        if (keep && !state.hasOperators)
+        {
+            keep = !(options.stopWords && isStopWord(token));
+            if (keep && options.stemming)
+            {
+                stem(token);
+            }
+        }
+        if (keep)
+        {
+            callback(TokenView(token.data(), token.size()));
+        }
+        token.clear();
+        state = TokenState();
+    }
+
+    static bool isStopWord(const std::string& token)
+    {
+        size_t stopWordsNumber;
+        const char* const* stopWords = getStopWords(stopWordsNumber);
+        const char* const* found = std::lower_bound(stopWords, stopWords + stopWordsNumber, token,
+            [](const char* stopWord, const std::string& word) { return word.compare(stopWord) > 0; });
+        return found != stopWords + stopWordsNumber && token.compare(*found) == 0;
+    }
+
+    static bool endsWith(const std::string& token, const char* suffix)
+    {
+        size_t suffixLength = std::strlen(suffix);
+        return token.size() >= suffixLength && token.compare(token.size() - suffixLength, suffixLength, suffix) == 0;
+    }
+
+    // S-stemmer of Harman: "ies" becomes "y", "es" becomes "e" and "s" is dropped,
+    // unless the word ends with "eies", "aies", "aes", "ees", "oes", "us" or "ss"
+    static void stem(std::string& token)
+    {
+        if (token.size() <= 3)
+        {
+            return;
+        }
+        if (endsWith(token, "ies") && !endsWith(token, "eies") && !endsWith(token, "aies"))
+        {
+            token.replace(token.size() - 3, 3, "y");
+        }
+        else if (endsWith(token, "es") && !endsWith(token, "aes") && !endsWith(token, "ees")
+                 && !endsWith(token, "oes"))
+        {
+            token.resize(token.size() - 1);
+        }
+        else if (endsWith(token, "s") && !endsWith(token, "us") && !endsWith(token, "ss"))
+        {
+            token.resize(token.size() - 1);
+        }
+    }
+
+    NormalizerOptions options;
+    unsigned char classes[256];
+    char lower[256];
+};
+
+} // namespace textnorm
+
+#endif // TEXTNORM_TOKENIZER_HPP
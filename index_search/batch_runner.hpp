@@ -0,0 +1,146 @@
+#ifndef BATCH_RUNNER_HPP
+#define BATCH_RUNNER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "search_engine.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Runs all queries of a file, one per line, on a pool of threads sharing one SearchEngine.
+// Top documents are written as TSV lines "QUERY_NUMBER RANK DOCUMENT SCORE" in the order
+// of queries, queries are numbered from 0. Reports throughput and latency percentiles
+// of the whole query and of every phase of ProfiledPhraseSearch. Every thread searches
+// with its own QueryContext, so queries don't allocate once its buffers have grown.
+template<typename ScoreEvaluator>
+class BatchRunner {
+public:
+    BatchRunner(const SearchEngine& searchEngine, size_t threadsNumber, size_t topNumber)
+        : searchEngine(searchEngine)
+        , threadsNumber(std::max<size_t>(threadsNumber, 1))
+        , topNumber(topNumber)
+    { }
+
+    void run(const string& queriesPath, const string& outputPath) {
+        vector<string> queries = readQueries(queriesPath);
+        std::cerr << "Running " << queries.size() << " queries on " << threadsNumber << " threads" << std::endl;
+
+        vector<vector<SearchEngine::DocumentScore>> results(queries.size());
+        vector<SearchEngine::QueryProfile> profiles(queries.size());
+        vector<double> latencies(queries.size());
+        std::atomic<size_t> nextQuery{0};
+        auto work = [&] {
+            SearchEngine::QueryContext context;
+            for (size_t i = nextQuery++; i < queries.size(); i = nextQuery++) {
+                Clock::time_point startTime = Clock::now();
+                const vector<SearchEngine::DocumentScore>& top =
+                    searchEngine.ProfiledPhraseSearch<ScoreEvaluator>(queries[i], topNumber, profiles[i], context);
+                latencies[i] = std::chrono::duration<double, std::micro>(Clock::now() - startTime).count();
+                results[i].assign(top.begin(), top.end());
+            }
+        };
+
+        Clock::time_point startTime = Clock::now();
+        vector<std::thread> threads;
+        for (size_t i = 1; i < threadsNumber; ++i) {
+            threads.push_back(std::thread(work));
+        }
+        work();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+        writeResults(results, outputPath);
+        printReport(profiles, latencies, seconds);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static vector<string> readQueries(const string& queriesPath) {
+        std::ifstream input(queriesPath);
+        if (!input.is_open()) {
+            throw std::logic_error("Can't open file " + queriesPath);
+        }
+        vector<string> queries;
+        string query;
+        while (std::getline(input, query)) {
+            queries.push_back(query);
+        }
+        return queries;
+    }
+
+    static void writeResults(const vector<vector<SearchEngine::DocumentScore>>& results, const string& outputPath) {
+        std::ofstream output(outputPath);
+        if (!output.is_open()) {
+            throw std::logic_error("Can't open file " + outputPath);
+        }
+        for (size_t i = 0; i < results.size(); ++i) {
+            for (size_t rank = 0; rank < results[i].size(); ++rank) {
+                output << i << '\t' << rank + 1 << '\t' << results[i][rank].documentIndex
+                       << '\t' << results[i][rank].score << '\n';
+            }
+        }
+    }
+
+    void printReport(const vector<SearchEngine::QueryProfile>& profiles, const vector<double>& latencies,
+                     double seconds) const {
+        std::cout << "Queries: " << latencies.size() << ", threads: " << threadsNumber
+                  << ", time: " << seconds << " s, QPS: " << (seconds > 0 ? latencies.size() / seconds : 0.0)
+                  << std::endl;
+        std::cout << std::left << std::setw(14) << "phase" << std::right
+                  << std::setw(12) << "p50 us" << std::setw(12) << "p95 us" << std::setw(12) << "p99 us"
+                  << std::endl;
+
+        vector<double> phaseLatencies(profiles.size());
+        for (size_t phase = 0; phase < SearchEngine::QueryProfile::phasesNumber; ++phase) {
+            for (size_t i = 0; i < profiles.size(); ++i) {
+                phaseLatencies[i] = profiles[i].microseconds[phase];
+            }
+            printPercentiles(SearchEngine::QueryProfile::getPhaseName(phase), phaseLatencies);
+        }
+        vector<double> queryLatencies(latencies);
+        printPercentiles("total", queryLatencies);
+    }
+
+    static void printPercentiles(const string& name, vector<double>& values) {
+        std::sort(values.begin(), values.end());
+        std::cout << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << percentile(values, 0.50)
+                  << std::setw(12) << percentile(values, 0.95)
+                  << std::setw(12) << percentile(values, 0.99) << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+        std::cout << std::setprecision(6);
+    }
+
+    // Nearest rank percentile of sorted values
+    static double percentile(const vector<double>& values, double fraction) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        size_t rank = static_cast<size_t>(std::ceil(fraction * values.size()));
+        return values[std::max<size_t>(rank, 1) - 1];
+    }
+
+    const SearchEngine& searchEngine;
+    size_t threadsNumber;
+    size_t topNumber;
+};
+
+} // namespace irindexer
+
+#endif // BATCH_RUNNER_HPP
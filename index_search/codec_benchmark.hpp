@@ -0,0 +1,168 @@
+#ifndef CODEC_BENCHMARK_HPP
+#define CODEC_BENCHMARK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "index.hpp"
+#include "posting_codecs.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Compares decoding speed of the posting codecs on the posting lists of an index.
+// All lists are encoded by every codec and decoded whole, as for intersection, then
+// StreamVByte blocks of all lists are decoded by every kernel the processor supports.
+class CodecBenchmark {
+public:
+    CodecBenchmark(const Index& index, size_t repetitions)
+        : index(index)
+        , repetitions(std::max<size_t>(repetitions, 1))
+    { }
+
+    void run() const {
+        std::cout << std::left << std::setw(14) << "codec" << std::right << std::setw(14) << "postings MB"
+                  << std::setw(18) << "bits/posting" << std::setw(18) << "Mpostings/s" << std::endl;
+        uint64_t expectedChecksum = 0;
+        for (int codec = 0; codec < postingCodecsNumber; ++codec) {
+            Index encoded(encodeIndex(static_cast<PostingCodec>(codec)));
+            PostingList postingList;
+            size_t postingsNumber = 0;
+            uint64_t checksum = 0;
+            Clock::time_point startTime = Clock::now();
+            for (size_t repetition = 0; repetition < repetitions; ++repetition) {
+                for (size_t word = 0; word < encoded.wordsNumber(); ++word) {
+                    encoded.decodePostingList(word, postingList);
+                    for (size_t i = 0; i < postingList.size(); ++i) {
+                        checksum = checksum * 31 + postingList.documents[i] * 7 + postingList.frequencies[i];
+                    }
+                    postingsNumber += postingList.size();
+                }
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+            if (codec == 0) {
+                expectedChecksum = checksum;
+            }
+            checkSum(expectedChecksum, checksum);
+            printRow(getPostingCodecName(static_cast<PostingCodec>(codec)), encoded.postingsSize(),
+                     postingsNumber / repetitions, postingsNumber, seconds);
+        }
+
+        std::cout << std::endl << std::left << std::setw(14) << "kernel" << std::right
+                  << std::setw(14) << "postings MB" << std::setw(18) << "bits/posting"
+                  << std::setw(18) << "Mpostings/s" << std::endl;
+        EncodedBlocks blocks = encodeStreamVByteBlocks();
+        vector<uint32_t> gaps(postingsBlockSize);
+        vector<uint32_t> frequencies(postingsBlockSize);
+        vector<StreamVByteKernel> kernels = getStreamVByteKernels();
+        for (const auto& kernel : kernels) {
+            size_t postingsNumber = 0;
+            uint64_t checksum = 0;
+            Clock::time_point startTime = Clock::now();
+            for (size_t repetition = 0; repetition < repetitions; ++repetition) {
+                for (const auto& block : blocks.blocks) {
+                    const uint8_t* input = blocks.data.data() + block.offset;
+                    decodePostingsBlock(StreamVByteCodec, input, input + block.size, block.postingsNumber,
+                                        gaps.data(), frequencies.data(), kernel.decode);
+                    for (size_t i = 0; i < block.postingsNumber; ++i) {
+                        checksum = checksum * 31 + gaps[i] * 7 + frequencies[i];
+                    }
+                    postingsNumber += block.postingsNumber;
+                }
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+            if (&kernel == &kernels.front()) {
+                expectedChecksum = checksum;
+            }
+            checkSum(expectedChecksum, checksum);
+            printRow(kernel.name, blocks.data.size(), postingsNumber / repetitions, postingsNumber, seconds);
+        }
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct EncodedBlock {
+        size_t offset;
+        size_t size;
+        size_t postingsNumber;
+    };
+
+    struct EncodedBlocks {
+        vector<uint8_t> data;
+        vector<EncodedBlock> blocks;
+    };
+
+    Index encodeIndex(PostingCodec codec) const {
+        IndexWriter writer;
+        writer.setPostingCodec(codec);
+        writer.setDenseListBitmaps(false);
+        vector<IndexWriter::Posting> postings;
+        for (size_t word = 0; word < index.wordsNumber(); ++word) {
+            for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+                postings.push_back(IndexWriter::Posting(cursor.document(), cursor.frequency()));
+            }
+            if (!postings.empty()) {
+                writer.addPostingList(word, std::move(postings));
+                postings.clear();
+            }
+        }
+        return Index(writer);
+    }
+
+    EncodedBlocks encodeStreamVByteBlocks() const {
+        EncodedBlocks encoded;
+        vector<uint32_t> gaps;
+        vector<uint32_t> frequencies;
+        for (size_t word = 0; word < index.wordsNumber(); ++word) {
+            int previousDocument = 0;
+            for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+                gaps.push_back(cursor.document() - previousDocument);
+                frequencies.push_back(cursor.frequency());
+                previousDocument = cursor.document();
+                if (gaps.size() == postingsBlockSize || cursor.size() == 1) {
+                    EncodedBlock block;
+                    block.offset = encoded.data.size();
+                    block.postingsNumber = gaps.size();
+                    encodePostingsBlock(StreamVByteCodec, gaps.data(), frequencies.data(), gaps.size(),
+                                        encoded.data);
+                    block.size = encoded.data.size() - block.offset;
+                    encoded.blocks.push_back(block);
+                    gaps.clear();
+                    frequencies.clear();
+                }
+            }
+        }
+        return encoded;
+    }
+
+    static void checkSum(uint64_t expected, uint64_t checksum) {
+        if (checksum != expected) {
+            throw std::logic_error("Decoded postings differ between codecs or kernels");
+        }
+    }
+
+    void printRow(const string& name, size_t bytes, size_t listPostings, size_t postingsNumber,
+                  double seconds) const {
+        std::cout << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(14) << bytes / 1048576.0
+                  << std::setw(18) << (listPostings > 0 ? bytes * 8.0 / listPostings : 0.0)
+                  << std::setw(18) << (seconds > 0 ? postingsNumber / seconds / 1e6 : 0.0) << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+        std::cout << std::setprecision(6);
+    }
+
+    const Index& index;
+    size_t repetitions;
+};
+
+} // namespace irindexer
+
+#endif // CODEC_BENCHMARK_HPP
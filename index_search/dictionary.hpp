@@ -0,0 +1,418 @@
+#ifndef DICTIONARY_HPP
+#define DICTIONARY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "text_loader.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+struct WordRecord {
+    WordRecord()
+    { }
+
+    WordRecord(const string& word, int index, int frequency)
+        : word(word)
+        , index(index)
+        , frequency(frequency)
+    { }
+
+    string word;
+    int index;
+    int frequency;
+};
+
+// Binary dictionary layout, all sections 8-byte aligned:
+//   DictionaryHeader
+//   DictionaryEntry[indexSlots]       indexed by word index, empty words are absent
+//   int32_t[bucketsNumber]            minimal perfect hash displacements
+//   uint32_t[wordsNumber]             word index of every hash slot
+//   words                             all words one after another
+const char dictionaryMagic[4] = {'I', 'R', 'D', 'C'};
+const uint32_t dictionaryVersion = 1;
+
+struct DictionaryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t wordsNumber;
+    uint32_t indexSlots;
+    uint32_t bucketsNumber;
+    uint32_t reserved;
+    uint64_t entriesOffset;
+    uint64_t bucketsOffset;
+    uint64_t slotsOffset;
+    uint64_t wordsOffset;
+    uint64_t wordsSize;
+};
+
+struct DictionaryEntry {
+    uint64_t wordOffset;
+    uint32_t wordLength;
+    int32_t frequency;
+};
+
+inline uint64_t hashWord(const char* word, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8_t>(word[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Slot of a word hash in the table of slotsNumber slots for the bucket displacement:
+// non-negative displacements are seeds of a rehash, negative ones encode the slot itself
+inline uint32_t hashSlot(uint64_t hash, int32_t displacement, uint32_t slotsNumber) {
+    if (displacement < 0) {
+        return static_cast<uint32_t>(-(displacement + 1));
+    }
+    hash += (static_cast<uint64_t>(displacement) + 1) * 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return static_cast<uint32_t>(hash % slotsNumber);
+}
+
+// Collects words and serializes them into the binary dictionary layout.
+// Later records of the same word or index replace earlier ones.
+class DictionaryWriter {
+public:
+    void addWord(const string& word, int index, int frequency) {
+        if (index < 0) {
+            throw std::logic_error("Negative index of word " + word);
+        }
+        if (word.empty()) {
+            throw std::logic_error("Empty word with index " + std::to_string(index));
+        }
+        if (static_cast<size_t>(index) >= records.size()) {
+            records.resize(index + 1, WordRecord("", index, 0));
+        }
+        records[index] = WordRecord(word, index, frequency);
+        wordIndices[word] = index;
+    }
+
+    vector<char> serialize() const {
+        // Words whose index was taken over by another word are dropped
+        vector<uint32_t> keys;
+        for (const auto& wordIndex : wordIndices) {
+            if (records[wordIndex.second].word == wordIndex.first) {
+                keys.push_back(wordIndex.second);
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+
+        vector<DictionaryEntry> entries(records.size(), DictionaryEntry());
+        string words;
+        for (uint32_t index : keys) {
+            entries[index].wordOffset = words.size();
+            entries[index].wordLength = records[index].word.size();
+            entries[index].frequency = records[index].frequency;
+            words += records[index].word;
+        }
+
+        uint32_t bucketsNumber = keys.size() / 2 + 1;
+        vector<int32_t> buckets(bucketsNumber, 0);
+        vector<uint32_t> slots(keys.size(), 0);
+        buildPerfectHash(keys, buckets, slots);
+
+        DictionaryHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, dictionaryMagic, sizeof(dictionaryMagic));
+        header.version = dictionaryVersion;
+        header.wordsNumber = keys.size();
+        header.indexSlots = entries.size();
+        header.bucketsNumber = bucketsNumber;
+        header.entriesOffset = align(sizeof(DictionaryHeader));
+        header.bucketsOffset = align(header.entriesOffset + entries.size() * sizeof(DictionaryEntry));
+        header.slotsOffset = align(header.bucketsOffset + buckets.size() * sizeof(int32_t));
+        header.wordsOffset = align(header.slotsOffset + slots.size() * sizeof(uint32_t));
+        header.wordsSize = words.size();
+
+        vector<char> image(header.wordsOffset + words.size(), 0);
+        std::memcpy(&image[0], &header, sizeof(header));
+        if (!entries.empty()) {
+            std::memcpy(&image[header.entriesOffset], &entries[0], entries.size() * sizeof(DictionaryEntry));
+        }
+        std::memcpy(&image[header.bucketsOffset], &buckets[0], buckets.size() * sizeof(int32_t));
+        if (!slots.empty()) {
+            std::memcpy(&image[header.slotsOffset], &slots[0], slots.size() * sizeof(uint32_t));
+        }
+        if (!words.empty()) {
+            std::memcpy(&image[header.wordsOffset], words.data(), words.size());
+        }
+        return image;
+    }
+
+private:
+    static uint64_t align(uint64_t offset) {
+        return (offset + 7) & ~static_cast<uint64_t>(7);
+    }
+
+    // Hash and displace: words are split into buckets by hash, the largest buckets
+    // are placed first by trying seeds until all of their words fall into free slots,
+    // buckets of a single word take the remaining free slots directly
+    void buildPerfectHash(const vector<uint32_t>& keys, vector<int32_t>& buckets, vector<uint32_t>& slots) const {
+        uint32_t slotsNumber = keys.size();
+        vector<uint64_t> hashes(keys.size());
+        vector<vector<uint32_t>> bucketKeys(buckets.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            const string& word = records[keys[i]].word;
+            hashes[i] = hashWord(word.data(), word.size());
+            bucketKeys[hashes[i] % buckets.size()].push_back(i);
+        }
+
+        vector<uint32_t> order(buckets.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+            [&](uint32_t lhs, uint32_t rhs) { return bucketKeys[lhs].size() > bucketKeys[rhs].size(); });
+
+        const int32_t maxSeed = 1 << 28;
+        vector<bool> occupied(slotsNumber, false);
+        vector<uint32_t> bucketSlots;
+        size_t bucket = 0;
+        for (; bucket < order.size() && bucketKeys[order[bucket]].size() > 1; ++bucket) {
+            const vector<uint32_t>& members = bucketKeys[order[bucket]];
+            int32_t seed = 0;
+            for (; seed < maxSeed; ++seed) {
+                bucketSlots.clear();
+                bool placed = true;
+                for (uint32_t key : members) {
+                    uint32_t slot = hashSlot(hashes[key], seed, slotsNumber);
+                    if (occupied[slot] || std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end()) {
+                        placed = false;
+                        break;
+                    }
+                    bucketSlots.push_back(slot);
+                }
+                if (placed) {
+                    break;
+                }
+            }
+            if (seed == maxSeed) {
+                throw std::logic_error("Can't build perfect hash of dictionary words");
+            }
+            buckets[order[bucket]] = seed;
+            for (size_t i = 0; i < members.size(); ++i) {
+                occupied[bucketSlots[i]] = true;
+                slots[bucketSlots[i]] = keys[members[i]];
+            }
+        }
+
+        uint32_t freeSlot = 0;
+        for (; bucket < order.size() && bucketKeys[order[bucket]].size() == 1; ++bucket) {
+            while (occupied[freeSlot]) {
+                ++freeSlot;
+            }
+            occupied[freeSlot] = true;
+            buckets[order[bucket]] = -static_cast<int32_t>(freeSlot) - 1;
+            slots[freeSlot] = keys[bucketKeys[order[bucket]][0]];
+        }
+    }
+
+    vector<WordRecord> records;
+    std::unordered_map<string, int> wordIndices;
+};
+
+// Read-only dictionary over a binary image: words are kept in one arena, records
+// in a dense table indexed by word index, and words are looked up through
+// a minimal perfect hash. The image is either memory-mapped from a binary
+// dictionary file or built in memory from the text format. Copies share the image.
+class Dictionary {
+public:
+    Dictionary() {
+        attachImage(DictionaryWriter().serialize());
+    }
+
+    void readFromFile(const string& filename) {
+        if (isBinaryDictionaryFile(filename)) {
+            readBinaryFile(filename);
+        } else {
+            readTextFile(filename);
+        }
+    }
+
+    void readBinaryFile(const string& filename) {
+        std::cerr << "Mapping binary dictionary from " << filename << std::endl;
+
+        std::shared_ptr<MappedFile> mappedFile = std::make_shared<MappedFile>(filename);
+        attach(mappedFile, mappedFile->data(), mappedFile->size());
+
+        std::cerr << "Finished mapping " << size() << " words" << std::endl;
+    }
+
+    // Lines "word index frequency" are parsed in chunks on all cores
+    void readTextFile(const string& filename) {
+        std::cerr << "Reading dictionary from " << filename << std::endl;
+
+        MappedFile mappedFile(filename);
+        vector<vector<WordRecord>> chunks = parseLineChunks<vector<WordRecord>>(
+            mappedFile.data(), mappedFile.size(),
+            [](const char* begin, const char* end, vector<WordRecord>& records) {
+                TextScanner scanner(begin, end);
+                for (; !scanner.finished(); scanner.nextLine()) {
+                    const char* wordBegin;
+                    const char* wordEnd;
+                    if (!scanner.readToken(wordBegin, wordEnd)) {
+                        continue;
+                    }
+                    WordRecord record;
+                    if (!scanner.readInt(record.index) || !scanner.readInt(record.frequency)) {
+                        throw std::logic_error("Malformed dictionary record " + string(wordBegin, wordEnd));
+                    }
+                    record.word.assign(wordBegin, wordEnd);
+                    records.push_back(std::move(record));
+                }
+            });
+
+        DictionaryWriter writer;
+        for (auto& chunk : chunks) {
+            for (const auto& record : chunk) {
+                writer.addWord(record.word, record.index, record.frequency);
+            }
+            vector<WordRecord>().swap(chunk);
+        }
+        attachImage(writer.serialize());
+
+        std::cerr << "Finished reading " << std::to_string(size()) << " words" << std::endl;
+    }
+
+    void writeToFile(const string& filename) const {
+        std::ofstream output(filename, std::ios::binary);
+
+        if (!output.is_open()) {
+            throw std::logic_error("Can't open file " + filename);
+        }
+
+        output.write(imageData, imageSize);
+    }
+
+    static bool isBinaryDictionaryFile(const string& filename) {
+        std::ifstream input(filename, std::ios::binary);
+        char magic[sizeof(dictionaryMagic)];
+        return input.read(magic, sizeof(magic)) && std::memcmp(magic, dictionaryMagic, sizeof(magic)) == 0;
+    }
+
+    size_t size() const {
+        return header->wordsNumber;
+    }
+
+    bool containsWord(const string& word) const {
+        return findWordIndex(word) >= 0;
+    }
+
+    // Index of the word, -1 if the dictionary doesn't contain it
+    int findWordIndex(const string& word) const {
+        return findWordIndex(word.data(), word.size());
+    }
+
+    int findWordIndex(const char* word, size_t length) const {
+        if (header->wordsNumber == 0) {
+            return -1;
+        }
+        uint64_t hash = hashWord(word, length);
+        uint32_t slot = hashSlot(hash, buckets[hash % header->bucketsNumber], header->wordsNumber);
+        uint32_t index = slots[slot];
+        const DictionaryEntry& entry = entries[index];
+        if (entry.wordLength != length || std::memcmp(words + entry.wordOffset, word, length) != 0) {
+            return -1;
+        }
+        return index;
+    }
+
+    // Word indices are below indexSlots(), some of them may be unused
+    size_t indexSlots() const {
+        return header->indexSlots;
+    }
+
+    bool containsIndex(int index) const {
+        return index >= 0 && static_cast<size_t>(index) < header->indexSlots && entries[index].wordLength != 0;
+    }
+
+    // Word of the index in the arena, without copying it
+    void getWordBounds(int index, const char*& begin, const char*& end) const {
+        const DictionaryEntry& entry = entries[index];
+        begin = words + entry.wordOffset;
+        end = begin + entry.wordLength;
+    }
+
+    int getWordFrequency(int index) const {
+        return entries[index].frequency;
+    }
+
+    WordRecord getWordRecord(int index) const {
+        if (!containsIndex(index)) {
+            throw std::out_of_range("Unknown word index " + std::to_string(index));
+        }
+        const DictionaryEntry& entry = entries[index];
+        return WordRecord(string(words + entry.wordOffset, entry.wordLength), index, entry.frequency);
+    }
+
+    WordRecord getWordRecord(const string& word) const {
+        int index = findWordIndex(word);
+        if (index < 0) {
+            throw std::out_of_range("Unknown word " + word);
+        }
+        return WordRecord(word, index, entries[index].frequency);
+    }
+
+private:
+
+    void attachImage(vector<char> image) {
+        std::shared_ptr<vector<char>> buffer = std::make_shared<vector<char>>(std::move(image));
+        attach(buffer, buffer->data(), buffer->size());
+    }
+
+    void attach(std::shared_ptr<const void> owner, const char* data, size_t size) {
+        if (size < sizeof(DictionaryHeader) || std::memcmp(data, dictionaryMagic, sizeof(dictionaryMagic)) != 0) {
+            throw std::logic_error("Not a binary dictionary");
+        }
+        const DictionaryHeader* candidate = reinterpret_cast<const DictionaryHeader*>(data);
+        if (candidate->version != dictionaryVersion) {
+            throw std::logic_error("Unsupported dictionary version " + std::to_string(candidate->version));
+        }
+        if (candidate->bucketsNumber == 0
+                || candidate->entriesOffset + candidate->indexSlots * sizeof(DictionaryEntry) > size
+                || candidate->bucketsOffset + candidate->bucketsNumber * sizeof(int32_t) > size
+                || candidate->slotsOffset + candidate->wordsNumber * sizeof(uint32_t) > size
+                || candidate->wordsOffset + candidate->wordsSize > size) {
+            throw std::logic_error("Truncated binary dictionary");
+        }
+
+        imageOwner = owner;
+        imageData = data;
+        imageSize = size;
+        header = candidate;
+        entries = reinterpret_cast<const DictionaryEntry*>(data + header->entriesOffset);
+        buckets = reinterpret_cast<const int32_t*>(data + header->bucketsOffset);
+        slots = reinterpret_cast<const uint32_t*>(data + header->slotsOffset);
+        words = data + header->wordsOffset;
+    }
+
+    std::shared_ptr<const void> imageOwner;
+    const char* imageData = nullptr;
+    size_t imageSize = 0;
+    const DictionaryHeader* header = nullptr;
+    const DictionaryEntry* entries = nullptr;
+    const int32_t* buckets = nullptr;
+    const uint32_t* slots = nullptr;
+    const char* words = nullptr;
+};
+
+} // namespace irindexer
+
+#endif // DICTIONARY_HPP
@@ -0,0 +1,337 @@
+#ifndef DOCID_REORDERING_HPP
+#define DOCID_REORDERING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "index.hpp"
+#include "static_rank.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Document reorderings list the documents of an index in their new order, the i-th of them
+// gets document index firstDocument + i where firstDocument is the smallest document index
+// of the index. Documents similar in their words get close indices, so gaps of posting lists
+// are smaller, take less space and intersections skip more blocks.
+
+// Documents which have postings in any field, by increasing index
+inline vector<int> getIndexDocuments(const Index& index) {
+    vector<int> documents;
+    for (size_t document = 0; document < index.documentSlots(); ++document) {
+        for (size_t field = 0; field < index.fieldsNumber(); ++field) {
+            if (index.getFieldLength(static_cast<DocumentField>(field), document) > 0) {
+                documents.push_back(document);
+                break;
+            }
+        }
+    }
+    return documents;
+}
+
+// Orders documents by their URLs. Lines "N.html URL" of the urls mapping written by flatten
+// give URL of document N, documents without URL follow in their current order.
+inline vector<int> orderDocumentsByUrls(const Index& index, const string& urlsMappingPath) {
+    vector<string> urls(index.documentSlots());
+    vector<bool> hasUrl(index.documentSlots(), false);
+    for (const auto& documentUrl : readUrlsMapping(urlsMappingPath)) {
+        size_t document = documentUrl.first;
+        if (document < urls.size()) {
+            urls[document] = documentUrl.second;
+            hasUrl[document] = true;
+        }
+    }
+
+    vector<int> order = getIndexDocuments(index);
+    std::stable_sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+        if (hasUrl[lhs] != hasUrl[rhs]) {
+            return hasUrl[lhs] > hasUrl[rhs];
+        }
+        return urls[lhs] < urls[rhs];
+    });
+    return order;
+}
+
+// Orders documents by decreasing static rank, documents of equal rank keep their current order.
+// Conjunctive search combining scores with the static rank then meets the documents of
+// high rank first and stops once the rank of the rest can't get them into the top.
+inline vector<int> orderDocumentsByStaticRank(const Index& index, const StaticRank& staticRank) {
+    vector<int> order = getIndexDocuments(index);
+    std::stable_sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+        return staticRank.getScore(lhs) > staticRank.getScore(rhs);
+    });
+    return order;
+}
+
+// Recursive graph bisection of the bipartite graph of documents and words: documents are
+// split into halves, then pairs of documents swap halves while the swap lowers the estimated
+// size of the gaps, sum over words of d log(n / (d + 1)) for both halves, where d of n
+// documents of a half contain the word. Both halves are bisected in turn until they are
+// smaller than minPartitionSize, the first levels run on separate threads.
+class GraphBisection {
+public:
+    GraphBisection(const Index& index, size_t iterations = 20, size_t minPartitionSize = 32)
+        : index(index)
+        , iterations(iterations)
+        , minPartitionSize(std::max<size_t>(minPartitionSize, 2))
+    { }
+
+    vector<int> orderDocuments() {
+        std::cerr << "Reordering documents by graph bisection" << std::endl;
+        buildForwardIndex();
+        logarithms.resize(documents.size() + 2);
+        for (size_t i = 1; i < logarithms.size(); ++i) {
+            logarithms[i] = std::log2(static_cast<double>(i));
+        }
+
+        vector<int> order(documents.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        size_t parallelDepth = 0;
+        while ((size_t(2) << parallelDepth) <= std::thread::hardware_concurrency()) {
+            ++parallelDepth;
+        }
+        bisect(order.begin(), order.end(), parallelDepth);
+
+        for (int& document : order) {
+            document = documents[document];
+        }
+        return order;
+    }
+
+private:
+    typedef vector<int>::iterator Iterator;
+
+    // Per-thread degrees of words in both halves, only words of the partition are touched
+    struct Scratch {
+        explicit Scratch(size_t wordsNumber)
+            : leftDegrees(wordsNumber, 0)
+            , rightDegrees(wordsNumber, 0)
+        { }
+
+        vector<int> leftDegrees;
+        vector<int> rightDegrees;
+        vector<std::pair<double, int>> leftGains;
+        vector<std::pair<double, int>> rightGains;
+    };
+
+    // Words of every document, words in one document only are left out as they don't
+    // depend on the order. Documents and words are numbered from 0 here.
+    void buildForwardIndex() {
+        documents = getIndexDocuments(index);
+        vector<int> localDocuments(index.documentSlots(), -1);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            localDocuments[documents[i]] = i;
+        }
+        vector<int> words;
+        for (size_t word = 0; word < index.wordsNumber(); ++word) {
+            if (index.getWordDocumentsNumber(word) > 1) {
+                words.push_back(word);
+            }
+        }
+        wordsNumber = words.size();
+
+        documentWordsBegin.assign(documents.size() + 1, 0);
+        for (int word : words) {
+            for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+                ++documentWordsBegin[localDocuments[cursor.document()] + 1];
+            }
+        }
+        for (size_t i = 1; i < documentWordsBegin.size(); ++i) {
+            documentWordsBegin[i] += documentWordsBegin[i - 1];
+        }
+        documentWords.resize(documentWordsBegin.back());
+        vector<size_t> filled(documentWordsBegin.begin(), documentWordsBegin.end() - 1);
+        for (size_t i = 0; i < words.size(); ++i) {
+            for (PostingCursor cursor = index.getPostingCursor(words[i]); cursor.valid(); cursor.next()) {
+                documentWords[filled[localDocuments[cursor.document()]]++] = i;
+            }
+        }
+    }
+
+    void bisect(Iterator begin, Iterator end, size_t parallelDepth) {
+        if (static_cast<size_t>(end - begin) < minPartitionSize) {
+            return;
+        }
+        Scratch scratch(wordsNumber);
+        bisect(begin, end, parallelDepth, scratch);
+    }
+
+    void bisect(Iterator begin, Iterator end, size_t parallelDepth, Scratch& scratch) {
+        if (static_cast<size_t>(end - begin) < minPartitionSize) {
+            return;
+        }
+        Iterator middle = begin + (end - begin) / 2;
+        for (size_t iteration = 0; iteration < iterations; ++iteration) {
+            if (swapDocuments(begin, middle, end, scratch) == 0) {
+                break;
+            }
+        }
+        if (parallelDepth > 0) {
+            std::thread left([=] { bisect(begin, middle, parallelDepth - 1); });
+            bisect(middle, end, parallelDepth - 1);
+            left.join();
+        } else {
+            bisect(begin, middle, 0, scratch);
+            bisect(middle, end, 0, scratch);
+        }
+    }
+
+    // One round of swaps between [begin, middle) and [middle, end), returns the number of swaps
+    size_t swapDocuments(Iterator begin, Iterator middle, Iterator end, Scratch& scratch) const {
+        countDegrees(begin, middle, scratch.leftDegrees, 1);
+        countDegrees(middle, end, scratch.rightDegrees, 1);
+        double leftLogarithm = logarithms[middle - begin];
+        double rightLogarithm = logarithms[end - middle];
+        computeGains(begin, middle, leftLogarithm, rightLogarithm, scratch.leftDegrees, scratch.rightDegrees,
+                     scratch.leftGains);
+        computeGains(middle, end, rightLogarithm, leftLogarithm, scratch.rightDegrees, scratch.leftDegrees,
+                     scratch.rightGains);
+        countDegrees(begin, middle, scratch.leftDegrees, 0);
+        countDegrees(middle, end, scratch.rightDegrees, 0);
+
+        auto byGain = [](const std::pair<double, int>& lhs, const std::pair<double, int>& rhs) {
+            return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+        };
+        std::sort(scratch.leftGains.begin(), scratch.leftGains.end(), byGain);
+        std::sort(scratch.rightGains.begin(), scratch.rightGains.end(), byGain);
+        size_t swaps = 0;
+        while (swaps < scratch.leftGains.size() && swaps < scratch.rightGains.size()
+               && scratch.leftGains[swaps].first + scratch.rightGains[swaps].first > 0) {
+            ++swaps;
+        }
+        if (swaps == 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < scratch.leftGains.size(); ++i) {
+            begin[i] = i < swaps ? scratch.rightGains[i].second : scratch.leftGains[i].second;
+        }
+        for (size_t i = 0; i < scratch.rightGains.size(); ++i) {
+            middle[i] = i < swaps ? scratch.leftGains[i].second : scratch.rightGains[i].second;
+        }
+        return swaps;
+    }
+
+    // Adds 1 to the degrees of words of the documents, or resets them to 0
+    void countDegrees(Iterator begin, Iterator end, vector<int>& degrees, int increment) const {
+        for (Iterator document = begin; document != end; ++document) {
+            for (size_t i = documentWordsBegin[*document]; i < documentWordsBegin[*document + 1]; ++i) {
+                degrees[documentWords[i]] = increment == 0 ? 0 : degrees[documentWords[i]] + increment;
+            }
+        }
+    }
+
+    // Decrease of the gaps cost when a document of [begin, end) moves into the other half
+    void computeGains(Iterator begin, Iterator end, double fromLogarithm, double toLogarithm,
+                      const vector<int>& fromDegrees, const vector<int>& toDegrees,
+                      vector<std::pair<double, int>>& gains) const {
+        gains.clear();
+        for (Iterator document = begin; document != end; ++document) {
+            double gain = 0.0;
+            for (size_t i = documentWordsBegin[*document]; i < documentWordsBegin[*document + 1]; ++i) {
+                int from = fromDegrees[documentWords[i]];
+                int to = toDegrees[documentWords[i]];
+                gain += getCost(fromLogarithm, from) + getCost(toLogarithm, to)
+                      - getCost(fromLogarithm, from - 1) - getCost(toLogarithm, to + 1);
+            }
+            gains.push_back(std::make_pair(gain, *document));
+        }
+    }
+
+    // Estimated bits of the gaps of a word in degree of the documents of a half
+    double getCost(double sizeLogarithm, int degree) const {
+        return degree * (sizeLogarithm - logarithms[degree + 1]);
+    }
+
+    const Index& index;
+    size_t iterations;
+    size_t minPartitionSize;
+    vector<int> documents;
+    size_t wordsNumber = 0;
+    vector<size_t> documentWordsBegin;
+    vector<int> documentWords;
+    vector<double> logarithms;
+};
+
+// Rewrites the postings and positions of every word and field for the documents in the order.
+// Every posting list keeps its codec, collection statistics don't change.
+inline Index reorderIndex(const Index& index, const vector<int>& order) {
+    std::cerr << "Rewriting postings of " << order.size() << " documents" << std::endl;
+
+    int firstDocument = order.empty() ? 0 : *std::min_element(order.begin(), order.end());
+    vector<int> newDocuments(index.documentSlots(), -1);
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (newDocuments[order[i]] != -1) {
+            throw std::logic_error("Document " + std::to_string(order[i]) + " is reordered twice");
+        }
+        newDocuments[order[i]] = firstDocument + i;
+    }
+
+    // Documents of postings in any field have to be in the order
+    auto getNewDocument = [&newDocuments](int document) {
+        if (newDocuments[document] == -1) {
+            throw std::logic_error("Document " + std::to_string(document) + " is not reordered");
+        }
+        return newDocuments[document];
+    };
+
+    IndexWriter writer;
+    vector<IndexWriter::Posting> postings;
+    vector<vector<int>> positions;
+    bool hasPositions = index.hasPositions();
+    for (size_t word = 0; word < index.wordsNumber(); ++word) {
+        for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+            postings.push_back(IndexWriter::Posting(getNewDocument(cursor.document()), cursor.frequency()));
+            if (hasPositions) {
+                positions.push_back(vector<int>());
+                cursor.readPositions(positions.back());
+            }
+        }
+        if (!postings.empty()) {
+            writer.setPostingCodec(index.getPostingCodec(word));
+            writer.addPostingList(word, std::move(postings), std::move(positions));
+            postings.clear();
+            positions.clear();
+        }
+
+        for (size_t field = TitleField; field < index.fieldsNumber(); ++field) {
+            DocumentField documentField = static_cast<DocumentField>(field);
+            for (PostingCursor cursor = index.getFieldPostingCursor(documentField, word); cursor.valid();
+                 cursor.next()) {
+                postings.push_back(IndexWriter::Posting(getNewDocument(cursor.document()), cursor.frequency()));
+            }
+            if (!postings.empty()) {
+                writer.setPostingCodec(index.getFieldPostingCodec(documentField, word));
+                writer.addFieldPostingList(documentField, word, std::move(postings));
+                postings.clear();
+            }
+        }
+    }
+    return Index(writer);
+}
+
+// Lines "NEW_DOCUMENT OLD_DOCUMENT" for all documents of the order
+inline void writeDocumentMapping(const vector<int>& order, const string& mappingPath) {
+    std::ofstream output(mappingPath);
+    if (!output.is_open()) {
+        throw std::logic_error("Can't open file " + mappingPath);
+    }
+    int firstDocument = order.empty() ? 0 : *std::min_element(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i) {
+        output << firstDocument + i << '\t' << order[i] << '\n';
+    }
+}
+
+} // namespace irindexer
+
+#endif // DOCID_REORDERING_HPP
@@ -0,0 +1,378 @@
+#ifndef IMPACT_INDEX_HPP
+#define IMPACT_INDEX_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "dictionary.hpp"
+#include "index.hpp"
+#include "mapped_file.hpp"
+#include "score_evaluators.hpp"
+#include "varbyte.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Impact-ordered index layout, all sections 8-byte aligned:
+//   ImpactIndexHeader
+//   ImpactTermEntry[termsNumber]      indexed by word index
+//   ImpactSegment[segmentsNumber]     consecutive for every word, by decreasing impact
+//   postings                          per segment: varbyte document gaps, sorted by document
+// Impact is the BM25 word score quantized to 8 bits, score = impact * quantumScore.
+// Numbers of words and documents of the index the impacts were computed from
+// are kept to reject the impact index of another index.
+const char impactIndexMagic[4] = {'I', 'R', 'I', 'M'};
+const uint32_t impactIndexVersion = 2;
+
+const uint32_t maxImpact = 255;
+
+struct ImpactIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t termsNumber;
+    uint32_t documentSlots;
+    double quantumScore;
+    uint64_t termsOffset;
+    uint64_t segmentsNumber;
+    uint64_t segmentsOffset;
+    uint64_t postingsOffset;
+    uint64_t postingsSize;
+    uint64_t indexDocumentsNumber;
+};
+
+struct ImpactTermEntry {
+    uint64_t firstSegment;
+    uint32_t segmentsNumber;
+    uint32_t documentsNumber;
+};
+
+struct ImpactSegment {
+    uint64_t offset;
+    uint32_t documentsNumber;
+    uint32_t impact;
+};
+
+struct DocumentImpact {
+    DocumentImpact(int document, uint32_t impact)
+        : document(document)
+        , impact(impact)
+    { }
+
+    int document;
+    uint32_t impact;
+};
+
+// Precomputes quantized BM25 scores of all postings of the index
+// and groups postings of every word by impact
+class ImpactIndexWriter {
+public:
+    explicit ImpactIndexWriter(const Index& index)
+        : index(index)
+    { }
+
+    vector<char> serialize() const {
+        Dictionary dict;
+        BM25DocumentScoreEvaluator evaluator(dict, index);
+        size_t termsNumber = index.wordsNumber();
+
+        double maxScore = 0.0;
+        for (size_t word = 0; word < termsNumber; ++word) {
+            evaluator.prepare(vector<WordRecord>(1, WordRecord("", word, 0)));
+            for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+                maxScore = std::max(maxScore, evaluator.evaluateWordScore(0, cursor.document(), cursor.frequency()));
+            }
+        }
+        double quantumScore = maxScore > 0.0 ? maxScore / maxImpact : 1.0;
+
+        vector<ImpactTermEntry> terms(termsNumber, ImpactTermEntry());
+        vector<ImpactSegment> segments;
+        vector<uint8_t> postingsData;
+        vector<vector<int>> impactDocuments(maxImpact + 1);
+        for (size_t word = 0; word < termsNumber; ++word) {
+            evaluator.prepare(vector<WordRecord>(1, WordRecord("", word, 0)));
+            for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+                double score = evaluator.evaluateWordScore(0, cursor.document(), cursor.frequency());
+                uint32_t impact = std::min<uint32_t>(maxImpact, static_cast<uint32_t>(score / quantumScore + 0.5));
+                // Postings which add nothing are dropped
+                if (impact > 0) {
+                    impactDocuments[impact].push_back(cursor.document());
+                }
+            }
+
+            ImpactTermEntry& entry = terms[word];
+            entry.firstSegment = segments.size();
+            for (uint32_t impact = maxImpact; impact > 0; --impact) {
+                vector<int>& documents = impactDocuments[impact];
+                if (documents.empty()) {
+                    continue;
+                }
+                ImpactSegment segment;
+                segment.offset = postingsData.size();
+                segment.documentsNumber = documents.size();
+                segment.impact = impact;
+                int previousDocument = 0;
+                for (int document : documents) {
+                    encodeVarByte(document - previousDocument, postingsData);
+                    previousDocument = document;
+                }
+                segments.push_back(segment);
+                entry.documentsNumber += documents.size();
+                documents.clear();
+            }
+            entry.segmentsNumber = segments.size() - entry.firstSegment;
+        }
+
+        ImpactIndexHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, impactIndexMagic, sizeof(impactIndexMagic));
+        header.version = impactIndexVersion;
+        header.termsNumber = termsNumber;
+        header.documentSlots = index.documentSlots();
+        header.quantumScore = quantumScore;
+        header.termsOffset = align(sizeof(ImpactIndexHeader));
+        header.segmentsNumber = segments.size();
+        header.segmentsOffset = align(header.termsOffset + terms.size() * sizeof(ImpactTermEntry));
+        header.postingsOffset = align(header.segmentsOffset + segments.size() * sizeof(ImpactSegment));
+        header.postingsSize = postingsData.size();
+        header.indexDocumentsNumber = index.documentsNumber();
+
+        vector<char> image(header.postingsOffset + postingsData.size(), 0);
+        std::memcpy(&image[0], &header, sizeof(header));
+        if (!terms.empty()) {
+            std::memcpy(&image[header.termsOffset], &terms[0], terms.size() * sizeof(ImpactTermEntry));
+        }
+        if (!segments.empty()) {
+            std::memcpy(&image[header.segmentsOffset], &segments[0], segments.size() * sizeof(ImpactSegment));
+        }
+        if (!postingsData.empty()) {
+            std::memcpy(&image[header.postingsOffset], &postingsData[0], postingsData.size());
+        }
+        return image;
+    }
+
+    void writeToFile(const string& filename) const {
+        std::ofstream output(filename, std::ios::binary);
+
+        if (!output.is_open()) {
+            throw std::logic_error("Can't open file " + filename);
+        }
+
+        vector<char> image = serialize();
+        output.write(image.data(), image.size());
+    }
+
+private:
+    static uint64_t align(uint64_t offset) {
+        return (offset + 7) & ~static_cast<uint64_t>(7);
+    }
+
+    const Index& index;
+};
+
+// Score-at-a-time evaluation over the impact-ordered index: segments of all query words
+// are processed from the highest impact down, adding impacts into per-document
+// accumulators, until no document outside of the current top can overtake it.
+class ImpactIndex {
+public:
+    ImpactIndex()
+    { }
+
+    // The impact index has to be built from index
+    void readFromFile(const string& filename, const Index& index) {
+        std::cerr << "Mapping impact index from " << filename << std::endl;
+
+        std::shared_ptr<MappedFile> mappedFile = std::make_shared<MappedFile>(filename);
+        const char* data = mappedFile->data();
+        size_t size = mappedFile->size();
+        if (size < sizeof(ImpactIndexHeader) || std::memcmp(data, impactIndexMagic, sizeof(impactIndexMagic)) != 0) {
+            throw std::logic_error("Not an impact index " + filename);
+        }
+        const ImpactIndexHeader* candidate = reinterpret_cast<const ImpactIndexHeader*>(data);
+        if (candidate->version != impactIndexVersion) {
+            throw std::logic_error("Unsupported impact index version " + std::to_string(candidate->version));
+        }
+        if (candidate->termsOffset + candidate->termsNumber * sizeof(ImpactTermEntry) > size
+                || candidate->segmentsOffset + candidate->segmentsNumber * sizeof(ImpactSegment) > size
+                || candidate->postingsOffset + candidate->postingsSize > size) {
+            throw std::logic_error("Truncated impact index " + filename);
+        }
+        if (candidate->termsNumber != index.wordsNumber() || candidate->documentSlots != index.documentSlots()
+                || candidate->indexDocumentsNumber != index.documentsNumber()) {
+            throw std::logic_error("Impact index " + filename + " is built from another index");
+        }
+
+        imageOwner = mappedFile;
+        header = candidate;
+        terms = reinterpret_cast<const ImpactTermEntry*>(data + header->termsOffset);
+        segments = reinterpret_cast<const ImpactSegment*>(data + header->segmentsOffset);
+        postings = reinterpret_cast<const uint8_t*>(data + header->postingsOffset);
+
+        std::cerr << "Finished mapping " << header->segmentsNumber << " impact segments" << std::endl;
+    }
+
+    bool empty() const {
+        return header == nullptr;
+    }
+
+    double getQuantumScore() const {
+        return header->quantumScore;
+    }
+
+    // Segments of every word are stored by decreasing impact,
+    // so the next unprocessed one bounds what the word can still add
+    struct QueueEntry {
+        uint32_t impact;
+        size_t word;
+        size_t segment;
+    };
+
+    // Buffers of the searches of one thread. Accumulators are allocated for all documents
+    // by the first search and only the touched ones are cleared after every search.
+    struct SearchContext {
+        vector<QueueEntry> queue;
+        vector<uint32_t> remainingImpacts;
+        vector<uint32_t> accumulators;
+        vector<int> touchedDocuments;
+        vector<uint32_t> topImpacts;
+        vector<DocumentImpact> result;
+    };
+
+    vector<DocumentImpact> search(const vector<int>& wordIndices, size_t topNumber, size_t postingsBudget = 0) const {
+        SearchContext context;
+        return search(wordIndices, topNumber, context, postingsBudget);
+    }
+
+    // Best topNumber documents by the sum of impacts of the words they contain.
+    // Stops once the top is stable or after postingsBudget postings, if it is not zero;
+    // on early stop impacts of the top documents may be partial.
+    // The result lives in the context and is valid until its next search.
+    const vector<DocumentImpact>& search(const vector<int>& wordIndices, size_t topNumber, SearchContext& context,
+                                         size_t postingsBudget = 0) const {
+        vector<DocumentImpact>& result = context.result;
+        result.clear();
+        if (topNumber == 0 || empty()) {
+            return result;
+        }
+
+        vector<QueueEntry>& queue = context.queue;
+        vector<uint32_t>& remainingImpacts = context.remainingImpacts;
+        queue.clear();
+        remainingImpacts.assign(wordIndices.size(), 0);
+        for (size_t i = 0; i < wordIndices.size(); ++i) {
+            ImpactTermEntry entry = getTermEntry(wordIndices[i]);
+            for (size_t j = 0; j < entry.segmentsNumber; ++j) {
+                QueueEntry queueEntry;
+                queueEntry.impact = segments[entry.firstSegment + j].impact;
+                queueEntry.word = i;
+                queueEntry.segment = entry.firstSegment + j;
+                queue.push_back(queueEntry);
+            }
+            if (entry.segmentsNumber > 0) {
+                remainingImpacts[i] = segments[entry.firstSegment].impact;
+            }
+        }
+        std::stable_sort(queue.begin(), queue.end(),
+            [](const QueueEntry& lhs, const QueueEntry& rhs) { return lhs.impact > rhs.impact; });
+
+        vector<uint32_t>& accumulators = context.accumulators;
+        vector<int>& touchedDocuments = context.touchedDocuments;
+        if (accumulators.size() != header->documentSlots) {
+            accumulators.assign(header->documentSlots, 0);
+        }
+        touchedDocuments.clear();
+        size_t processedPostings = 0;
+        size_t postingsSinceCheck = 0;
+        for (size_t q = 0; q < queue.size(); ++q) {
+            const ImpactSegment& segment = segments[queue[q].segment];
+            const uint8_t* position = postings + segment.offset;
+            int document = 0;
+            for (size_t j = 0; j < segment.documentsNumber; ++j) {
+                uint32_t gap;
+                position = decodeVarByte(position, gap);
+                document += gap;
+                if (accumulators[document] == 0) {
+                    touchedDocuments.push_back(document);
+                }
+                accumulators[document] += segment.impact;
+            }
+
+            size_t word = queue[q].word;
+            ImpactTermEntry entry = getTermEntry(wordIndices[word]);
+            size_t nextSegment = queue[q].segment + 1;
+            remainingImpacts[word] = nextSegment < entry.firstSegment + entry.segmentsNumber
+                ? segments[nextSegment].impact : 0;
+
+            processedPostings += segment.documentsNumber;
+            postingsSinceCheck += segment.documentsNumber;
+            if (postingsBudget != 0 && processedPostings >= postingsBudget) {
+                break;
+            }
+            // Checks cost as much as the postings processed since the previous one
+            if (postingsSinceCheck >= touchedDocuments.size() && touchedDocuments.size() > topNumber) {
+                postingsSinceCheck = 0;
+                if (isTopStable(accumulators, touchedDocuments, remainingImpacts, topNumber, context.topImpacts)) {
+                    break;
+                }
+            }
+        }
+
+        for (int document : touchedDocuments) {
+            result.push_back(DocumentImpact(document, accumulators[document]));
+            accumulators[document] = 0;
+        }
+        size_t resultSize = std::min(topNumber, result.size());
+        std::partial_sort(result.begin(), result.begin() + resultSize, result.end(),
+            [](const DocumentImpact& lhs, const DocumentImpact& rhs) { return lhs.impact > rhs.impact; });
+        result.erase(result.begin() + resultSize, result.end());
+        return result;
+    }
+
+private:
+    // Top is stable when the k-th accumulator is greater than the (k+1)-th one
+    // plus everything the query words can still add
+    static bool isTopStable(const vector<uint32_t>& accumulators, const vector<int>& touchedDocuments,
+                            const vector<uint32_t>& remainingImpacts, size_t topNumber, vector<uint32_t>& topImpacts) {
+        uint32_t remainingImpact = 0;
+        for (uint32_t impact : remainingImpacts) {
+            remainingImpact += impact;
+        }
+        if (remainingImpact == 0) {
+            return true;
+        }
+
+        topImpacts.clear();
+        for (int document : touchedDocuments) {
+            topImpacts.push_back(accumulators[document]);
+        }
+        std::nth_element(topImpacts.begin(), topImpacts.begin() + topNumber, topImpacts.end(),
+                         std::greater<uint32_t>());
+        uint32_t nextImpact = topImpacts[topNumber];
+        uint32_t lastTopImpact = *std::min_element(topImpacts.begin(), topImpacts.begin() + topNumber);
+        return lastTopImpact > nextImpact + remainingImpact;
+    }
+
+    ImpactTermEntry getTermEntry(int wordIndex) const {
+        if (wordIndex < 0 || static_cast<size_t>(wordIndex) >= header->termsNumber) {
+            return ImpactTermEntry();
+        }
+        return terms[wordIndex];
+    }
+
+    std::shared_ptr<const void> imageOwner;
+    const ImpactIndexHeader* header = nullptr;
+    const ImpactTermEntry* terms = nullptr;
+    const ImpactSegment* segments = nullptr;
+    const uint8_t* postings = nullptr;
+};
+
+} // namespace irindexer
+
+#endif // IMPACT_INDEX_HPP
@@ -0,0 +1,1181 @@
+#ifndef INDEX_HPP
+#define INDEX_HPP
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <memory>
+#include <cstring>
+#include <iterator>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "posting_codecs.hpp"
+#include "roaring.hpp"
+#include "text_loader.hpp"
+#include "varbyte.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Binary index layout, all sections 8-byte aligned:
+//   IndexHeader
+//   TermEntry[fieldsNumber][termsNumber]        indexed by field and word index
+//   BlockEntry[blocksNumber]                    skip entries, consecutive for every posting list
+//   DocumentEntry[fieldsNumber][documentSlots]  indexed by field and document index
+//   postings                          per word: (document gap, frequency) pairs sorted
+//                                     by document index, split into blocks of
+//                                     postingsBlockSize postings encoded by the word codec;
+//                                     Roaring lists start 8-byte aligned
+//   positions                         optional, per word and document: varbyte gaps
+//                                     of frequency positions of the word in the document
+// Every field of documents has its own posting lists and document lengths.
+// The body is the whole text of the document and the only field with positions.
+const char indexMagic[4] = {'I', 'R', 'I', 'X'};
+const uint32_t indexVersion = 6;
+
+const size_t postingsBlockSize = 128;
+
+struct IndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t termsNumber;
+    uint32_t documentSlots;
+    uint64_t documentsNumber;
+    double averageDocumentLength;
+    uint64_t termsOffset;
+    uint64_t blocksNumber;
+    uint64_t blocksOffset;
+    uint64_t documentsOffset;
+    uint64_t postingsOffset;
+    uint64_t postingsSize;
+    uint64_t positionsOffset;
+    uint64_t positionsSize;
+    uint32_t fieldsNumber;
+};
+
+enum DocumentField {
+    BodyField = 0,
+    TitleField = 1,
+    AnchorField = 2,
+    documentFieldsNumber
+};
+
+inline const char* getDocumentFieldName(DocumentField field) {
+    static const char* names[documentFieldsNumber] = {"body", "title", "anchor"};
+    return names[field];
+}
+
+inline DocumentField parseDocumentField(const string& name) {
+    for (int field = 0; field < documentFieldsNumber; ++field) {
+        if (name == getDocumentFieldName(static_cast<DocumentField>(field))) {
+            return static_cast<DocumentField>(field);
+        }
+    }
+    throw std::logic_error("Unknown document field " + name);
+}
+
+// Length is the total number of words in the field of the document
+struct DocumentEntry {
+    uint32_t maxFrequency;
+    uint32_t length;
+};
+
+// Statistics of a posting list or its block which bound the word contribution
+// into document score. Normalized frequency is word frequency divided by
+// max word frequency in the document.
+struct PostingStatistics {
+    float minNormalizedFrequency;
+    float maxNormalizedFrequency;
+    uint32_t maxFrequency;
+    uint32_t minDocumentLength;
+};
+
+struct TermEntry {
+    uint64_t offset;
+    uint64_t positionsOffset;
+    uint64_t firstBlock;
+    uint32_t documentsNumber;
+    uint32_t size;
+    PostingStatistics statistics;
+    uint32_t codec;
+};
+
+// Offsets are relative to the beginning of the word postings and positions
+struct BlockEntry {
+    uint32_t lastDocument;
+    uint32_t offset;
+    uint32_t positionsOffset;
+    PostingStatistics statistics;
+};
+
+inline float roundDown(double value) {
+    float result = static_cast<float>(value);
+    return result > value ? std::nextafter(result, -HUGE_VALF) : result;
+}
+
+inline float roundUp(double value) {
+    float result = static_cast<float>(value);
+    return result < value ? std::nextafter(result, HUGE_VALF) : result;
+}
+
+// Decodes one posting list on the fly, without materializing it. Blocks are decoded
+// as a whole when the cursor enters them, skip entries allow to jump over whole blocks.
+// Positions, when the index has them, are decoded only for documents which ask for them.
+class PostingCursor {
+public:
+    PostingCursor()
+    { }
+
+    PostingCursor(const uint8_t* begin, size_t size, const BlockEntry* blocks, size_t documentsNumber,
+                  PostingCodec codec, const uint8_t* positionsBegin = nullptr)
+        : begin(begin)
+        , listSize(size)
+        , blocks(blocks)
+        , documentsNumber(documentsNumber)
+        , codec(codec)
+        , positionsBegin(positionsBegin)
+        , positionsPosition(positionsBegin)
+    {
+        if (documentsNumber != 0) {
+            decodeBlock(0);
+            isValid = true;
+        }
+    }
+
+    bool valid() const {
+        return isValid;
+    }
+
+    int document() const {
+        return static_cast<int>(blockDocuments[blockPosition]);
+    }
+
+    int frequency() const {
+        return static_cast<int>(blockFrequencies[blockPosition]);
+    }
+
+    size_t size() const {
+        return isValid ? documentsNumber - block * postingsBlockSize - blockPosition : 0;
+    }
+
+    void next() {
+        if (!isValid) {
+            return;
+        }
+        if (positionsBegin != nullptr && !positionsRead) {
+            skippedPositions += blockFrequencies[blockPosition];
+        }
+        positionsRead = false;
+        if (blockPosition + 1 < blockSize) {
+            ++blockPosition;
+        } else if (block + 1 < blocksNumber()) {
+            decodeBlock(block + 1);
+        } else {
+            isValid = false;
+        }
+    }
+
+    // Postings of the current block from the current one on, decoded at once
+    size_t remainingBlockPostings() const {
+        return isValid ? blockSize - blockPosition : 0;
+    }
+
+    const uint32_t* remainingBlockDocuments() const {
+        return blockDocuments + blockPosition;
+    }
+
+    const uint32_t* remainingBlockFrequencies() const {
+        return blockFrequencies + blockPosition;
+    }
+
+    // Moves to the first posting of the next block
+    void nextBlock() {
+        if (isValid && block + 1 < blocksNumber()) {
+            seekBlock(block + 1);
+        } else {
+            isValid = false;
+        }
+    }
+
+    size_t getBlockPostings(size_t block) const {
+        return std::min(postingsBlockSize, documentsNumber - block * postingsBlockSize);
+    }
+
+    // Decodes all postings of the block into the arrays, without moving the cursor.
+    // Gaps of the first posting of a block are counted from the last document of the previous one,
+    // documents of Roaring lists are taken from the set after that document.
+    void decodeBlock(size_t block, uint32_t* documents, uint32_t* frequencies) const {
+        const uint8_t* blockBegin = begin + blocks[block].offset;
+        const uint8_t* blockEnd = block + 1 < blocksNumber() ? begin + blocks[block + 1].offset : begin + listSize;
+        size_t postingsNumber = getBlockPostings(block);
+        decodePostingsBlock(codec, blockBegin, blockEnd, postingsNumber, documents, frequencies);
+        if (codec == RoaringCodec) {
+            RoaringSet(begin).extract(block == 0 ? 0 : blocks[block - 1].lastDocument + 1, postingsNumber, documents);
+            return;
+        }
+        prefixSum(documents, postingsNumber, block == 0 ? 0 : blocks[block - 1].lastDocument);
+    }
+
+    // Moves to the first posting with document not less than target
+    void nextGEQ(int target) {
+        if (!isValid || document() >= target) {
+            return;
+        }
+        size_t targetBlock = findBlock(target);
+        if (targetBlock == blocksNumber()) {
+            isValid = false;
+            return;
+        }
+        if (targetBlock != currentBlock()) {
+            seekBlock(targetBlock);
+        }
+        while (isValid && document() < target) {
+            next();
+        }
+    }
+
+    // Block which may contain target, searched from the current block without decoding,
+    // blocksNumber() if target is beyond the last document
+    size_t findBlock(int target) const {
+        size_t targetBlock = isValid ? currentBlock() : blocksNumber();
+        while (targetBlock < blocksNumber() && static_cast<int>(blocks[targetBlock].lastDocument) < target) {
+            ++targetBlock;
+        }
+        return targetBlock;
+    }
+
+    size_t currentBlock() const {
+        return block;
+    }
+
+    size_t blocksNumber() const {
+        return (documentsNumber + postingsBlockSize - 1) / postingsBlockSize;
+    }
+
+    const BlockEntry& getBlock(size_t block) const {
+        return blocks[block];
+    }
+
+    bool hasPositions() const {
+        return positionsBegin != nullptr;
+    }
+
+    // Sorted positions of the word in the current document, empty if the index has no positions
+    void readPositions(vector<int>& positions) {
+        positions.clear();
+        if (!isValid || positionsBegin == nullptr) {
+            return;
+        }
+        if (!positionsRead) {
+            positionsPosition = skipVarBytes(positionsPosition, skippedPositions);
+            skippedPositions = 0;
+            currentPositions = positionsPosition;
+        }
+        const uint8_t* input = currentPositions;
+        uint32_t gap;
+        int documentPosition = 0;
+        for (int i = 0; i < frequency(); ++i) {
+            input = decodeVarByte(input, gap);
+            documentPosition += static_cast<int>(gap);
+            positions.push_back(documentPosition);
+        }
+        positionsPosition = input;
+        positionsRead = true;
+    }
+
+private:
+    void seekBlock(size_t targetBlock) {
+        decodeBlock(targetBlock);
+        if (positionsBegin != nullptr) {
+            positionsPosition = positionsBegin + blocks[targetBlock].positionsOffset;
+        }
+        skippedPositions = 0;
+        positionsRead = false;
+    }
+
+    void decodeBlock(size_t targetBlock) {
+        block = targetBlock;
+        blockPosition = 0;
+        blockSize = getBlockPostings(block);
+        decodeBlock(block, blockDocuments, blockFrequencies);
+    }
+
+    const uint8_t* begin = nullptr;
+    size_t listSize = 0;
+    const BlockEntry* blocks = nullptr;
+    size_t documentsNumber = 0;
+    PostingCodec codec = VarByteCodec;
+    size_t block = 0;
+    size_t blockPosition = 0;
+    size_t blockSize = 0;
+    uint32_t blockDocuments[postingsBlockSize];
+    uint32_t blockFrequencies[postingsBlockSize];
+    bool isValid = false;
+    // Positions of the current document start after skippedPositions codes from positionsPosition
+    const uint8_t* positionsBegin = nullptr;
+    const uint8_t* positionsPosition = nullptr;
+    const uint8_t* currentPositions = nullptr;
+    size_t skippedPositions = 0;
+    bool positionsRead = false;
+};
+
+struct PostingList {
+    size_t size() const {
+        return documents.size();
+    }
+
+    vector<int> documents;
+    vector<int> frequencies;
+};
+
+// Accumulates posting lists and serializes them into the binary index layout.
+class IndexWriter {
+public:
+    typedef std::pair<int, int> Posting;
+
+    // Codec of the posting lists added after the call, varbyte by default
+    void setPostingCodec(PostingCodec codec) {
+        postingCodec = codec;
+    }
+
+    // Lists whose documents take less space as a Roaring set than as varbyte gaps
+    // are stored by RoaringCodec whatever the posting codec, unless disabled
+    void setDenseListBitmaps(bool enabled) {
+        denseListBitmaps = enabled;
+    }
+
+    void addPostingList(int wordIndex, vector<Posting> postings) {
+        addPostingList(wordIndex, std::move(postings), vector<vector<int>>());
+    }
+
+    // positions[i] are the positions of the word in the document of postings[i], as many
+    // as its frequency. Either every posting list of the index has positions or none.
+    void addPostingList(int wordIndex, vector<Posting> postings, vector<vector<int>> positions) {
+        addFieldPostingList(BodyField, wordIndex, std::move(postings), std::move(positions));
+    }
+
+    // Posting list of the word in a field of documents, only the body has positions
+    void addFieldPostingList(DocumentField field, int wordIndex, vector<Posting> postings,
+                             vector<vector<int>> positions = vector<vector<int>>()) {
+        if (wordIndex < 0) {
+            throw std::logic_error("Negative word index " + std::to_string(wordIndex));
+        }
+        if (field < 0 || field >= documentFieldsNumber) {
+            throw std::logic_error("Unknown document field " + std::to_string(field));
+        }
+        if (static_cast<size_t>(field) >= fieldsTerms.size()) {
+            fieldsTerms.resize(field + 1);
+            fieldsDocuments.resize(field + 1);
+        }
+        vector<TermEntry>& terms = fieldsTerms[field];
+        if (static_cast<size_t>(wordIndex) >= terms.size()) {
+            terms.resize(wordIndex + 1, TermEntry());
+        }
+        if (terms[wordIndex].documentsNumber != 0) {
+            throw std::logic_error("Duplicate posting list for word " + std::to_string(wordIndex));
+        }
+
+        bool positional = !positions.empty();
+        if (positional && field != BodyField) {
+            throw std::logic_error("Positions in " + string(getDocumentFieldName(field))
+                                   + " of word " + std::to_string(wordIndex));
+        }
+        if (positional && positions.size() != postings.size()) {
+            throw std::logic_error("Positions don't match postings of word " + std::to_string(wordIndex));
+        }
+        if (!postings.empty() && field == BodyField) {
+            (positional ? hasPositionalLists : hasPlainLists) = true;
+        }
+        if (hasPositionalLists && hasPlainLists) {
+            throw std::logic_error("Posting lists with and without positions in word " + std::to_string(wordIndex));
+        }
+
+        // Postings are sorted by document with their positions, the first posting added for a document is kept
+        vector<size_t> order(postings.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_t lhs, size_t rhs) { return postings[lhs].first < postings[rhs].first; });
+        order.erase(std::unique(order.begin(), order.end(),
+            [&](size_t lhs, size_t rhs) { return postings[lhs].first == postings[rhs].first; }),
+            order.end());
+
+        PostingCodec codec = postingCodec;
+        vector<int> documents(order.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            documents[i] = postings[order[i]].first;
+        }
+        if (codec == RoaringCodec || (denseListBitmaps && isDenseList(documents))) {
+            codec = RoaringCodec;
+            postingsData.resize(align(postingsData.size()), 0);
+        }
+
+        TermEntry& entry = terms[wordIndex];
+        entry.offset = postingsData.size();
+        entry.positionsOffset = positionsData.size();
+        entry.firstBlock = blocks.size();
+        entry.codec = codec;
+        if (codec == RoaringCodec && !documents.empty()) {
+            if (documents[0] < 0) {
+                throw std::logic_error("Negative posting in word " + std::to_string(wordIndex));
+            }
+            encodeRoaring(documents, postingsData);
+        }
+        uint32_t gaps[postingsBlockSize];
+        uint32_t frequencies[postingsBlockSize];
+        int previousDocument = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            int documentIndex = postings[order[i]].first;
+            int frequency = postings[order[i]].second;
+            if (documentIndex < 0 || frequency < 0) {
+                throw std::logic_error("Negative posting in word " + std::to_string(wordIndex));
+            }
+            if (i % postingsBlockSize == 0) {
+                BlockEntry block = BlockEntry();
+                block.offset = postingsData.size() - entry.offset;
+                block.positionsOffset = positionsData.size() - entry.positionsOffset;
+                blocks.push_back(block);
+            }
+            blocks.back().lastDocument = documentIndex;
+            gaps[i % postingsBlockSize] = documentIndex - previousDocument;
+            frequencies[i % postingsBlockSize] = frequency;
+            if (i % postingsBlockSize == postingsBlockSize - 1 || i + 1 == order.size()) {
+                encodePostingsBlock(codec, gaps, frequencies, i % postingsBlockSize + 1, postingsData);
+            }
+            if (positional) {
+                encodePositions(wordIndex, frequency, positions[order[i]]);
+            }
+            previousDocument = documentIndex;
+            addDocument(field, documentIndex, frequency);
+        }
+        entry.documentsNumber = order.size();
+        entry.size = postingsData.size() - entry.offset;
+    }
+
+    // Tables of all fields are padded to the same number of words and documents
+    vector<char> serialize() const {
+        size_t fieldsNumber = std::max<size_t>(fieldsTerms.size(), 1);
+        size_t termsNumber = 0;
+        size_t documentSlots = 0;
+        for (size_t field = 0; field < fieldsTerms.size(); ++field) {
+            termsNumber = std::max(termsNumber, fieldsTerms[field].size());
+            documentSlots = std::max(documentSlots, fieldsDocuments[field].size());
+        }
+        vector<TermEntry> termsTable(fieldsNumber * termsNumber, TermEntry());
+        vector<DocumentEntry> documentsTable(fieldsNumber * documentSlots, DocumentEntry());
+        vector<BlockEntry> blocksTable(blocks);
+        for (size_t field = 0; field < fieldsTerms.size(); ++field) {
+            vector<TermEntry>::iterator fieldTerms = termsTable.begin() + field * termsNumber;
+            std::copy(fieldsTerms[field].begin(), fieldsTerms[field].end(), fieldTerms);
+            fillPostingStatistics(fieldsDocuments[field], fieldTerms, fieldTerms + fieldsTerms[field].size(),
+                                  blocksTable);
+            std::copy(fieldsDocuments[field].begin(), fieldsDocuments[field].end(),
+                      documentsTable.begin() + field * documentSlots);
+        }
+
+        IndexHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+        header.version = indexVersion;
+        header.termsNumber = termsNumber;
+        header.documentSlots = documentSlots;
+        header.documentsNumber = documentsNumber;
+        header.averageDocumentLength = documentsNumber == 0 ? 0.0 : totalFrequency * 1.0 / documentsNumber;
+        header.termsOffset = align(sizeof(IndexHeader));
+        header.blocksNumber = blocks.size();
+        header.blocksOffset = align(header.termsOffset + termsTable.size() * sizeof(TermEntry));
+        header.documentsOffset = align(header.blocksOffset + blocks.size() * sizeof(BlockEntry));
+        header.postingsOffset = align(header.documentsOffset + documentsTable.size() * sizeof(DocumentEntry));
+        header.postingsSize = postingsData.size();
+        header.positionsOffset = align(header.postingsOffset + postingsData.size());
+        header.positionsSize = positionsData.size();
+        header.fieldsNumber = fieldsNumber;
+
+        vector<char> image(header.positionsOffset + positionsData.size(), 0);
+        std::memcpy(&image[0], &header, sizeof(header));
+        if (!termsTable.empty()) {
+            std::memcpy(&image[header.termsOffset], &termsTable[0], termsTable.size() * sizeof(TermEntry));
+        }
+        if (!blocks.empty()) {
+            std::memcpy(&image[header.blocksOffset], &blocksTable[0], blocks.size() * sizeof(BlockEntry));
+        }
+        if (!documentsTable.empty()) {
+            std::memcpy(&image[header.documentsOffset], &documentsTable[0],
+                        documentsTable.size() * sizeof(DocumentEntry));
+        }
+        if (!postingsData.empty()) {
+            std::memcpy(&image[header.postingsOffset], &postingsData[0], postingsData.size());
+        }
+        if (!positionsData.empty()) {
+            std::memcpy(&image[header.positionsOffset], &positionsData[0], positionsData.size());
+        }
+        return image;
+    }
+
+private:
+    static uint64_t align(uint64_t offset) {
+        return (offset + 7) & ~static_cast<uint64_t>(7);
+    }
+
+    static bool isDenseList(const vector<int>& documents) {
+        size_t gapsSize = 0;
+        int previousDocument = 0;
+        for (int document : documents) {
+            uint32_t gap = document - previousDocument;
+            gapsSize += gap < (1U << 7) ? 1 : gap < (1U << 14) ? 2 : gap < (1U << 21) ? 3 : gap < (1U << 28) ? 4 : 5;
+            previousDocument = document;
+        }
+        return !documents.empty() && documents[0] >= 0 && getRoaringSize(documents) < gapsSize;
+    }
+
+    void encodePositions(int wordIndex, int frequency, vector<int>& documentPositions) {
+        if (documentPositions.size() != static_cast<size_t>(frequency)) {
+            throw std::logic_error("Positions don't match frequency of word " + std::to_string(wordIndex));
+        }
+        std::sort(documentPositions.begin(), documentPositions.end());
+        int previousPosition = 0;
+        for (int documentPosition : documentPositions) {
+            if (documentPosition < previousPosition) {
+                throw std::logic_error("Negative position of word " + std::to_string(wordIndex));
+            }
+            encodeVarByte(documentPosition - previousPosition, positionsData);
+            previousPosition = documentPosition;
+        }
+    }
+
+    // Max frequency and length of a document are known only after all words are added
+    void fillPostingStatistics(const vector<DocumentEntry>& documentsTable, vector<TermEntry>::iterator termsBegin,
+                               vector<TermEntry>::iterator termsEnd, vector<BlockEntry>& blocksTable) const {
+        for (vector<TermEntry>::iterator term = termsBegin; term != termsEnd; ++term) {
+            TermEntry& entry = *term;
+            if (entry.documentsNumber == 0) {
+                continue;
+            }
+            StatisticsAccumulator termStatistics;
+            PostingCursor cursor(&postingsData[entry.offset], entry.size, &blocksTable[entry.firstBlock],
+                                 entry.documentsNumber, static_cast<PostingCodec>(entry.codec));
+            for (size_t block = 0; block < cursor.blocksNumber(); ++block) {
+                StatisticsAccumulator blockStatistics;
+                for (size_t i = 0; i < postingsBlockSize && cursor.valid(); ++i, cursor.next()) {
+                    blockStatistics.add(cursor.frequency(), documentsTable[cursor.document()]);
+                }
+                blocksTable[entry.firstBlock + block].statistics = blockStatistics.get();
+                termStatistics.merge(blockStatistics);
+            }
+            entry.statistics = termStatistics.get();
+        }
+    }
+
+    struct StatisticsAccumulator {
+        void add(uint32_t frequency, const DocumentEntry& document) {
+            double normalizedFrequency = document.maxFrequency == 0 ? 0.0 : frequency * 1.0 / document.maxFrequency;
+            minNormalizedFrequency = std::min(minNormalizedFrequency, normalizedFrequency);
+            maxNormalizedFrequency = std::max(maxNormalizedFrequency, normalizedFrequency);
+            maxFrequency = std::max(maxFrequency, frequency);
+            minDocumentLength = std::min(minDocumentLength, document.length);
+        }
+
+        void merge(const StatisticsAccumulator& other) {
+            minNormalizedFrequency = std::min(minNormalizedFrequency, other.minNormalizedFrequency);
+            maxNormalizedFrequency = std::max(maxNormalizedFrequency, other.maxNormalizedFrequency);
+            maxFrequency = std::max(maxFrequency, other.maxFrequency);
+            minDocumentLength = std::min(minDocumentLength, other.minDocumentLength);
+        }
+
+        PostingStatistics get() const {
+            PostingStatistics statistics;
+            statistics.minNormalizedFrequency = roundDown(minNormalizedFrequency);
+            statistics.maxNormalizedFrequency = roundUp(maxNormalizedFrequency);
+            statistics.maxFrequency = maxFrequency;
+            statistics.minDocumentLength = minDocumentLength;
+            return statistics;
+        }
+
+        double minNormalizedFrequency = HUGE_VAL;
+        double maxNormalizedFrequency = 0.0;
+        uint32_t maxFrequency = 0;
+        uint32_t minDocumentLength = std::numeric_limits<uint32_t>::max();
+    };
+
+    // Documents of the collection are the documents having a body
+    void addDocument(DocumentField field, int documentIndex, int frequency) {
+        vector<DocumentEntry>& documentsTable = fieldsDocuments[field];
+        if (static_cast<size_t>(documentIndex) >= documentsTable.size()) {
+            documentsTable.resize(documentIndex + 1, DocumentEntry());
+        }
+        DocumentEntry& document = documentsTable[documentIndex];
+        document.maxFrequency = std::max<uint32_t>(document.maxFrequency, frequency);
+        document.length += frequency;
+        if (field != BodyField) {
+            return;
+        }
+        if (static_cast<size_t>(documentIndex) >= documentSeen.size()) {
+            documentSeen.resize(documentIndex + 1, false);
+        }
+        if (!documentSeen[documentIndex]) {
+            documentSeen[documentIndex] = true;
+            ++documentsNumber;
+        }
+        totalFrequency += frequency;
+    }
+
+    vector<vector<TermEntry>> fieldsTerms;
+    vector<BlockEntry> blocks;
+    vector<vector<DocumentEntry>> fieldsDocuments;
+    vector<bool> documentSeen;
+    vector<uint8_t> postingsData;
+    vector<uint8_t> positionsData;
+    PostingCodec postingCodec = VarByteCodec;
+    bool denseListBitmaps = true;
+    bool hasPositionalLists = false;
+    bool hasPlainLists = false;
+    uint64_t documentsNumber = 0;
+    uint64_t totalFrequency = 0;
+};
+
+// Inverted index over a binary image. The image is either memory-mapped
+// from a binary index file or built in memory from the text format,
+// posting lists are decoded only when requested.
+// Copies share the same image.
+class Index {
+public:
+    Index() {
+        attachImage(IndexWriter().serialize());
+    }
+
+    explicit Index(const IndexWriter& writer) {
+        attachImage(writer.serialize());
+    }
+
+    void readFromFile(const string& filename) {
+        if (isBinaryIndexFile(filename)) {
+            readBinaryFile(filename);
+        } else {
+            readTextFile(filename);
+        }
+    }
+
+    void readBinaryFile(const string& filename) {
+        std::cerr << "Mapping binary index from " << filename << std::endl;
+
+        std::shared_ptr<MappedFile> mappedFile = std::make_shared<MappedFile>(filename);
+        attach(mappedFile, mappedFile->data(), mappedFile->size());
+
+        std::cerr << "Finished mapping " << documentsNumber() << " documents" << std::endl;
+    }
+
+    // Lines "wordIndex document:frequency[:position,...] ..." are parsed in chunks on all cores,
+    // posting lists are encoded by the codec. Lines "wordIndex@field document:frequency ..."
+    // hold the posting list of the word in another field than the body, as "12@title".
+    void readTextFile(const string& filename, PostingCodec codec = VarByteCodec) {
+        std::cerr << "Reading index from " << filename << std::endl;
+
+        struct WordPostings {
+            DocumentField field;
+            int wordIndex;
+            vector<IndexWriter::Posting> postings;
+            vector<vector<int>> positions;
+            bool merged = false;
+        };
+        MappedFile mappedFile(filename);
+        vector<vector<WordPostings>> chunks = parseLineChunks<vector<WordPostings>>(
+            mappedFile.data(), mappedFile.size(),
+            [](const char* begin, const char* end, vector<WordPostings>& wordsPostings) {
+                TextScanner scanner(begin, end);
+                for (; !scanner.finished(); scanner.nextLine()) {
+                    int wordIndex;
+                    if (!scanner.hasToken()) {
+                        continue;
+                    }
+                    if (!scanner.readInt(wordIndex)) {
+                        throw std::logic_error("Malformed word index in text index");
+                    }
+                    WordPostings word;
+                    word.field = BodyField;
+                    word.wordIndex = wordIndex;
+                    if (scanner.readChar('@')) {
+                        const char* fieldBegin;
+                        const char* fieldEnd;
+                        if (!scanner.readToken(fieldBegin, fieldEnd)) {
+                            throw std::logic_error("Malformed field of word " + std::to_string(wordIndex));
+                        }
+                        word.field = parseDocumentField(string(fieldBegin, fieldEnd));
+                    }
+                    int documentIndex, frequency;
+                    while (scanner.hasToken()) {
+                        if (!scanner.readInt(documentIndex) || !scanner.readChar(':') || !scanner.readInt(frequency)) {
+                            throw std::logic_error("Malformed posting of word " + std::to_string(wordIndex));
+                        }
+                        word.postings.push_back(IndexWriter::Posting(documentIndex, frequency));
+                        if (scanner.readChar(':')) {
+                            word.positions.resize(word.postings.size());
+                            vector<int>& documentPositions = word.positions.back();
+                            int documentPosition;
+                            do {
+                                if (!scanner.readInt(documentPosition)) {
+                                    throw std::logic_error("Malformed positions of word " + std::to_string(wordIndex));
+                                }
+                                documentPositions.push_back(documentPosition);
+                            } while (scanner.readChar(','));
+                        }
+                    }
+                    if (!word.positions.empty() && word.positions.size() != word.postings.size()) {
+                        throw std::logic_error("Missing positions of word " + std::to_string(wordIndex));
+                    }
+                    wordsPostings.push_back(std::move(word));
+                }
+            });
+
+        // Postings of a word on several lines are merged into its first line,
+        // for a document on several of them the last line wins
+        vector<vector<WordPostings*>> firstLines(documentFieldsNumber);
+        vector<WordPostings*> mergedLines;
+        for (auto& chunk : chunks) {
+            for (auto& word : chunk) {
+                if (word.wordIndex < 0) {
+                    throw std::logic_error("Negative word index " + std::to_string(word.wordIndex));
+                }
+                vector<WordPostings*>& fieldLines = firstLines[word.field];
+                if (static_cast<size_t>(word.wordIndex) >= fieldLines.size()) {
+                    fieldLines.resize(word.wordIndex + 1, nullptr);
+                }
+                WordPostings*& first = fieldLines[word.wordIndex];
+                if (first == nullptr) {
+                    first = &word;
+                    continue;
+                }
+                if (first->positions.empty() != word.positions.empty()) {
+                    throw std::logic_error("Missing positions of word " + std::to_string(word.wordIndex));
+                }
+                if (!first->merged) {
+                    first->merged = true;
+                    mergedLines.push_back(first);
+                }
+                first->postings.insert(first->postings.end(), word.postings.begin(), word.postings.end());
+                std::move(word.positions.begin(), word.positions.end(), std::back_inserter(first->positions));
+                word.wordIndex = -1;
+            }
+        }
+        for (WordPostings* word : mergedLines) {
+            keepLastPostings(word->postings, word->positions);
+        }
+
+        IndexWriter writer;
+        writer.setPostingCodec(codec);
+        for (auto& chunk : chunks) {
+            for (auto& word : chunk) {
+                if (word.wordIndex >= 0) {
+                    writer.addFieldPostingList(word.field, word.wordIndex, std::move(word.postings),
+                                               std::move(word.positions));
+                }
+            }
+            vector<WordPostings>().swap(chunk);
+        }
+
+        attachImage(writer.serialize());
+
+        std::cerr << "Finished reading " << documentsNumber() << " documents" << std::endl;
+    }
+
+    void writeToFile(const string& filename) const {
+        std::ofstream output(filename, std::ios::binary);
+
+        if (!output.is_open()) {
+            throw std::logic_error("Can't open file " + filename);
+        }
+
+        output.write(imageData, imageSize);
+    }
+
+    static bool isBinaryIndexFile(const string& filename) {
+        std::ifstream input(filename, std::ios::binary);
+        char magic[sizeof(indexMagic)];
+        return input.read(magic, sizeof(magic)) && std::memcmp(magic, indexMagic, sizeof(magic)) == 0;
+    }
+
+    size_t documentsNumber() const {
+        return collectionDocumentsNumber;
+    }
+
+    size_t wordsNumber() const {
+        return header->termsNumber;
+    }
+
+    // Bytes taken by the encoded postings of all words
+    size_t postingsSize() const {
+        return header->postingsSize;
+    }
+
+    // Documents are numbered in [0, documentSlots())
+    size_t documentSlots() const {
+        return header->documentSlots;
+    }
+
+    size_t getWordDocumentsNumber(int wordIndex) const {
+        return getTermEntry(wordIndex).documentsNumber;
+    }
+
+    PostingCursor getPostingCursor(int wordIndex) const {
+        TermEntry entry = getTermEntry(wordIndex);
+        return PostingCursor(postings + entry.offset, entry.size, blocks + entry.firstBlock, entry.documentsNumber,
+                             static_cast<PostingCodec>(entry.codec),
+                             hasPositions() ? positions + entry.positionsOffset : nullptr);
+    }
+
+    // Fields of documents which have posting lists, the body at least
+    size_t fieldsNumber() const {
+        return header->fieldsNumber;
+    }
+
+    // Posting list of the word in a field, empty if the index doesn't have the field
+    PostingCursor getFieldPostingCursor(DocumentField field, int wordIndex) const {
+        if (field == BodyField) {
+            return getPostingCursor(wordIndex);
+        }
+        TermEntry entry = getTermEntry(field, wordIndex);
+        return PostingCursor(postings + entry.offset, entry.size, blocks + entry.firstBlock, entry.documentsNumber,
+                             static_cast<PostingCodec>(entry.codec));
+    }
+
+    PostingCodec getFieldPostingCodec(DocumentField field, int wordIndex) const {
+        return static_cast<PostingCodec>(getTermEntry(field, wordIndex).codec);
+    }
+
+    // Number of words in the field of the document
+    int getFieldLength(DocumentField field, int documentIndex) const {
+        if (documentIndex < 0 || static_cast<size_t>(documentIndex) >= header->documentSlots) {
+            throw std::out_of_range("Unknown document " + std::to_string(documentIndex));
+        }
+        if (static_cast<size_t>(field) >= header->fieldsNumber) {
+            return 0;
+        }
+        return documents[static_cast<size_t>(field) * header->documentSlots + documentIndex].length;
+    }
+
+    // Average over the documents of the collection, which may have the field empty
+    double getAverageFieldLength(DocumentField field) const {
+        return static_cast<size_t>(field) < averageFieldLengths.size() ? averageFieldLengths[field] : 0.0;
+    }
+
+    PostingCodec getPostingCodec(int wordIndex) const {
+        return static_cast<PostingCodec>(getTermEntry(wordIndex).codec);
+    }
+
+    // Documents of a word stored by RoaringCodec
+    RoaringSet getRoaringSet(int wordIndex) const {
+        TermEntry entry = getTermEntry(wordIndex);
+        if (entry.codec != RoaringCodec || entry.documentsNumber == 0) {
+            throw std::logic_error("Posting list of word " + std::to_string(wordIndex) + " is not a Roaring set");
+        }
+        return RoaringSet(postings + entry.offset);
+    }
+
+    // Index built from posting lists with positions of words in documents
+    bool hasPositions() const {
+        return header->positionsSize != 0;
+    }
+
+    PostingStatistics getPostingStatistics(int wordIndex) const {
+        return getTermEntry(wordIndex).statistics;
+    }
+
+    // Inverse document frequency, computed for all words when the index is loaded
+    double getIdf(int wordIndex) const {
+        if (wordIndex < 0 || static_cast<size_t>(wordIndex) >= idfs->size()) {
+            return evaluateIdf(0);
+        }
+        return (*idfs)[wordIndex];
+    }
+
+    PostingList getPostingList(int wordIndex) const {
+        PostingList postingList;
+        decodePostingList(wordIndex, postingList);
+        return postingList;
+    }
+
+    // Decodes into the vectors of postingList, reusing their capacity.
+    // Blocks are decoded straight into the vectors, except the first one decoded by the cursor.
+    void decodePostingList(int wordIndex, PostingList& postingList) const {
+        size_t documentsNumber = getWordDocumentsNumber(wordIndex);
+        postingList.documents.resize(documentsNumber);
+        postingList.frequencies.resize(documentsNumber);
+        if (documentsNumber == 0) {
+            return;
+        }
+        uint32_t* documents = reinterpret_cast<uint32_t*>(postingList.documents.data());
+        uint32_t* frequencies = reinterpret_cast<uint32_t*>(postingList.frequencies.data());
+        PostingCursor cursor = getPostingCursor(wordIndex);
+        size_t firstBlockPostings = cursor.getBlockPostings(0);
+        std::memcpy(documents, cursor.remainingBlockDocuments(), firstBlockPostings * sizeof(uint32_t));
+        std::memcpy(frequencies, cursor.remainingBlockFrequencies(), firstBlockPostings * sizeof(uint32_t));
+        for (size_t block = 1; block < cursor.blocksNumber(); ++block) {
+            size_t position = block * postingsBlockSize;
+            cursor.decodeBlock(block, documents + position, frequencies + position);
+        }
+    }
+
+    int getMaxWordDocumentFrequency(int documentIndex) const {
+        return getDocument(documentIndex).maxFrequency;
+    }
+
+    int getDocumentLength(int documentIndex) const {
+        return getDocument(documentIndex).length;
+    }
+
+    const DocumentEntry& getDocument(int documentIndex) const {
+        if (documentIndex < 0 || static_cast<size_t>(documentIndex) >= header->documentSlots) {
+            throw std::out_of_range("Unknown document " + std::to_string(documentIndex));
+        }
+        return documents[documentIndex];
+    }
+
+    double getAverageDocumentLength() const {
+        return averageDocumentLength;
+    }
+
+    // A shard of the collection takes the number of documents, their average length
+    // and word idfs from the whole collection, so its scores are the same as there
+    void shareCollectionStatistics(const Index& collection) {
+        collectionDocumentsNumber = collection.collectionDocumentsNumber;
+        averageDocumentLength = collection.averageDocumentLength;
+        averageFieldLengths = collection.averageFieldLengths;
+        idfs = collection.idfs;
+    }
+
+    // A segment of a collection split into independently built segments takes
+    // the number of documents, their average length and the number of documents
+    // of every word summed over all segments
+    void setCollectionStatistics(size_t documentsNumber, const vector<double>& averageLengths,
+                                 const vector<size_t>& wordDocumentsNumbers) {
+        collectionDocumentsNumber = documentsNumber;
+        averageFieldLengths = averageLengths;
+        averageFieldLengths.resize(documentFieldsNumber, 0.0);
+        averageDocumentLength = averageFieldLengths[BodyField];
+        std::shared_ptr<vector<double>> wordIdfs = std::make_shared<vector<double>>(wordDocumentsNumbers.size());
+        for (size_t i = 0; i < wordDocumentsNumbers.size(); ++i) {
+            (*wordIdfs)[i] = evaluateIdf(wordDocumentsNumbers[i]);
+        }
+        idfs = wordIdfs;
+    }
+
+private:
+    // Keeps the last posting of every document with its positions, in the order of documents
+    static void keepLastPostings(vector<IndexWriter::Posting>& postings, vector<vector<int>>& positions) {
+        vector<size_t> order(postings.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_t lhs, size_t rhs) { return postings[lhs].first < postings[rhs].first; });
+        vector<IndexWriter::Posting> lastPostings;
+        vector<vector<int>> lastPositions;
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (i + 1 < order.size() && postings[order[i + 1]].first == postings[order[i]].first) {
+                continue;
+            }
+            lastPostings.push_back(postings[order[i]]);
+            if (!positions.empty()) {
+                lastPositions.push_back(std::move(positions[order[i]]));
+            }
+        }
+        postings.swap(lastPostings);
+        positions.swap(lastPositions);
+    }
+
+    void attachImage(vector<char> image) {
+        std::shared_ptr<vector<char>> buffer = std::make_shared<vector<char>>(std::move(image));
+        attach(buffer, buffer->data(), buffer->size());
+    }
+
+    void attach(std::shared_ptr<const void> owner, const char* data, size_t size) {
+        if (size < sizeof(IndexHeader) || std::memcmp(data, indexMagic, sizeof(indexMagic)) != 0) {
+            throw std::logic_error("Not a binary index");
+        }
+        const IndexHeader* candidate = reinterpret_cast<const IndexHeader*>(data);
+        if (candidate->version != indexVersion) {
+            throw std::logic_error("Unsupported index version " + std::to_string(candidate->version));
+        }
+        if (candidate->fieldsNumber == 0 || candidate->fieldsNumber > documentFieldsNumber) {
+            throw std::logic_error("Unsupported number of fields " + std::to_string(candidate->fieldsNumber));
+        }
+        if (candidate->termsOffset + candidate->fieldsNumber * candidate->termsNumber * sizeof(TermEntry) > size
+                || candidate->blocksOffset + candidate->blocksNumber * sizeof(BlockEntry) > size
+                || candidate->documentsOffset
+                   + candidate->fieldsNumber * candidate->documentSlots * sizeof(DocumentEntry) > size
+                || candidate->postingsOffset + candidate->postingsSize > size
+                || candidate->positionsOffset + candidate->positionsSize > size) {
+            throw std::logic_error("Truncated binary index");
+        }
+
+        imageOwner = owner;
+        imageData = data;
+        imageSize = size;
+        header = candidate;
+        terms = reinterpret_cast<const TermEntry*>(data + header->termsOffset);
+        blocks = reinterpret_cast<const BlockEntry*>(data + header->blocksOffset);
+        documents = reinterpret_cast<const DocumentEntry*>(data + header->documentsOffset);
+        postings = reinterpret_cast<const uint8_t*>(data + header->postingsOffset);
+        positions = reinterpret_cast<const uint8_t*>(data + header->positionsOffset);
+        collectionDocumentsNumber = header->documentsNumber;
+        averageDocumentLength = header->averageDocumentLength;
+
+        averageFieldLengths.assign(documentFieldsNumber, 0.0);
+        averageFieldLengths[BodyField] = averageDocumentLength;
+        for (size_t field = 1; field < header->fieldsNumber && header->documentsNumber > 0; ++field) {
+            double totalLength = 0.0;
+            for (size_t document = 0; document < header->documentSlots; ++document) {
+                totalLength += documents[field * header->documentSlots + document].length;
+            }
+            averageFieldLengths[field] = totalLength / header->documentsNumber;
+        }
+
+        for (size_t i = 0; i < header->fieldsNumber * header->termsNumber; ++i) {
+            if (terms[i].codec >= postingCodecsNumber) {
+                throw std::logic_error("Unknown posting codec " + std::to_string(terms[i].codec));
+            }
+            checkPostingList(terms[i]);
+        }
+        std::shared_ptr<vector<double>> wordIdfs = std::make_shared<vector<double>>(header->termsNumber);
+        for (size_t i = 0; i < header->termsNumber; ++i) {
+            (*wordIdfs)[i] = evaluateIdf(terms[i].documentsNumber);
+        }
+        idfs = wordIdfs;
+    }
+
+    // Blocks of the list have to lie in the block table and their bytes in the postings and positions,
+    // so that cursors never read past the image of a corrupt index
+    void checkPostingList(const TermEntry& entry) const {
+        if (entry.documentsNumber == 0) {
+            return;
+        }
+        uint64_t listBlocks = (entry.documentsNumber + postingsBlockSize - 1) / postingsBlockSize;
+        if (entry.firstBlock > header->blocksNumber || listBlocks > header->blocksNumber - entry.firstBlock
+                || entry.offset > header->postingsSize || entry.size > header->postingsSize - entry.offset
+                || entry.positionsOffset > header->positionsSize) {
+            throw std::logic_error("Corrupt posting list in binary index");
+        }
+        if (entry.codec == RoaringCodec && (!RoaringSet::isValid(postings + entry.offset, entry.size)
+                || RoaringSet(postings + entry.offset).size() != entry.documentsNumber)) {
+            throw std::logic_error("Corrupt Roaring set in binary index");
+        }
+        uint32_t previousOffset = 0;
+        int64_t previousDocument = -1;
+        for (uint64_t block = entry.firstBlock; block < entry.firstBlock + listBlocks; ++block) {
+            const BlockEntry& blockEntry = blocks[block];
+            if (blockEntry.offset < previousOffset || blockEntry.offset > entry.size
+                    || blockEntry.lastDocument <= previousDocument || blockEntry.lastDocument >= header->documentSlots
+                    || blockEntry.positionsOffset > header->positionsSize - entry.positionsOffset) {
+                throw std::logic_error("Corrupt posting block in binary index");
+            }
+            previousOffset = blockEntry.offset;
+            previousDocument = blockEntry.lastDocument;
+        }
+    }
+
+    double evaluateIdf(size_t wordDocumentsNumber) const {
+        return log((documentsNumber() - wordDocumentsNumber + 0.5) / (wordDocumentsNumber + 0.5));
+    }
+
+    // Words missing from the index have empty posting lists
+    TermEntry getTermEntry(int wordIndex) const {
+        if (wordIndex < 0 || static_cast<size_t>(wordIndex) >= header->termsNumber) {
+            return TermEntry();
+        }
+        return terms[wordIndex];
+    }
+
+    TermEntry getTermEntry(DocumentField field, int wordIndex) const {
+        if (wordIndex < 0 || static_cast<size_t>(wordIndex) >= header->termsNumber
+                || static_cast<size_t>(field) >= header->fieldsNumber) {
+            return TermEntry();
+        }
+        return terms[static_cast<size_t>(field) * header->termsNumber + wordIndex];
+    }
+
+    std::shared_ptr<const void> imageOwner;
+    const char* imageData = nullptr;
+    size_t imageSize = 0;
+    const IndexHeader* header = nullptr;
+    const TermEntry* terms = nullptr;
+    const BlockEntry* blocks = nullptr;
+    const DocumentEntry* documents = nullptr;
+    const uint8_t* postings = nullptr;
+    const uint8_t* positions = nullptr;
+    size_t collectionDocumentsNumber = 0;
+    double averageDocumentLength = 0.0;
+    vector<double> averageFieldLengths;
+    std::shared_ptr<const vector<double>> idfs;
+};
+
+// Posting lists of a word in all fields of the index merged by document: the cursor stands
+// at the least document having the word in any field and gives the frequency in every field
+class FieldsCursor {
+public:
+    FieldsCursor(const Index& index, int wordIndex)
+        : fieldsNumber(index.fieldsNumber())
+    {
+        for (size_t field = 0; field < fieldsNumber; ++field) {
+            cursors[field] = index.getFieldPostingCursor(static_cast<DocumentField>(field), wordIndex);
+            listsSize += cursors[field].size();
+        }
+        updateDocument();
+    }
+
+    bool valid() const {
+        return currentDocument != std::numeric_limits<int>::max();
+    }
+
+    int document() const {
+        return currentDocument;
+    }
+
+    // Zero if the document doesn't have the word in the field
+    int frequency(DocumentField field) const {
+        const PostingCursor& cursor = cursors[field];
+        return static_cast<size_t>(field) < fieldsNumber && cursor.valid() && cursor.document() == currentDocument
+            ? cursor.frequency() : 0;
+    }
+
+    // Postings in all fields, at least the number of documents
+    size_t size() const {
+        return listsSize;
+    }
+
+    void nextGEQ(int target) {
+        if (currentDocument >= target) {
+            return;
+        }
+        for (size_t field = 0; field < fieldsNumber; ++field) {
+            cursors[field].nextGEQ(target);
+        }
+        updateDocument();
+    }
+
+private:
+    void updateDocument() {
+        currentDocument = std::numeric_limits<int>::max();
+        for (size_t field = 0; field < fieldsNumber; ++field) {
+            if (cursors[field].valid()) {
+                currentDocument = std::min(currentDocument, cursors[field].document());
+            }
+        }
+    }
+
+    PostingCursor cursors[documentFieldsNumber];
+    size_t fieldsNumber;
+    size_t listsSize = 0;
+    int currentDocument = std::numeric_limits<int>::max();
+};
+
+} // namespace irindexer
+
+#endif // INDEX_HPP
@@ -0,0 +1,128 @@
+#ifndef INTERSECTION_HPP
+#define INTERSECTION_HPP
+
+#include <algorithm>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace irindexer {
+
+using std::vector;
+
+// How a step of a conjunctive query gets its documents: the first list is scanned,
+// other lists are merged with the candidates or galloped through by them, Roaring sets
+// are intersected container by container or probed with the candidates
+enum IntersectionStrategy { ScanStrategy, MergeStrategy, GallopStrategy, BitmapStrategy };
+
+inline const char* getIntersectionStrategyName(IntersectionStrategy strategy) {
+    static const char* names[] = {"scan", "merge", "gallop", "bitmap"};
+    return names[strategy];
+}
+
+// Lists which differ in length more than this are intersected by galloping,
+// otherwise by block merge
+const size_t gallopingLengthRatio = 32;
+
+// First position in [begin, end) not less than value: doubles the step from begin
+// and finishes with binary search inside the last step
+inline const int* gallopingLowerBound(const int* begin, const int* end, int value) {
+    size_t length = end - begin;
+    size_t step = 1;
+    size_t previous = 0;
+    while (step < length && begin[step] < value) {
+        previous = step;
+        step <<= 1;
+    }
+    return std::lower_bound(begin + previous, begin + std::min(step + 1, length), value);
+}
+
+inline void intersectGalloping(const vector<int>& shorter, const vector<int>& longer, vector<int>& output) {
+    output.clear();
+    const int* position = longer.data();
+    const int* end = longer.data() + longer.size();
+    for (int document : shorter) {
+        position = gallopingLowerBound(position, end, document);
+        if (position == end) {
+            break;
+        }
+        if (*position == document) {
+            output.push_back(document);
+        }
+    }
+}
+
+inline void intersectScalarMerge(const int* first, const int* firstEnd,
+                                 const int* second, const int* secondEnd, vector<int>& output) {
+    while (first != firstEnd && second != secondEnd) {
+        if (*first < *second) {
+            ++first;
+        } else if (*second < *first) {
+            ++second;
+        } else {
+            output.push_back(*first);
+            ++first;
+            ++second;
+        }
+    }
+}
+
+// Merge intersection working on blocks of 4 documents: every block of the first list
+// is compared with all rotations of the current block of the second list at once
+inline void intersectBlockMerge(const vector<int>& firstList, const vector<int>& secondList, vector<int>& output) {
+    output.clear();
+    const int* first = firstList.data();
+    const int* firstEnd = first + firstList.size();
+    const int* second = secondList.data();
+    const int* secondEnd = second + secondList.size();
+
+#ifdef __SSE2__
+    const int* firstBlocksEnd = first + (firstList.size() & ~size_t(3));
+    const int* secondBlocksEnd = second + (secondList.size() & ~size_t(3));
+    while (first != firstBlocksEnd && second != secondBlocksEnd) {
+        __m128i firstBlock = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        __m128i secondBlock = _mm_loadu_si128(reinterpret_cast<const __m128i*>(second));
+
+        __m128i equal = _mm_cmpeq_epi32(firstBlock, secondBlock);
+        equal = _mm_or_si128(equal, _mm_cmpeq_epi32(firstBlock, _mm_shuffle_epi32(secondBlock, _MM_SHUFFLE(0, 3, 2, 1))));
+        equal = _mm_or_si128(equal, _mm_cmpeq_epi32(firstBlock, _mm_shuffle_epi32(secondBlock, _MM_SHUFFLE(1, 0, 3, 2))));
+        equal = _mm_or_si128(equal, _mm_cmpeq_epi32(firstBlock, _mm_shuffle_epi32(secondBlock, _MM_SHUFFLE(2, 1, 0, 3))));
+
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+        for (int i = 0; mask != 0; ++i, mask >>= 1) {
+            if (mask & 1) {
+                output.push_back(first[i]);
+            }
+        }
+
+        int firstMax = first[3];
+        int secondMax = second[3];
+        if (firstMax <= secondMax) {
+            first += 4;
+        }
+        if (secondMax <= firstMax) {
+            second += 4;
+        }
+    }
+#endif
+
+    intersectScalarMerge(first, firstEnd, second, secondEnd, output);
+}
+
+// Intersects sorted candidates with a sorted list into output, galloping through the list
+// when it is much longer than the candidates and merging them otherwise. Returns the strategy used.
+inline IntersectionStrategy intersectCandidates(const vector<int>& candidates, const vector<int>& list,
+                                                vector<int>& output) {
+    if (candidates.size() * gallopingLengthRatio < list.size()) {
+        intersectGalloping(candidates, list, output);
+        return GallopStrategy;
+    }
+    intersectBlockMerge(candidates, list, output);
+    return MergeStrategy;
+}
+
+} // namespace irindexer
+
+#endif // INTERSECTION_HPP
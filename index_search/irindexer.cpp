@@ -2,6 +2,14 @@
 #include <cstdlib>
 #include <cstdio>
 
+#include <csignal>
+#include <sstream>
+#include <thread>
+
+#include "batch_runner.hpp"
+#include "codec_benchmark.hpp"
+#include "docid_reordering.hpp"
+#include "query_server.hpp"
 #include "search_engine.hpp"
 
 using namespace irindexer;
@@ -14,9 +22,243 @@ void printTop(const std::vector<SearchEngine::DocumentScore> &phraseDocuments, s
     std::cout << std::endl;
 }
 
+int compressIndex(const std::string& textIndexPath, const std::string& binaryIndexPath, PostingCodec codec) {
+    Index index;
+    index.readTextFile(textIndexPath, codec);
+    index.writeToFile(binaryIndexPath);
+    std::cerr << "Binary index written to " << binaryIndexPath << std::endl;
+    return 0;
+}
+
+int compressDictionary(const std::string& textDictionaryPath, const std::string& binaryDictionaryPath) {
+    Dictionary dictionary;
+    dictionary.readTextFile(textDictionaryPath);
+    dictionary.writeToFile(binaryDictionaryPath);
+    std::cerr << "Binary dictionary written to " << binaryDictionaryPath << std::endl;
+    return 0;
+}
+
+int benchmarkCodecs(const std::string& indexPath, size_t repetitions) {
+    Index index;
+    index.readFromFile(indexPath);
+    CodecBenchmark(index, repetitions).run();
+    return 0;
+}
+
+// Orders documents by "url" with the urls mapping of flatten, by graph "bisection"
+// or by decreasing "staticrank" of the static rank file
+int reorderDocuments(const std::string& indexPath, const std::string& reorderedIndexPath,
+                     const std::string& mappingPath, const std::string& method, const std::string& orderPath) {
+    Index index;
+    index.readFromFile(indexPath);
+    std::vector<int> order;
+    if (method == "url") {
+        order = orderDocumentsByUrls(index, orderPath);
+    } else if (method == "bisection") {
+        order = GraphBisection(index).orderDocuments();
+    } else if (method == "staticrank") {
+        StaticRank staticRank;
+        staticRank.readFromFile(orderPath);
+        order = orderDocumentsByStaticRank(index, staticRank);
+    } else {
+        throw std::logic_error("Unknown reordering " + method);
+    }
+    Index reordered = reorderIndex(index, order);
+    reordered.writeToFile(reorderedIndexPath);
+    writeDocumentMapping(order, mappingPath);
+    std::cout << "Postings: " << index.postingsSize() << " bytes before, " << reordered.postingsSize()
+              << " bytes after reordering" << std::endl;
+    std::cerr << "Reordered index written to " << reorderedIndexPath << ", document mapping to "
+              << mappingPath << std::endl;
+    return 0;
+}
+
+// Static rank of documents from the pagerank file of flat_webgraph, renumbered
+// by the document mapping of a reordering when the index was reordered
+int convertPageranks(const std::string& pageranksPath, const std::string& urlsMappingPath,
+                     const std::string& staticRankPath, const std::string& mappingPath) {
+    StaticRank staticRank;
+    staticRank.readPageranks(pageranksPath, urlsMappingPath);
+    if (!mappingPath.empty()) {
+        staticRank.renumberDocuments(mappingPath);
+    }
+    staticRank.writeToFile(staticRankPath);
+    std::cerr << "Static rank written to " << staticRankPath << std::endl;
+    return 0;
+}
+
+int buildImpactIndex(const std::string& indexPath, const std::string& impactIndexPath) {
+    Index index;
+    index.readFromFile(indexPath);
+    ImpactIndexWriter(index).writeToFile(impactIndexPath);
+    std::cerr << "Impact index written to " << impactIndexPath << std::endl;
+    return 0;
+}
+
+// Segments of new documents are flushed after this many documents
+// and merged this many at a time
+const size_t segmentFlushDocuments = 1000;
+const size_t segmentMergeFactor = 4;
+
+// Lines ":add DOCUMENT TEXT", ":delete DOCUMENT" and ":flush" update the segments.
+// False if the line is not an update.
+bool applyUpdate(const std::string& line, const SearchEngine& searchEngine, SegmentedIndex& segmentedIndex) {
+    std::istringstream lineStream(line);
+    std::string command;
+    lineStream >> command;
+    int document;
+    if (command == ":add" && lineStream >> document) {
+        std::string text;
+        std::getline(lineStream, text);
+        segmentedIndex.addDocument(document, searchEngine.lookupWords(text));
+        std::cout << "Added document " << document << std::endl;
+    } else if (command == ":delete" && lineStream >> document) {
+        segmentedIndex.deleteDocument(document);
+        std::cout << "Deleted document " << document << std::endl;
+    } else if (command == ":flush") {
+        segmentedIndex.flush();
+        std::cout << "Flushed into " << segmentedIndex.segmentsNumber() << " segments" << std::endl;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Serves queries from stdin when socketPath is "-", otherwise from clients of the unix socket
+int serveQueries(const std::string& socketPath, const std::string& dictPath, const std::string& indexPath,
+                 size_t workersNumber, size_t cacheMegabytes,
+                 const textnorm::NormalizerOptions& normalizerOptions) {
+    SearchEngine searchEngine(dictPath, indexPath);
+    searchEngine.setNormalization(normalizerOptions);
+    if (cacheMegabytes > 0) {
+        searchEngine.enableResultCache(cacheMegabytes << 20, 4 * workersNumber);
+        searchEngine.enablePostingCache(cacheMegabytes << 20, 4 * workersNumber);
+    }
+    // Clients going away must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    QueryServer server(searchEngine, workersNumber, 10);
+    if (socketPath == "-") {
+        server.serveStream(0, 1);
+    } else {
+        server.serveSocket(socketPath);
+    }
+    return 0;
+}
+
+int runBatch(const std::string& queriesPath, const std::string& outputPath, const std::string& dictPath,
+             const std::string& indexPath, size_t threadsNumber, size_t topNumber,
+             const textnorm::NormalizerOptions& normalizerOptions) {
+    SearchEngine searchEngine(dictPath, indexPath);
+    searchEngine.setNormalization(normalizerOptions);
+    BatchRunner<BM25DocumentScoreEvaluator>(searchEngine, threadsNumber, topNumber).run(queriesPath, outputPath);
+    std::cerr << "Results written to " << outputPath << std::endl;
+    return 0;
+}
+
+// Search options given to a mode which doesn't support them are reported rather than ignored
+bool checkSearchOptions(const std::vector<std::string>& searchOptions, const std::string& mode,
+                        const std::vector<std::string>& supportedOptions) {
+    for (const auto& option : searchOptions) {
+        if (std::find(supportedOptions.begin(), supportedOptions.end(), option) == supportedOptions.end()) {
+            std::cerr << option << " is not supported by " << mode << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 int main(int argc, char **argv) {
+    std::string programName(argv[0]);
+    // Options of the search come before the mode or the dictionary, in any order.
+    // Words of queries are normalized as build_index normalized the documents.
+    textnorm::NormalizerOptions normalizerOptions;
+    size_t shardsNumber = 1;
+    std::string segmentsDirectory;
+    std::string staticRankPath;
+    std::vector<std::string> searchOptions;
+    while (argc > 1) {
+        std::string option(argv[1]);
+        size_t optionArguments = 0;
+        if (option == "--stemming") {
+            normalizerOptions.stemming = true;
+        } else if (option == "--stop-words") {
+            normalizerOptions.stopWords = true;
+        } else if (option == "--shards" && argc > 2) {
+            shardsNumber = std::atoi(argv[2]);
+            optionArguments = 1;
+        } else if (option == "--segments" && argc > 2) {
+            segmentsDirectory = argv[2];
+            optionArguments = 1;
+        } else if (option == "--static-rank" && argc > 2) {
+            staticRankPath = argv[2];
+            optionArguments = 1;
+        } else {
+            break;
+        }
+        searchOptions.push_back(option);
+        argc -= 1 + optionArguments;
+        argv += 1 + optionArguments;
+    }
+
+    // Server and batch mode only normalize queries as the interactive search does, other modes don't search
+    std::string mode = (argc > 1 && std::string(argv[1]).compare(0, 2, "--") == 0) ? argv[1] : "";
+    std::vector<std::string> supportedOptions;
+    if (mode == "--serve" || mode == "--batch") {
+        supportedOptions = {"--stemming", "--stop-words"};
+    }
+    if (!mode.empty() && !checkSearchOptions(searchOptions, mode, supportedOptions)) {
+        return 1;
+    }
+
+    if (argc >= 4 && argc <= 5 && std::string(argv[1]) == "--compress") {
+        return compressIndex(argv[2], argv[3], (argc >= 5) ? parsePostingCodec(argv[4]) : VarByteCodec);
+    }
+    if (argc >= 3 && argc <= 4 && std::string(argv[1]) == "--codec-benchmark") {
+        return benchmarkCodecs(argv[2], (argc >= 4) ? std::atoi(argv[3]) : 10);
+    }
+    if (argc == 4 && std::string(argv[1]) == "--compress-dictionary") {
+        return compressDictionary(argv[2], argv[3]);
+    }
+    if (argc >= 6 && argc <= 7 && std::string(argv[1]) == "--reorder") {
+        return reorderDocuments(argv[2], argv[3], argv[4], argv[5], (argc >= 7) ? argv[6] : "");
+    }
+    if (argc >= 5 && argc <= 6 && std::string(argv[1]) == "--pagerank") {
+        return convertPageranks(argv[2], argv[3], argv[4], (argc >= 6) ? argv[5] : "");
+    }
+    if (argc == 4 && std::string(argv[1]) == "--impacts") {
+        return buildImpactIndex(argv[2], argv[3]);
+    }
+    if (argc >= 5 && argc <= 7 && std::string(argv[1]) == "--serve") {
+        size_t workersNumber = (argc >= 6) ? std::atoi(argv[5]) : std::thread::hardware_concurrency();
+        size_t cacheMegabytes = (argc >= 7) ? std::atoi(argv[6]) : 64;
+        return serveQueries(argv[2], argv[3], argv[4], std::max<size_t>(workersNumber, 1), cacheMegabytes,
+                            normalizerOptions);
+    }
+
+    if (argc >= 6 && argc <= 8 && std::string(argv[1]) == "--batch") {
+        size_t threadsNumber = (argc >= 7) ? std::atoi(argv[6]) : std::thread::hardware_concurrency();
+        size_t topNumber = (argc >= 8) ? std::atoi(argv[7]) : 10;
+        return runBatch(argv[2], argv[3], argv[4], argv[5], std::max<size_t>(threadsNumber, 1), topNumber,
+                        normalizerOptions);
+    }
+
     if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " DICTIONARY_FILE INDEX_FILE " << std::endl;
+        std::cerr << "Usage: " << programName << " [--stemming] [--stop-words] [--shards N] [--segments DIRECTORY]"
+                  << " [--static-rank STATIC_RANK_FILE] DICTIONARY_FILE INDEX_FILE [IMPACT_INDEX_FILE]" << std::endl;
+        std::cerr << "       " << programName << " --compress TEXT_INDEX_FILE BINARY_INDEX_FILE"
+                  << " [varbyte|streamvbyte|roaring]" << std::endl;
+        std::cerr << "       " << programName << " --codec-benchmark INDEX_FILE [REPETITIONS]" << std::endl;
+        std::cerr << "       " << programName << " --compress-dictionary TEXT_DICTIONARY_FILE BINARY_DICTIONARY_FILE"
+                  << std::endl;
+        std::cerr << "       " << programName << " --reorder INDEX_FILE REORDERED_INDEX_FILE MAPPING_FILE"
+                  << " bisection|url URLS_MAPPING_FILE|staticrank STATIC_RANK_FILE" << std::endl;
+        std::cerr << "       " << programName << " --pagerank PAGERANK_FILE URLS_MAPPING_FILE STATIC_RANK_FILE"
+                  << " [MAPPING_FILE]" << std::endl;
+        std::cerr << "       " << programName << " --impacts INDEX_FILE IMPACT_INDEX_FILE" << std::endl;
+        std::cerr << "       " << programName << " [--stemming] [--stop-words] --serve SOCKET_PATH|-"
+                  << " DICTIONARY_FILE INDEX_FILE [WORKERS [CACHE_MB]]" << std::endl;
+        std::cerr << "       " << programName << " [--stemming] [--stop-words] --batch QUERIES_FILE OUTPUT_FILE"
+                  << " DICTIONARY_FILE INDEX_FILE [THREADS [TOP]]" << std::endl;
         return 0;
     }
 
@@ -24,7 +266,24 @@ int main(int argc, char **argv) {
     std::string indexPath(argv[2]);
 
     SearchEngine searchEngine(dictPath, indexPath);
+    searchEngine.setNormalization(normalizerOptions);
+    searchEngine.splitIntoShards(shardsNumber);
+    if (argc > 3) {
+        searchEngine.readImpactIndex(argv[3]);
+    }
+    if (!staticRankPath.empty()) {
+        searchEngine.readStaticRank(staticRankPath);
+    }
+    searchEngine.enableTermExpansion(32);
+    searchEngine.setVerbose(true);
+    std::shared_ptr<SegmentedIndex> segmentedIndex;
+    if (!segmentsDirectory.empty()) {
+        segmentedIndex = std::make_shared<SegmentedIndex>(segmentsDirectory, searchEngine.getIndex(),
+                                                          segmentFlushDocuments, segmentMergeFactor);
+        searchEngine.attachSegments(segmentedIndex);
+    }
 
+    SearchEngine::QueryContext queryContext;
     while (!feof(stdin)) {
         std::cout << "Search query: ";
         std::string searchPhrase;
@@ -34,9 +293,35 @@ int main(int argc, char **argv) {
         if (feof(stdin)) {
             break;
         }
+        if (segmentedIndex && applyUpdate(searchPhrase, searchEngine, *segmentedIndex)) {
+            continue;
+        }
+        const std::string explainCommand(":explain ");
+        if (searchPhrase.compare(0, explainCommand.size(), explainCommand) == 0) {
+            std::string query = searchPhrase.substr(explainCommand.size());
+            printTop(searchEngine.ExplainPhraseSearch<BM25DocumentScoreEvaluator>(query, 10, std::cout), 10);
+            std::cout << "--------------------------------" << std::endl;
+            continue;
+        }
 
-        printTop(searchEngine.ScoredPhraseSearch<TFIDFDocumentScoreEvaluator>(searchPhrase), 10);
-        printTop(searchEngine.ScoredPhraseSearch<BM25DocumentScoreEvaluator>(searchPhrase), 10);
+        printTop(searchEngine.TopScoredPhraseSearch<TFIDFDocumentScoreEvaluator>(searchPhrase, 10), 10);
+        printTop(searchEngine.TopScoredPhraseSearch<BM25DocumentScoreEvaluator>(searchPhrase, 10), 10);
+        printTop(searchEngine.DisjunctivePhraseSearch<BM25DocumentScoreEvaluator>(searchPhrase, 10), 10);
+        if (searchEngine.hasImpactIndex()) {
+            printTop(searchEngine.ImpactPhraseSearch(searchPhrase, 10, queryContext), 10);
+        }
+        if (searchEngine.hasStaticRank()) {
+            printTop(searchEngine.StaticRankPhraseSearch<BM25DocumentScoreEvaluator>(searchPhrase, 10), 10);
+        }
+        if (searchEngine.hasFields()) {
+            printTop(searchEngine.FieldedPhraseSearch(searchPhrase, 10), 10);
+        }
+        if (searchEngine.hasPositions()) {
+            printTop(searchEngine.ExactPhraseSearch<BM25DocumentScoreEvaluator>(searchPhrase, 10), 10);
+        }
+        if (searchEngine.needsTermExpansion(searchPhrase)) {
+            printTop(searchEngine.ExpandedPhraseSearch<BM25DocumentScoreEvaluator>(searchPhrase, 10), 10);
+        }
 
         std::cout << "--------------------------------" << std::endl;
     }
@@ -0,0 +1,67 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <string>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace irindexer {
+
+// Read-only view of the whole file mapped into memory.
+// Pages are loaded by the kernel on first access, so opening is O(1)
+// regardless of file size.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename) {
+        int descriptor = ::open(filename.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::logic_error("Can't open file " + filename);
+        }
+
+        struct stat fileStat;
+        if (::fstat(descriptor, &fileStat) < 0) {
+            ::close(descriptor);
+            throw std::logic_error("Can't stat file " + filename);
+        }
+
+        fileSize = static_cast<size_t>(fileStat.st_size);
+        if (fileSize > 0) {
+            void* mapping = ::mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, descriptor, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(descriptor);
+                throw std::logic_error("Can't map file " + filename);
+            }
+            fileData = static_cast<const char*>(mapping);
+        }
+        ::close(descriptor);
+    }
+
+    ~MappedFile() {
+        if (fileData != nullptr) {
+            ::munmap(const_cast<char*>(fileData), fileSize);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    const char* data() const {
+        return fileData;
+    }
+
+    size_t size() const {
+        return fileSize;
+    }
+
+private:
+    const char* fileData = nullptr;
+    size_t fileSize = 0;
+};
+
+} // namespace irindexer
+
+#endif // MAPPED_FILE_HPP
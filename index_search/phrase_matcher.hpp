@@ -0,0 +1,75 @@
+#ifndef PHRASE_MATCHER_HPP
+#define PHRASE_MATCHER_HPP
+
+#include <vector>
+
+#include "index.hpp"
+
+namespace irindexer {
+
+using std::vector;
+
+// Document filters are checked by conjunctive search on the documents where
+// all cursors are aligned, before the document is scored.
+
+// Accepts every document containing all words
+struct AnyDocumentFilter {
+    bool matches(vector<PostingCursor>& cursors) {
+        return true;
+    }
+};
+
+// Accepts documents where the words of the phrase, in the order of cursors,
+// occur one after another with at most slop other words between them in total.
+// Positions are decoded only for the documents which get here.
+class PhraseMatcher {
+public:
+    explicit PhraseMatcher(size_t slop)
+        : slop(slop)
+    { }
+
+    bool matches(vector<PostingCursor>& cursors) {
+        positions.resize(cursors.size());
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            cursors[i].readPositions(positions[i]);
+            if (positions[i].empty()) {
+                return false;
+            }
+        }
+
+        // Every word is matched greedily at its first position after the previous word,
+        // which gives the shortest span for the start. Later starts never need earlier positions.
+        nextPositions.assign(cursors.size(), 0);
+        for (int start : positions[0]) {
+            int previous = start;
+            size_t gaps = 0;
+            bool matched = true;
+            for (size_t i = 1; i < positions.size() && matched; ++i) {
+                const vector<int>& wordPositions = positions[i];
+                size_t& next = nextPositions[i];
+                while (next < wordPositions.size() && wordPositions[next] <= previous) {
+                    ++next;
+                }
+                if (next == wordPositions.size()) {
+                    return false;
+                }
+                gaps += wordPositions[next] - previous - 1;
+                matched = gaps <= slop;
+                previous = wordPositions[next];
+            }
+            if (matched) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    size_t slop;
+    vector<vector<int>> positions;
+    vector<size_t> nextPositions;
+};
+
+} // namespace irindexer
+
+#endif // PHRASE_MATCHER_HPP
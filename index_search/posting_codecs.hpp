@@ -0,0 +1,253 @@
+#ifndef POSTING_CODECS_HPP
+#define POSTING_CODECS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IRINDEXER_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "varbyte.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Posting lists are split into blocks which are encoded and decoded as a whole.
+// The codec is chosen for every posting list and recorded in the index:
+//   VarByteCodec       varbyte (document gap, frequency) pairs
+//   StreamVByteCodec   StreamVByte: control bytes of the gaps, then of the frequencies,
+//                      each holding 2-bit byte lengths of four numbers, followed by
+//                      the little-endian bytes of the gaps and then of the frequencies
+//   RoaringCodec       documents of the whole list as a RoaringSet, then blocks
+//                      of StreamVByte frequencies
+enum PostingCodec {
+    VarByteCodec = 0,
+    StreamVByteCodec = 1,
+    RoaringCodec = 2,
+    postingCodecsNumber
+};
+
+inline const char* getPostingCodecName(PostingCodec codec) {
+    static const char* names[postingCodecsNumber] = {"varbyte", "streamvbyte", "roaring"};
+    return names[codec];
+}
+
+inline PostingCodec parsePostingCodec(const string& name) {
+    for (int codec = 0; codec < postingCodecsNumber; ++codec) {
+        if (name == getPostingCodecName(static_cast<PostingCodec>(codec))) {
+            return static_cast<PostingCodec>(codec);
+        }
+    }
+    throw std::logic_error("Unknown posting codec " + name);
+}
+
+inline size_t getStreamVByteLength(uint32_t value) {
+    return value < (1U << 8) ? 1 : value < (1U << 16) ? 2 : value < (1U << 24) ? 3 : 4;
+}
+
+// Appends control bytes of the values to controls and their bytes to data
+inline void encodeStreamVByte(const uint32_t* values, size_t count,
+                              vector<uint8_t>& controls, vector<uint8_t>& data) {
+    for (size_t i = 0; i < count; i += 4) {
+        uint8_t control = 0;
+        for (size_t j = i; j < std::min(count, i + 4); ++j) {
+            size_t length = getStreamVByteLength(values[j]);
+            control |= static_cast<uint8_t>((length - 1) << (2 * (j - i)));
+            for (size_t k = 0; k < length; ++k) {
+                data.push_back(static_cast<uint8_t>(values[j] >> (8 * k)));
+            }
+        }
+        controls.push_back(control);
+    }
+}
+
+// Decodes count values from data in [data, end), returns the end of their bytes.
+// Kernels never read at or past end.
+typedef const uint8_t* (*StreamVByteDecoder)(const uint8_t* controls, const uint8_t* data, const uint8_t* end,
+                                             size_t count, uint32_t* values);
+
+inline const uint8_t* decodeStreamVByteScalar(const uint8_t* controls, const uint8_t* data, const uint8_t* end,
+                                              size_t count, uint32_t* values) {
+    for (size_t i = 0; i < count; ++i) {
+        size_t length = ((controls[i / 4] >> (2 * (i % 4))) & 3) + 1;
+        uint32_t value = 0;
+        for (size_t k = 0; k < length; ++k) {
+            value |= static_cast<uint32_t>(data[k]) << (8 * k);
+        }
+        values[i] = value;
+        data += length;
+    }
+    return data;
+}
+
+#ifdef IRINDEXER_X86_KERNELS
+
+// For every control byte: shuffle moving the bytes of its four numbers into 32-bit lanes
+// and the total length of the numbers
+struct StreamVByteTables {
+    StreamVByteTables() {
+        for (int control = 0; control < 256; ++control) {
+            int offset = 0;
+            for (int i = 0; i < 4; ++i) {
+                int length = ((control >> (2 * i)) & 3) + 1;
+                for (int k = 0; k < 4; ++k) {
+                    shuffles[control][4 * i + k] = k < length ? static_cast<uint8_t>(offset + k) : 0x80;
+                }
+                offset += length;
+            }
+            lengths[control] = static_cast<uint8_t>(offset);
+        }
+    }
+
+    uint8_t shuffles[256][16];
+    uint8_t lengths[256];
+};
+
+inline const StreamVByteTables& getStreamVByteTables() {
+    static const StreamVByteTables tables;
+    return tables;
+}
+
+// Four numbers of a control byte per shuffle, while a whole 16-byte load fits before end
+__attribute__((target("ssse3")))
+inline const uint8_t* decodeStreamVByteSSSE3(const uint8_t* controls, const uint8_t* data, const uint8_t* end,
+                                             size_t count, uint32_t* values) {
+    const StreamVByteTables& tables = getStreamVByteTables();
+    size_t i = 0;
+    for (; i + 4 <= count && end - data >= 16; i += 4) {
+        uint8_t control = controls[i / 4];
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.shuffles[control]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), _mm_shuffle_epi8(input, shuffle));
+        data += tables.lengths[control];
+    }
+    return decodeStreamVByteScalar(controls + i / 4, data, end, count - i, values + i);
+}
+
+// Eight numbers of two control bytes per shuffle, one control byte in every 128-bit lane
+__attribute__((target("avx2")))
+inline const uint8_t* decodeStreamVByteAVX2(const uint8_t* controls, const uint8_t* data, const uint8_t* end,
+                                            size_t count, uint32_t* values) {
+    const StreamVByteTables& tables = getStreamVByteTables();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8_t lowControl = controls[i / 4];
+        uint8_t highControl = controls[i / 4 + 1];
+        size_t lowLength = tables.lengths[lowControl];
+        if (end - data < static_cast<ptrdiff_t>(lowLength + 16)) {
+            break;
+        }
+        __m256i input = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + lowLength)), 1);
+        __m256i shuffle = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.shuffles[lowControl]))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.shuffles[highControl])), 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), _mm256_shuffle_epi8(input, shuffle));
+        data += lowLength + tables.lengths[highControl];
+    }
+    return decodeStreamVByteSSSE3(controls + i / 4, data, end, count - i, values + i);
+}
+
+#endif // IRINDEXER_X86_KERNELS
+
+// Turns gaps into running sums starting from base, four at a time with SSE2
+inline void prefixSum(uint32_t* values, size_t count, uint32_t base) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i previous = _mm_set1_epi32(base);
+    for (; i + 4 <= count; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        block = _mm_add_epi32(block, _mm_slli_si128(block, 4));
+        block = _mm_add_epi32(block, _mm_slli_si128(block, 8));
+        block = _mm_add_epi32(block, previous);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), block);
+        previous = _mm_shuffle_epi32(block, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    base = i == 0 ? base : values[i - 1];
+#endif
+    for (; i < count; ++i) {
+        base += values[i];
+        values[i] = base;
+    }
+}
+
+struct StreamVByteKernel {
+    const char* name;
+    StreamVByteDecoder decode;
+};
+
+// Kernels supported by the processor, the fastest one last
+inline vector<StreamVByteKernel> getStreamVByteKernels() {
+    vector<StreamVByteKernel> kernels;
+    kernels.push_back(StreamVByteKernel{"scalar", decodeStreamVByteScalar});
+#ifdef IRINDEXER_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        kernels.push_back(StreamVByteKernel{"ssse3", decodeStreamVByteSSSE3});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(StreamVByteKernel{"avx2", decodeStreamVByteAVX2});
+    }
+#endif
+    return kernels;
+}
+
+// The fastest kernel, chosen once at runtime
+inline const StreamVByteKernel& getStreamVByteKernel() {
+    static const StreamVByteKernel kernel = getStreamVByteKernels().back();
+    return kernel;
+}
+
+// Appends the block of count postings, gaps are differences of documents
+// with the previous posting of the list. Roaring blocks keep only frequencies.
+inline void encodePostingsBlock(PostingCodec codec, const uint32_t* gaps, const uint32_t* frequencies,
+                                size_t count, vector<uint8_t>& output) {
+    if (codec == VarByteCodec) {
+        for (size_t i = 0; i < count; ++i) {
+            encodeVarByte(gaps[i], output);
+            encodeVarByte(frequencies[i], output);
+        }
+    } else if (codec == RoaringCodec) {
+        vector<uint8_t> data;
+        encodeStreamVByte(frequencies, count, output, data);
+        output.insert(output.end(), data.begin(), data.end());
+    } else if (codec == StreamVByteCodec) {
+        vector<uint8_t> data;
+        encodeStreamVByte(gaps, count, output, data);
+        encodeStreamVByte(frequencies, count, output, data);
+        output.insert(output.end(), data.begin(), data.end());
+    } else {
+        throw std::logic_error("Unknown posting codec " + std::to_string(codec));
+    }
+}
+
+// Decodes the block of count postings taking bytes [input, end), gaps of Roaring blocks are left as is
+inline void decodePostingsBlock(PostingCodec codec, const uint8_t* input, const uint8_t* end, size_t count,
+                                uint32_t* gaps, uint32_t* frequencies,
+                                StreamVByteDecoder decoder = getStreamVByteKernel().decode) {
+    if (codec == StreamVByteCodec) {
+        size_t controlsLength = (count + 3) / 4;
+        const uint8_t* data = decoder(input, input + 2 * controlsLength, end, count, gaps);
+        decoder(input + controlsLength, data, end, count, frequencies);
+    } else if (codec == RoaringCodec) {
+        decoder(input, input + (count + 3) / 4, end, count, frequencies);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            input = decodeVarByte(input, gaps[i]);
+            input = decodeVarByte(input, frequencies[i]);
+        }
+    }
+}
+
+} // namespace irindexer
+
+#endif // POSTING_CODECS_HPP
@@ -0,0 +1,111 @@
+#ifndef QUERY_PLANNER_HPP
+#define QUERY_PLANNER_HPP
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#include "dictionary.hpp"
+#include "index.hpp"
+#include "intersection.hpp"
+
+namespace irindexer {
+
+using std::vector;
+
+// One query word of the plan. Candidates are documents containing the words of this
+// and all previous steps, estimated by the plan and counted when the step is executed.
+struct PlanStep {
+    int wordIndex = 0;
+    size_t keyword = 0;
+    size_t documentsNumber = 0;
+    bool isRoaring = false;
+    IntersectionStrategy plannedStrategy = ScanStrategy;
+    double estimatedCandidates = 0.0;
+
+    bool executed = false;
+    IntersectionStrategy strategy = ScanStrategy;
+    size_t candidates = 0;
+    double microseconds = 0.0;
+};
+
+// Order in which the posting lists of a conjunctive query are intersected, planned from
+// the numbers of documents of the words before any list is decoded. Execution stops
+// at the first step leaving no candidates, so the lists of later steps are never decoded.
+struct QueryPlan {
+    vector<PlanStep> steps;
+    size_t collectionDocuments = 0;
+};
+
+// Decoded lists go first from the most selective word, as every one of them has to be
+// decoded anyway for scoring and each step can only shrink the candidates. Roaring sets
+// follow, as probing a set costs the same for every candidate; they are intersected
+// with each other only when all words are dense. Estimates assume independent words.
+inline void planConjunction(const Index& index, const vector<int>& wordIndices, QueryPlan& plan) {
+    plan.steps.resize(wordIndices.size());
+    plan.collectionDocuments = index.documentsNumber();
+    for (size_t i = 0; i < wordIndices.size(); ++i) {
+        PlanStep& step = plan.steps[i];
+        step = PlanStep();
+        step.wordIndex = wordIndices[i];
+        step.keyword = i;
+        step.documentsNumber = index.getWordDocumentsNumber(wordIndices[i]);
+        step.isRoaring = index.getPostingCodec(wordIndices[i]) == RoaringCodec;
+    }
+    std::sort(plan.steps.begin(), plan.steps.end(), [](const PlanStep& lhs, const PlanStep& rhs) {
+        if (lhs.isRoaring != rhs.isRoaring) {
+            return rhs.isRoaring;
+        }
+        return lhs.documentsNumber < rhs.documentsNumber;
+    });
+
+    double candidates = 0.0;
+    for (size_t i = 0; i < plan.steps.size(); ++i) {
+        PlanStep& step = plan.steps[i];
+        if (i == 0) {
+            step.plannedStrategy = step.isRoaring ? BitmapStrategy : ScanStrategy;
+            candidates = step.documentsNumber;
+        } else {
+            if (step.isRoaring) {
+                step.plannedStrategy = BitmapStrategy;
+            } else if (candidates * gallopingLengthRatio < step.documentsNumber) {
+                step.plannedStrategy = GallopStrategy;
+            } else {
+                step.plannedStrategy = MergeStrategy;
+            }
+            candidates *= plan.collectionDocuments == 0 ? 0.0 : step.documentsNumber * 1.0 / plan.collectionDocuments;
+        }
+        step.estimatedCandidates = candidates;
+        step.strategy = step.plannedStrategy;
+    }
+}
+
+// Steps of the plan with the strategies planned and used, candidates estimated and
+// found and the time of every executed step
+inline void printQueryPlan(const QueryPlan& plan, const Dictionary& dict, std::ostream& output) {
+    output << "Plan of " << plan.steps.size() << " words over " << plan.collectionDocuments
+           << " documents" << std::endl;
+    output << std::left << std::setw(20) << "word" << std::right << std::setw(12) << "documents"
+           << std::setw(10) << "planned" << std::setw(14) << "estimated" << std::setw(10) << "used"
+           << std::setw(12) << "candidates" << std::setw(12) << "time us" << std::endl;
+    for (const PlanStep& step : plan.steps) {
+        output << std::left << std::setw(20) << dict.getWordRecord(step.wordIndex).word << std::right
+               << std::setw(12) << step.documentsNumber
+               << std::setw(10) << getIntersectionStrategyName(step.plannedStrategy)
+               << std::fixed << std::setprecision(1) << std::setw(14) << step.estimatedCandidates;
+        if (step.executed) {
+            output << std::setw(10) << getIntersectionStrategyName(step.strategy)
+                   << std::setw(12) << step.candidates << std::setw(12) << step.microseconds;
+        } else {
+            output << std::setw(34) << "skipped";
+        }
+        output << std::endl;
+        output.unsetf(std::ios::fixed);
+        output << std::setprecision(6);
+    }
+}
+
+} // namespace irindexer
+
+#endif // QUERY_PLANNER_HPP
@@ -0,0 +1,425 @@
+#ifndef QUERY_SERVER_HPP
+#define QUERY_SERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "search_engine.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Queue of at most capacity elements. Consumers wait for an element and producers for
+// free room, so producers faster than consumers are slowed down instead of growing the queue.
+template<typename T>
+class BlockingQueue {
+public:
+    explicit BlockingQueue(size_t capacity)
+        : capacity(std::max<size_t>(capacity, 1))
+    { }
+
+    // Returns false if the queue is closed
+    bool push(T element) {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueIsNotFull.wait(lock, [this] { return queue.size() < capacity || closed; });
+        if (closed) {
+            return false;
+        }
+        queue.push_back(std::move(element));
+        queueIsNotEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T& element) {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueIsNotEmpty.wait(lock, [this] { return !queue.empty() || closed; });
+        if (queue.empty()) {
+            return false;
+        }
+        element = std::move(queue.front());
+        queue.pop_front();
+        queueIsNotFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        closed = true;
+        queueIsNotEmpty.notify_all();
+        queueIsNotFull.notify_all();
+    }
+
+private:
+    std::deque<T> queue;
+    size_t capacity;
+    bool closed = false;
+    std::mutex queueMutex;
+    std::condition_variable queueIsNotEmpty;
+    std::condition_variable queueIsNotFull;
+};
+
+// Queries waiting for a worker; readers of clients stop reading beyond that
+const size_t queuedQueriesPerWorker = 64;
+
+// Queries of a client read but not yet answered to it; its reader stops reading beyond that,
+// so a client which doesn't read its answers holds only its own reader and writer
+const size_t pendingQueriesPerClient = 256;
+
+// A socket client which doesn't take an answer for that long is not written to anymore
+const int answerWriteTimeoutSeconds = 30;
+
+// Answers newline-delimited queries with BM25 top documents. The search engine is shared
+// read-only by a fixed pool of workers, so queries of all clients are answered concurrently.
+// Every answer starts with "query NUMBER WAIT_US SEARCH_US RESULTS", where NUMBER counts
+// queries of the client from zero, followed by RESULTS lines "DOCUMENT SCORE" and an empty line.
+class QueryServer {
+public:
+    QueryServer(const SearchEngine& searchEngine, size_t workersNumber, size_t topNumber)
+        : searchEngine(searchEngine)
+        , topNumber(topNumber)
+        , queries(queuedQueriesPerWorker * std::max<size_t>(workersNumber, 1))
+    {
+        for (size_t i = 0; i < std::max<size_t>(workersNumber, 1); ++i) {
+            workers.push_back(std::thread(&QueryServer::work, this));
+        }
+    }
+
+    ~QueryServer() {
+        queries.close();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        printStatistics();
+    }
+
+    // Serves one client until the end of its input and all of its queries are answered.
+    // Answers are written by a writer thread of the client, never by the workers.
+    void serveStream(int inputFd, int outputFd) {
+        std::shared_ptr<Client> client = std::make_shared<Client>(outputFd);
+        std::thread writer(&Client::writeAnswers, client);
+        readQueries(inputFd, client);
+        client->finish();
+        writer.join();
+    }
+
+    // Accepts clients on the unix domain socket, each one served by its own reader thread.
+    // SIGINT or SIGTERM stops accepting clients; connected clients are then answered
+    // the queries already read and disconnected.
+    void serveSocket(const string& socketPath) {
+        int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) {
+            throw std::logic_error("Can't create socket: " + string(strerror(errno)));
+        }
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            close(listenFd);
+            throw std::logic_error("Socket path is too long " + socketPath);
+        }
+        std::strcpy(address.sun_path, socketPath.c_str());
+        unlink(socketPath.c_str());
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+                || listen(listenFd, SOMAXCONN) < 0) {
+            close(listenFd);
+            throw std::logic_error("Can't listen on " + socketPath + ": " + strerror(errno));
+        }
+        int stopPipe[2];
+        if (pipe(stopPipe) < 0) {
+            close(listenFd);
+            throw std::logic_error("Can't create pipe: " + string(strerror(errno)));
+        }
+        handleStopSignals(stopPipe[1]);
+
+        std::cerr << "Listening on " << socketPath << " with " << workers.size() << " workers" << std::endl;
+
+        pollfd descriptors[2];
+        descriptors[0].fd = listenFd;
+        descriptors[0].events = POLLIN;
+        descriptors[1].fd = stopPipe[0];
+        descriptors[1].events = POLLIN;
+        while (true) {
+            if (poll(descriptors, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (descriptors[1].revents != 0) {
+                break;
+            }
+            if ((descriptors[0].revents & POLLIN) == 0) {
+                continue;
+            }
+            int clientFd = accept(listenFd, nullptr, nullptr);
+            if (clientFd < 0) {
+                continue;
+            }
+            timeval timeout;
+            timeout.tv_sec = answerWriteTimeoutSeconds;
+            timeout.tv_usec = 0;
+            setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clientFds.insert(clientFd);
+            std::thread([this, clientFd] {
+                serveStream(clientFd, clientFd);
+                std::lock_guard<std::mutex> lock(clientsMutex);
+                clientFds.erase(clientFd);
+                close(clientFd);
+                clientsFinished.notify_all();
+            }).detach();
+        }
+
+        handleStopSignals(-1);
+        close(listenFd);
+        unlink(socketPath.c_str());
+        close(stopPipe[0]);
+        close(stopPipe[1]);
+        std::unique_lock<std::mutex> lock(clientsMutex);
+        std::cerr << "Stopping, waiting for " << clientFds.size() << " clients" << std::endl;
+        for (int clientFd : clientFds) {
+            shutdown(clientFd, SHUT_RD);
+        }
+        clientsFinished.wait(lock, [this] { return clientFds.empty(); });
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    class Client {
+    public:
+        explicit Client(int outputFd)
+            : outputFd(outputFd)
+        { }
+
+        // Waits while too many queries of the client are not answered yet
+        void queryReceived() {
+            std::unique_lock<std::mutex> lock(clientMutex);
+            queryAnswered.wait(lock, [this] { return pendingQueries < pendingQueriesPerClient; });
+            ++pendingQueries;
+        }
+
+        // Queues the answer for the writer without waiting for the client
+        void answer(string text) {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            answers.push_back(std::move(text));
+            answersReady.notify_one();
+        }
+
+        // The query won't be answered
+        void dropQuery() {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            --pendingQueries;
+            queryAnswered.notify_all();
+            answersReady.notify_one();
+        }
+
+        // No more queries come; the writer stops once all pending ones are answered
+        void finish() {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            finished = true;
+            answersReady.notify_one();
+        }
+
+        // Writes answers in the order they come until finished and all are answered.
+        // After a failed write answers are dropped, so that queries are still counted as answered.
+        void writeAnswers() {
+            std::unique_lock<std::mutex> lock(clientMutex);
+            while (true) {
+                answersReady.wait(lock, [this] { return !answers.empty() || (finished && pendingQueries == 0); });
+                if (answers.empty()) {
+                    return;
+                }
+                string text = std::move(answers.front());
+                answers.pop_front();
+                lock.unlock();
+                if (!failed) {
+                    failed = !write(text);
+                }
+                lock.lock();
+                --pendingQueries;
+                queryAnswered.notify_all();
+            }
+        }
+
+    private:
+        bool write(const string& text) {
+            const char* data = text.data();
+            size_t left = text.size();
+            while (left > 0) {
+                ssize_t written = ::write(outputFd, data, left);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    return false;
+                }
+                data += written;
+                left -= written;
+            }
+            return true;
+        }
+
+        int outputFd;
+        bool failed = false;
+        bool finished = false;
+        size_t pendingQueries = 0;
+        std::deque<string> answers;
+        std::mutex clientMutex;
+        std::condition_variable answersReady;
+        std::condition_variable queryAnswered;
+    };
+
+    struct Query {
+        std::shared_ptr<Client> client;
+        size_t number;
+        string text;
+        Clock::time_point receivedTime;
+    };
+
+    void readQueries(int inputFd, const std::shared_ptr<Client>& client) {
+        size_t queryNumber = 0;
+        string pending;
+        char buffer[1 << 16];
+        while (true) {
+            ssize_t bytesRead = read(inputFd, buffer, sizeof(buffer));
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead <= 0) {
+                break;
+            }
+            pending.append(buffer, bytesRead);
+            size_t lineBegin = 0;
+            size_t lineEnd;
+            while ((lineEnd = pending.find('\n', lineBegin)) != string::npos) {
+                submit(client, queryNumber++, pending.substr(lineBegin, lineEnd - lineBegin));
+                lineBegin = lineEnd + 1;
+            }
+            pending.erase(0, lineBegin);
+        }
+        if (!pending.empty()) {
+            submit(client, queryNumber++, pending);
+        }
+    }
+
+    void submit(const std::shared_ptr<Client>& client, size_t number, const string& text) {
+        client->queryReceived();
+        Query query;
+        query.client = client;
+        query.number = number;
+        query.text = text;
+        query.receivedTime = Clock::now();
+        if (!queries.push(std::move(query))) {
+            client->dropQuery();
+        }
+    }
+
+    // Signals write to the pipe, which wakes up the accepting loop; -1 restores the default handlers
+    static void handleStopSignals(int pipeFd) {
+        stopPipeFd() = pipeFd;
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_handler = pipeFd < 0 ? SIG_DFL : &onStopSignal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+
+    static void onStopSignal(int) {
+        char signaled = 1;
+        ssize_t written = ::write(stopPipeFd(), &signaled, 1);
+        (void) written;
+    }
+
+    static int& stopPipeFd() {
+        static int fd = -1;
+        return fd;
+    }
+
+    // Every worker searches with its own context, so once its buffers have grown
+    // queries don't allocate and workers don't contend in the allocator
+    void work() {
+        Query query;
+        SearchEngine::QueryContext context;
+        SearchEngine::QueryProfile profile;
+        while (queries.pop(query)) {
+            Clock::time_point startTime = Clock::now();
+            const vector<SearchEngine::DocumentScore>& documentScores =
+                searchEngine.ProfiledPhraseSearch<BM25DocumentScoreEvaluator>(query.text, topNumber, profile, context);
+            Clock::time_point finishTime = Clock::now();
+
+            long long waitTime = microseconds(query.receivedTime, startTime);
+            long long searchTime = microseconds(startTime, finishTime);
+            std::ostringstream answer;
+            answer << "query " << query.number << " " << waitTime << " " << searchTime
+                   << " " << documentScores.size() << "\n";
+            for (const auto& documentScore : documentScores) {
+                answer << documentScore.documentIndex << " " << documentScore.score << "\n";
+            }
+            answer << "\n";
+            query.client->answer(answer.str());
+
+            long long latency = waitTime + searchTime;
+            answeredQueries += 1;
+            totalLatency += latency;
+            long long previousMax = maxLatency.load();
+            while (latency > previousMax && !maxLatency.compare_exchange_weak(previousMax, latency)) {
+            }
+            query = Query();
+        }
+    }
+
+    void printStatistics() const {
+        size_t answered = answeredQueries.load();
+        std::cerr << "Answered " << answered << " queries";
+        if (answered > 0) {
+            std::cerr << ", mean latency " << totalLatency.load() / answered << " us"
+                      << ", max latency " << maxLatency.load() << " us";
+        }
+        std::cerr << std::endl;
+    }
+
+    static long long microseconds(Clock::time_point begin, Clock::time_point end) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    }
+
+    const SearchEngine& searchEngine;
+    size_t topNumber;
+    BlockingQueue<Query> queries;
+    vector<std::thread> workers;
+    std::mutex clientsMutex;
+    std::condition_variable clientsFinished;
+    std::set<int> clientFds;
+    std::atomic<size_t> answeredQueries{0};
+    std::atomic<long long> totalLatency{0};
+    std::atomic<long long> maxLatency{0};
+};
+
+} // namespace irindexer
+
+#endif // QUERY_SERVER_HPP
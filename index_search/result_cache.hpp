@@ -0,0 +1,252 @@
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Approximate access counts of recently seen keys (count-min sketch with 4-bit counters).
+// Counters are halved every samplesLimit accesses, so the popularity of old keys fades.
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t expectedKeys) {
+        size_t width = 64;
+        while (width < expectedKeys) {
+            width <<= 1;
+        }
+        counters.assign(width, 0);
+        mask = width - 1;
+        samplesLimit = 10 * width;
+    }
+
+    void increment(uint64_t hash) {
+        bool incremented = false;
+        for (size_t row = 0; row < rowsNumber; ++row) {
+            uint8_t& counter = counters[position(hash, row)];
+            if (counter < maxCount) {
+                ++counter;
+                incremented = true;
+            }
+        }
+        if (incremented && ++samples >= samplesLimit) {
+            age();
+        }
+    }
+
+    uint8_t estimate(uint64_t hash) const {
+        uint8_t result = maxCount;
+        for (size_t row = 0; row < rowsNumber; ++row) {
+            result = std::min(result, counters[position(hash, row)]);
+        }
+        return result;
+    }
+
+private:
+    static const size_t rowsNumber = 4;
+    static const uint8_t maxCount = 15;
+
+    size_t position(uint64_t hash, size_t row) const {
+        static const uint64_t seeds[rowsNumber] = {
+            0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+        };
+        uint64_t mixed = (hash + seeds[row]) * seeds[(row + 1) % rowsNumber];
+        return (mixed >> 32) & mask;
+    }
+
+    void age() {
+        for (auto& counter : counters) {
+            counter >>= 1;
+        }
+        samples /= 2;
+    }
+
+    vector<uint8_t> counters;
+    size_t mask = 0;
+    size_t samples = 0;
+    size_t samplesLimit = 0;
+};
+
+// Concurrent cache split into independently locked shards, each one evicting
+// in LRU order within its share of the memory budget. A new entry is admitted
+// only if it was requested more often lately than the least recent entry (TinyLFU),
+// so one-off keys can't flush the popular ones. Ties are rejected, as in TinyLFU;
+// aging of the sketch lets saturated keys be replaced later.
+template<typename Key, typename Value, typename KeyHash = std::hash<Key>>
+class ShardedCache {
+public:
+    typedef std::function<size_t(const Key&, const Value&)> SizeFunction;
+
+    ShardedCache(size_t memoryBudget, size_t shardsNumber, SizeFunction entrySize)
+        : entrySize(entrySize)
+    {
+        shardsNumber = std::max<size_t>(shardsNumber, 1);
+        for (size_t i = 0; i < shardsNumber; ++i) {
+            shards.push_back(std::unique_ptr<Shard>(new Shard(memoryBudget / shardsNumber)));
+        }
+    }
+
+    // Every lookup counts as a request of the key for admission
+    bool find(const Key& key, Value& value) {
+        uint64_t hash = keyHash(key);
+        Shard& shard = getShard(hash);
+        std::lock_guard<std::mutex> lock(shard.shardMutex);
+        shard.sketch.increment(hash);
+        auto position = shard.entries.find(key);
+        if (position == shard.entries.end()) {
+            ++misses;
+            return false;
+        }
+        shard.recency.splice(shard.recency.begin(), shard.recency, position->second);
+        value = position->second->value;
+        ++hits;
+        return true;
+    }
+
+    void insert(const Key& key, const Value& value) {
+        uint64_t hash = keyHash(key);
+        Shard& shard = getShard(hash);
+        size_t size = entrySize(key, value);
+        std::lock_guard<std::mutex> lock(shard.shardMutex);
+        if (size > shard.memoryBudget) {
+            return;
+        }
+
+        // A cached key is refreshed in place without admission
+        auto position = shard.entries.find(key);
+        if (position != shard.entries.end()) {
+            typename Shard::EntryPosition entry = position->second;
+            shard.usedMemory = shard.usedMemory - entry->size + size;
+            entry->value = value;
+            entry->size = size;
+            shard.recency.splice(shard.recency.begin(), shard.recency, entry);
+            shard.evictOverBudget();
+            return;
+        }
+
+        // The least recent entry is the victim, followed by as many entries as it takes to free the memory
+        if (shard.usedMemory + size > shard.memoryBudget
+                && shard.sketch.estimate(shard.recency.back().hash) >= shard.sketch.estimate(hash)) {
+            return;
+        }
+        shard.recency.push_front(Entry(key, value, hash, size));
+        shard.entries[key] = shard.recency.begin();
+        shard.usedMemory += size;
+        shard.evictOverBudget();
+    }
+
+    size_t getHits() const {
+        return hits.load();
+    }
+
+    size_t getMisses() const {
+        return misses.load();
+    }
+
+private:
+    struct Entry {
+        Entry(const Key& key, const Value& value, uint64_t hash, size_t size)
+            : key(key)
+            , value(value)
+            , hash(hash)
+            , size(size)
+        { }
+
+        Key key;
+        Value value;
+        uint64_t hash;
+        size_t size;
+    };
+
+    struct Shard {
+        typedef typename std::list<Entry>::iterator EntryPosition;
+
+        explicit Shard(size_t memoryBudget)
+            : memoryBudget(memoryBudget)
+            , sketch(memoryBudget / 256)
+        { }
+
+        void remove(EntryPosition position) {
+            usedMemory -= position->size;
+            entries.erase(position->key);
+            recency.erase(position);
+        }
+
+        // The most recent entry fits into the budget alone, so it is never evicted here
+        void evictOverBudget() {
+            while (usedMemory > memoryBudget) {
+                remove(std::prev(recency.end()));
+            }
+        }
+
+        std::mutex shardMutex;
+        size_t memoryBudget;
+        size_t usedMemory = 0;
+        FrequencySketch sketch;
+        std::list<Entry> recency;
+        std::unordered_map<Key, EntryPosition, KeyHash> entries;
+    };
+
+    uint64_t keyHash(const Key& key) const {
+        // Spread the bits, std::hash of integers is identity
+        uint64_t hash = KeyHash()(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    Shard& getShard(uint64_t hash) {
+        return *shards[hash % shards.size()];
+    }
+
+    SizeFunction entrySize;
+    vector<std::unique_ptr<Shard>> shards;
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+};
+
+// Query normalized to the sorted word indices and the ranking function
+struct QueryKey {
+    QueryKey()
+    { }
+
+    QueryKey(vector<int> wordIndices, const string& scorer)
+        : wordIndices(std::move(wordIndices))
+        , scorer(scorer)
+    {
+        std::sort(this->wordIndices.begin(), this->wordIndices.end());
+    }
+
+    bool operator == (const QueryKey& key) const {
+        return wordIndices == key.wordIndices && scorer == key.scorer;
+    }
+
+    vector<int> wordIndices;
+    string scorer;
+};
+
+struct QueryKeyHash {
+    size_t operator () (const QueryKey& key) const {
+        size_t hash = std::hash<string>()(key.scorer);
+        for (int wordIndex : key.wordIndices) {
+            hash = hash * 1000003 ^ std::hash<int>()(wordIndex);
+        }
+        return hash;
+    }
+};
+
+} // namespace irindexer
+
+#endif // RESULT_CACHE_HPP
@@ -0,0 +1,307 @@
+#ifndef ROARING_HPP
+#define ROARING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace irindexer {
+
+using std::vector;
+
+// Roaring layout of a sorted set of documents, 8-byte aligned:
+//   RoaringHeader
+//   RoaringContainer[containersNumber]   one per used value of the high 16 bits of documents
+//   containers                           bitmap containers: roaringBitmapWords words of the low 16 bits,
+//                                        array containers: sorted low 16 bits, padded to 8 bytes
+// Containers with more than roaringArrayMaxSize documents are bitmaps.
+const size_t roaringArrayMaxSize = 4096;
+const size_t roaringBitmapWords = 1024;
+
+struct RoaringHeader {
+    uint32_t containersNumber;
+    uint32_t documentsNumber;
+    uint64_t size;
+};
+
+// Rank is the number of documents in the preceding containers, offset is relative to the header
+struct RoaringContainer {
+    uint16_t key;
+    uint16_t isBitmap;
+    uint32_t cardinality;
+    uint32_t rank;
+    uint32_t offset;
+};
+
+inline size_t alignRoaring(size_t offset) {
+    return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+// Bytes taken by the Roaring layout of the sorted documents
+inline size_t getRoaringSize(const vector<int>& documents) {
+    size_t size = sizeof(RoaringHeader);
+    for (size_t begin = 0; begin < documents.size();) {
+        size_t end = begin;
+        while (end < documents.size() && (documents[end] >> 16) == (documents[begin] >> 16)) {
+            ++end;
+        }
+        size_t cardinality = end - begin;
+        size += sizeof(RoaringContainer) + (cardinality > roaringArrayMaxSize
+            ? roaringBitmapWords * sizeof(uint64_t)
+            : alignRoaring(cardinality * sizeof(uint16_t)));
+        begin = end;
+    }
+    return size;
+}
+
+// Appends the Roaring layout of the sorted documents, output size must be 8-byte aligned
+inline void encodeRoaring(const vector<int>& documents, vector<uint8_t>& output) {
+    vector<RoaringContainer> containers;
+    for (size_t begin = 0; begin < documents.size();) {
+        size_t end = begin;
+        while (end < documents.size() && (documents[end] >> 16) == (documents[begin] >> 16)) {
+            ++end;
+        }
+        RoaringContainer container;
+        container.key = static_cast<uint16_t>(documents[begin] >> 16);
+        container.cardinality = end - begin;
+        container.isBitmap = container.cardinality > roaringArrayMaxSize;
+        container.rank = begin;
+        container.offset = 0;
+        containers.push_back(container);
+        begin = end;
+    }
+
+    size_t start = output.size();
+    RoaringHeader header;
+    header.containersNumber = containers.size();
+    header.documentsNumber = documents.size();
+    header.size = getRoaringSize(documents);
+    output.resize(start + header.size, 0);
+
+    size_t offset = sizeof(RoaringHeader) + containers.size() * sizeof(RoaringContainer);
+    for (auto& container : containers) {
+        container.offset = offset;
+        uint8_t* data = &output[start + offset];
+        if (container.isBitmap) {
+            uint64_t words[roaringBitmapWords] = {};
+            for (size_t i = container.rank; i < container.rank + container.cardinality; ++i) {
+                uint16_t low = static_cast<uint16_t>(documents[i]);
+                words[low >> 6] |= uint64_t(1) << (low & 63);
+            }
+            std::memcpy(data, words, sizeof(words));
+            offset += sizeof(words);
+        } else {
+            for (size_t i = 0; i < container.cardinality; ++i) {
+                uint16_t low = static_cast<uint16_t>(documents[container.rank + i]);
+                std::memcpy(data + i * sizeof(uint16_t), &low, sizeof(low));
+            }
+            offset += alignRoaring(container.cardinality * sizeof(uint16_t));
+        }
+    }
+    std::memcpy(&output[start], &header, sizeof(header));
+    if (!containers.empty()) {
+        std::memcpy(&output[start + sizeof(RoaringHeader)], &containers[0],
+                    containers.size() * sizeof(RoaringContainer));
+    }
+}
+
+// Read-only view of a Roaring layout
+class RoaringSet {
+public:
+    RoaringSet()
+    { }
+
+    explicit RoaringSet(const uint8_t* data)
+        : data(data)
+        , header(reinterpret_cast<const RoaringHeader*>(data))
+        , containers(reinterpret_cast<const RoaringContainer*>(data + sizeof(RoaringHeader)))
+    { }
+
+    size_t size() const {
+        return header->documentsNumber;
+    }
+
+    // Bytes of the layout
+    size_t byteSize() const {
+        return header->size;
+    }
+
+    // Writes up to count documents not less than first, returns their number
+    size_t extract(uint32_t first, size_t count, uint32_t* documents) const {
+        size_t extracted = 0;
+        size_t container = findContainer(first >> 16);
+        for (; container < header->containersNumber && extracted < count; ++container) {
+            const RoaringContainer& entry = containers[container];
+            uint32_t high = static_cast<uint32_t>(entry.key) << 16;
+            uint32_t low = entry.key == (first >> 16) ? (first & 0xffff) : 0;
+            if (entry.isBitmap) {
+                const uint64_t* words = getBitmap(entry);
+                size_t word = low >> 6;
+                uint64_t bits = words[word] & (~uint64_t(0) << (low & 63));
+                while (true) {
+                    while (bits != 0 && extracted < count) {
+                        documents[extracted++] = high | (word << 6 | __builtin_ctzll(bits));
+                        bits &= bits - 1;
+                    }
+                    if (extracted == count || ++word == roaringBitmapWords) {
+                        break;
+                    }
+                    bits = words[word];
+                }
+            } else {
+                const uint16_t* values = getArray(entry);
+                const uint16_t* value = std::lower_bound(values, values + entry.cardinality, low);
+                for (; value != values + entry.cardinality && extracted < count; ++value) {
+                    documents[extracted++] = high | *value;
+                }
+            }
+        }
+        return extracted;
+    }
+
+    // Keeps the sorted documents which are in the set
+    void filter(const vector<int>& documents, vector<int>& output) const {
+        output.clear();
+        size_t container = 0;
+        for (int document : documents) {
+            uint32_t key = static_cast<uint32_t>(document) >> 16;
+            while (container < header->containersNumber && containers[container].key < key) {
+                ++container;
+            }
+            if (container == header->containersNumber) {
+                break;
+            }
+            if (containers[container].key == key && containsLow(containers[container], document & 0xffff)) {
+                output.push_back(document);
+            }
+        }
+    }
+
+    // Intersection of setsNumber sets, fastest with the smallest set first: bitmap containers
+    // are combined by bitwise AND word by word, otherwise the smallest container is probed in the others
+    static void intersect(const RoaringSet* sets, size_t setsNumber, vector<int>& output) {
+        output.clear();
+        if (setsNumber == 0) {
+            return;
+        }
+        if (setsNumber > maxIntersectedSets) {
+            throw std::logic_error("Too many Roaring sets to intersect");
+        }
+        const RoaringSet& first = sets[0];
+        size_t containersPositions[maxIntersectedSets] = {};
+        const RoaringContainer* matched[maxIntersectedSets];
+        for (size_t container = 0; container < first.header->containersNumber; ++container) {
+            uint16_t key = first.containers[container].key;
+            size_t smallest = 0;
+            bool found = true;
+            for (size_t i = 0; i < setsNumber && found; ++i) {
+                const RoaringSet& set = sets[i];
+                size_t& position = containersPositions[i];
+                while (position < set.header->containersNumber && set.containers[position].key < key) {
+                    ++position;
+                }
+                found = position < set.header->containersNumber && set.containers[position].key == key;
+                if (found) {
+                    matched[i] = &set.containers[position];
+                    if (matched[i]->cardinality < matched[smallest]->cardinality) {
+                        smallest = i;
+                    }
+                }
+            }
+            if (!found) {
+                continue;
+            }
+
+            uint32_t high = static_cast<uint32_t>(key) << 16;
+            if (matched[smallest]->isBitmap) {
+                // Every container is a bitmap when the smallest one is
+                uint64_t words[roaringBitmapWords];
+                std::memcpy(words, sets[0].getBitmap(*matched[0]), sizeof(words));
+                for (size_t i = 1; i < setsNumber; ++i) {
+                    const uint64_t* other = sets[i].getBitmap(*matched[i]);
+                    for (size_t word = 0; word < roaringBitmapWords; ++word) {
+                        words[word] &= other[word];
+                    }
+                }
+                for (size_t word = 0; word < roaringBitmapWords; ++word) {
+                    for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+                        output.push_back(high | (word << 6 | __builtin_ctzll(bits)));
+                    }
+                }
+            } else {
+                const uint16_t* values = sets[smallest].getArray(*matched[smallest]);
+                for (size_t j = 0; j < matched[smallest]->cardinality; ++j) {
+                    bool everywhere = true;
+                    for (size_t i = 0; i < setsNumber && everywhere; ++i) {
+                        everywhere = i == smallest || sets[i].containsLow(*matched[i], values[j]);
+                    }
+                    if (everywhere) {
+                        output.push_back(high | values[j]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Whether the layout at data and all its containers lie within size bytes,
+    // with bitmaps holding exactly the containers of more than roaringArrayMaxSize documents
+    static bool isValid(const uint8_t* data, size_t size) {
+        if (size < sizeof(RoaringHeader)) {
+            return false;
+        }
+        const RoaringHeader* header = reinterpret_cast<const RoaringHeader*>(data);
+        if (header->size > size
+                || header->containersNumber > (header->size - sizeof(RoaringHeader)) / sizeof(RoaringContainer)) {
+            return false;
+        }
+        const RoaringContainer* containers = reinterpret_cast<const RoaringContainer*>(data + sizeof(RoaringHeader));
+        for (size_t i = 0; i < header->containersNumber; ++i) {
+            const RoaringContainer& container = containers[i];
+            size_t containerSize = container.isBitmap
+                ? roaringBitmapWords * sizeof(uint64_t)
+                : container.cardinality * sizeof(uint16_t);
+            if ((container.isBitmap != 0) != (container.cardinality > roaringArrayMaxSize)
+                    || container.offset > header->size || containerSize > header->size - container.offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Sets intersected at once by intersect, which is enough for any query
+    static const size_t maxIntersectedSets = 64;
+
+private:
+    size_t findContainer(uint32_t key) const {
+        const RoaringContainer* end = containers + header->containersNumber;
+        return std::lower_bound(containers, end, key,
+            [](const RoaringContainer& container, uint32_t key) { return container.key < key; }) - containers;
+    }
+
+    bool containsLow(const RoaringContainer& container, uint32_t low) const {
+        if (container.isBitmap) {
+            return (getBitmap(container)[low >> 6] >> (low & 63)) & 1;
+        }
+        const uint16_t* values = getArray(container);
+        return std::binary_search(values, values + container.cardinality, static_cast<uint16_t>(low));
+    }
+
+    const uint64_t* getBitmap(const RoaringContainer& container) const {
+        return reinterpret_cast<const uint64_t*>(data + container.offset);
+    }
+
+    const uint16_t* getArray(const RoaringContainer& container) const {
+        return reinterpret_cast<const uint16_t*>(data + container.offset);
+    }
+
+    const uint8_t* data = nullptr;
+    const RoaringHeader* header = nullptr;
+    const RoaringContainer* containers = nullptr;
+};
+
+} // namespace irindexer
+
+#endif // ROARING_HPP
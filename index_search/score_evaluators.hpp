@@ -0,0 +1,305 @@
+#ifndef SCORE_EVALUATORS_HPP
+#define SCORE_EVALUATORS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "dictionary.hpp"
+#include "index.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Scoring policies used by SearchEngine without virtual dispatch.
+// Evaluator references the index, takes statistics of the query words once
+// in prepare() and provides WordScorer: a small functor evaluating the word contribution
+// from its frequency and the document max word frequency and length.
+// Contributions of the words add up into the document score.
+
+// Scratch vectors of an evaluator. A worker thread may lend the same buffers to
+// the evaluators of all its queries, so their capacity is reused.
+struct EvaluatorBuffers {
+    vector<double> idfs;
+    vector<double> maxFrequencies;
+    vector<double> lengths;
+};
+
+template <typename Evaluator>
+class DocumentScoreEvaluator {
+public:
+    DocumentScoreEvaluator(const Dictionary& dict, const Index& index)
+        : dict(dict)
+        , index(index)
+    { }
+
+    void useBuffers(EvaluatorBuffers& buffers) {
+        externalBuffers = &buffers;
+    }
+
+    void prepare(const vector<WordRecord>& keywords) {
+        vector<double>& idfs = getBuffers().idfs;
+        idfs.clear();
+        for (const auto& keyword : keywords) {
+            idfs.push_back(index.getIdf(keyword.index));
+        }
+    }
+
+    void prepare(const vector<int>& wordIndices) {
+        vector<double>& idfs = getBuffers().idfs;
+        idfs.clear();
+        for (int wordIndex : wordIndices) {
+            idfs.push_back(index.getIdf(wordIndex));
+        }
+    }
+
+    double evaluateWordScore(size_t keyword, int documentIndex, int frequency) const {
+        const DocumentEntry& document = index.getDocument(documentIndex);
+        return self().getWordScorer(keyword)(frequency, document.maxFrequency, document.length);
+    }
+
+    double evaluateScore(int documentIndex, const vector<int>& frequencies) const {
+        double score = 0.0;
+        for (size_t i = 0; i < frequencies.size(); ++i) {
+            score += evaluateWordScore(i, documentIndex, frequencies[i]);
+        }
+        return score;
+    }
+
+    // scores[j] is the score of documents[j], frequencies[i][j] is the frequency of keyword i in it.
+    // Document statistics are gathered into dense arrays first, so the inner loop runs
+    // over documents with word constants held in registers.
+    // Frequencies of word i in the documents are stored one word after another,
+    // the frequency in document j is at i * documents.size() + j
+    void evaluateScores(const vector<int>& documents, const vector<int>& frequencies,
+                        vector<double>& scores) const {
+        size_t documentsNumber = documents.size();
+        vector<double>& maxFrequencies = getBuffers().maxFrequencies;
+        vector<double>& lengths = getBuffers().lengths;
+        maxFrequencies.resize(documentsNumber);
+        lengths.resize(documentsNumber);
+        for (size_t j = 0; j < documentsNumber; ++j) {
+            const DocumentEntry& document = index.getDocument(documents[j]);
+            maxFrequencies[j] = document.maxFrequency;
+            lengths[j] = document.length;
+        }
+
+        scores.assign(documentsNumber, 0.0);
+        double* documentScores = scores.data();
+        const double* documentMaxFrequencies = maxFrequencies.data();
+        const double* documentLengths = lengths.data();
+        for (size_t i = 0; documentsNumber > 0 && i < frequencies.size() / documentsNumber; ++i) {
+            const typename Evaluator::WordScorer scorer = self().getWordScorer(i);
+            const int* wordFrequencies = frequencies.data() + i * documentsNumber;
+            for (size_t j = 0; j < documentsNumber; ++j) {
+                documentScores[j] += scorer(wordFrequencies[j], documentMaxFrequencies[j], documentLengths[j]);
+            }
+        }
+    }
+
+protected:
+    const Evaluator& self() const {
+        return static_cast<const Evaluator&>(*this);
+    }
+
+    EvaluatorBuffers& getBuffers() const {
+        return externalBuffers != nullptr ? *externalBuffers : ownBuffers;
+    }
+
+    double getIdf(size_t keyword) const {
+        return getBuffers().idfs[keyword];
+    }
+
+    const Dictionary& dict;
+    const Index& index;
+    mutable EvaluatorBuffers ownBuffers;
+    EvaluatorBuffers* externalBuffers = nullptr;
+};
+
+class BooleanDocumentScoreEvaluator : public DocumentScoreEvaluator<BooleanDocumentScoreEvaluator> {
+public:
+    struct WordScorer {
+        double operator()(double frequency, double maxFrequency, double documentLength) const {
+            return 1.0;
+        }
+    };
+
+    BooleanDocumentScoreEvaluator(const Dictionary& dict, const Index& index)
+        : DocumentScoreEvaluator(dict, index)
+    { }
+
+    WordScorer getWordScorer(size_t keyword) const {
+        return WordScorer();
+    }
+
+    double evaluateUpperBound(size_t keyword, const PostingStatistics& statistics) const {
+        return 1.0;
+    }
+
+    // Every matching document scores 1, regardless of the number of words
+    double evaluateScore(int documentIndex, const vector<int>& frequencies) const {
+        return 1.0;
+    }
+
+    void evaluateScores(const vector<int>& documents, const vector<int>& frequencies,
+                        vector<double>& scores) const {
+        scores.assign(documents.size(), 1.0);
+    }
+
+    static string getName() {
+        return "Boolean ScoreEvaluator";
+    }
+};
+
+class TFIDFDocumentScoreEvaluator : public DocumentScoreEvaluator<TFIDFDocumentScoreEvaluator> {
+public:
+    struct WordScorer {
+        double operator()(double frequency, double maxFrequency, double documentLength) const {
+            double tf = 0.5 + 0.5 * (frequency / maxFrequency);
+            return idf * tf;
+        }
+
+        double idf;
+    };
+
+    TFIDFDocumentScoreEvaluator(const Dictionary& dict, const Index& index)
+        : DocumentScoreEvaluator(dict, index)
+    { }
+
+    WordScorer getWordScorer(size_t keyword) const {
+        WordScorer scorer;
+        scorer.idf = getIdf(keyword);
+        return scorer;
+    }
+
+    // Score is monotone in normalized frequency, so it is bounded by one of the range ends
+    double evaluateUpperBound(size_t keyword, const PostingStatistics& statistics) const {
+        WordScorer scorer = getWordScorer(keyword);
+        return std::max(scorer(statistics.minNormalizedFrequency, 1.0, 0.0),
+                        scorer(statistics.maxNormalizedFrequency, 1.0, 0.0));
+    }
+
+    static string getName() {
+        return "TFIDF ScoreEvaluator";
+    }
+};
+
+class BM25DocumentScoreEvaluator : public DocumentScoreEvaluator<BM25DocumentScoreEvaluator> {
+public:
+    struct WordScorer {
+        double operator()(double frequency, double maxFrequency, double documentLength) const {
+            double lengthNormalization = shortDocumentNormalization + lengthWeight * documentLength;
+            return idf * (frequency * (k + 1)) / (frequency + lengthNormalization);
+        }
+
+        double idf;
+        double shortDocumentNormalization;
+        double lengthWeight;
+    };
+
+    BM25DocumentScoreEvaluator(const Dictionary& dict, const Index& index)
+        : DocumentScoreEvaluator(dict, index)
+        , shortDocumentNormalization(k * (1 - b))
+        , lengthWeight(index.getAverageDocumentLength() > 0 ? k * b / index.getAverageDocumentLength() : 0.0)
+    { }
+
+    WordScorer getWordScorer(size_t keyword) const {
+        WordScorer scorer;
+        scorer.idf = getIdf(keyword);
+        scorer.shortDocumentNormalization = shortDocumentNormalization;
+        scorer.lengthWeight = lengthWeight;
+        return scorer;
+    }
+
+    // Score grows with frequency and falls with document length; words with
+    // negative idf never add anything positive
+    double evaluateUpperBound(size_t keyword, const PostingStatistics& statistics) const {
+        if (getIdf(keyword) <= 0.0) {
+            return 0.0;
+        }
+        return getWordScorer(keyword)(statistics.maxFrequency, 1.0, statistics.minDocumentLength);
+    }
+
+    static string getName() {
+        return "BM25 ScoreEvaluator";
+    }
+
+private:
+    static constexpr double b = 0.75;
+    static constexpr double k = 1.5;
+
+    double shortDocumentNormalization;
+    double lengthWeight;
+};
+
+// BM25F: frequencies of a word in the fields of a document are normalized by the field
+// lengths, weighted and added up into one frequency, which saturates as in BM25.
+// Idf comes from the body, which holds the whole text of the document. Over an index
+// with the body only it scores as BM25DocumentScoreEvaluator.
+class BM25FDocumentScoreEvaluator {
+public:
+    BM25FDocumentScoreEvaluator(const Dictionary& dict, const Index& index)
+        : index(index)
+    {
+        for (int field = 0; field < documentFieldsNumber; ++field) {
+            double averageLength = index.getAverageFieldLength(static_cast<DocumentField>(field));
+            lengthWeights[field] = averageLength > 0 ? getFieldLengthWeight(field) / averageLength : 0.0;
+        }
+    }
+
+    void prepare(const vector<WordRecord>& keywords) {
+        idfs.clear();
+        for (const auto& keyword : keywords) {
+            idfs.push_back(index.getIdf(keyword.index));
+        }
+    }
+
+    // Frequency of keyword i in field f of the document is fieldFrequencies[i * documentFieldsNumber + f]
+    double evaluateScore(int documentIndex, const vector<int>& fieldFrequencies) const {
+        double fieldNormalizations[documentFieldsNumber];
+        for (int field = 0; field < documentFieldsNumber; ++field) {
+            double length = index.getFieldLength(static_cast<DocumentField>(field), documentIndex);
+            fieldNormalizations[field] = getFieldWeight(field)
+                / (1 - getFieldLengthWeight(field) + lengthWeights[field] * length);
+        }
+        double score = 0.0;
+        for (size_t i = 0; i < idfs.size(); ++i) {
+            double frequency = 0.0;
+            for (int field = 0; field < documentFieldsNumber; ++field) {
+                frequency += fieldFrequencies[i * documentFieldsNumber + field] * fieldNormalizations[field];
+            }
+            score += idfs[i] * (frequency * (k + 1)) / (frequency + k);
+        }
+        return score;
+    }
+
+    static string getName() {
+        return "BM25F ScoreEvaluator";
+    }
+
+private:
+    // Importance of a word occurrence in the field relative to the body
+    static double getFieldWeight(int field) {
+        static const double weights[documentFieldsNumber] = {1.0, 3.0, 2.0};
+        return weights[field];
+    }
+
+    // BM25 b of the field: short titles and anchors are normalized less than the body
+    static double getFieldLengthWeight(int field) {
+        static const double weights[documentFieldsNumber] = {0.75, 0.5, 0.5};
+        return weights[field];
+    }
+
+    static constexpr double k = 1.5;
+
+    const Index& index;
+    double lengthWeights[documentFieldsNumber];
+    vector<double> idfs;
+};
+
+} // namespace irindexer
+
+#endif // SCORE_EVALUATORS_HPP
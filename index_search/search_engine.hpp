@@ -3,13 +3,31 @@
 
 #include <fstream>
 #include <algorithm>
+#include <chrono>
 #include <stdexcept>
 #include <unordered_map>
-#include <unordered_set>
 #include <iomanip>
 #include <sstream>
 #include <vector>
 #include <cmath>
+#include <queue>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#include "dictionary.hpp"
+#include "impact_index.hpp"
+#include "index.hpp"
+#include "intersection.hpp"
+#include "phrase_matcher.hpp"
+#include "query_planner.hpp"
+#include "result_cache.hpp"
+#include "score_evaluators.hpp"
+#include "segmented_index.hpp"
+#include "sharded_index.hpp"
+#include "static_rank.hpp"
+#include "term_expansion.hpp"
+#include "textnorm/tokenizer.hpp"
 
 namespace irindexer {
 
@@ -17,353 +35,1099 @@ using std::string;
 using std::vector;
 using std::cin;
 
-struct WordRecord {
-    WordRecord()
-    { }
+// Query words keep the operators of term expansion
+const char* const queryOperators = "*?~";
 
-    WordRecord(const string& word, int index, int frequency)
-        : word(word)
+class SearchEngine {
+public:
+    SearchEngine() {
+        setNormalization(textnorm::NormalizerOptions());
+    }
+
+    SearchEngine(const Dictionary& dict, const Index& index)
+        : dict(dict)
         , index(index)
-        , frequency(frequency)
-    { }
+    {
+        setNormalization(textnorm::NormalizerOptions());
+    }
 
-    string word;
-    int index;
-    int frequency;
-};
+    SearchEngine(const string& dictPath, const string& indexPath) {
+        setNormalization(textnorm::NormalizerOptions());
+        dict.readFromFile(dictPath);
+        index.readFromFile(indexPath);
+    }
 
-class Dictionary {
-public:
-    void readFromFile(const string& filename)
-    {
-        std::ifstream input(filename);
+    // Queries and added documents are normalized as the indexed documents were,
+    // stemmed and without stop words if the index was built so
+    void setNormalization(const textnorm::NormalizerOptions& options) {
+        documentTokenizer = textnorm::Tokenizer(options);
+        textnorm::NormalizerOptions queryOptions(options);
+        queryOptions.wordCharacters = queryOperators;
+        queryTokenizer = textnorm::Tokenizer(queryOptions);
+    }
+
+    void readImpactIndex(const string& impactIndexPath) {
+        impactIndex.readFromFile(impactIndexPath, index);
+    }
+
+    // Scores "DOCUMENT SCORE" of StaticRank, combined with query scores by StaticRankPhraseSearch
+    void readStaticRank(const string& staticRankPath) {
+        staticRank.readFromFile(staticRankPath);
+    }
 
-        if (!input.is_open()) {
-            throw std::logic_error("Can't open file " + filename);
+    // Queries are then evaluated over all shards in parallel
+    void splitIntoShards(size_t shardsNumber) {
+        shards.clear();
+        if (shardsNumber > 1) {
+            shards = partitionIndex(index, shardsNumber);
         }
+    }
 
-        std::cerr << "Reading dictionary from " << filename << std::endl;
+    // Lookup structures for prefix, wildcard and fuzzy words are built once here
+    void enableTermExpansion(size_t maxExpansions) {
+        termExpander = std::make_shared<TermExpander>(dict, maxExpansions);
+    }
 
-        int wordsNumber = 0;
-        while (!input.eof())
-        {
-            string word;
-            int index, frequency;
-            input >> word >> index >> frequency;
-            addWord(word, index, frequency);
-            ++wordsNumber;
+    // Word indices of the text words in their order, -1 for words missing from the dictionary
+    vector<int> lookupWords(const string& text) const {
+        vector<int> wordIndices;
+        for (const auto& token : documentTokenizer.tokenize(text)) {
+            wordIndices.push_back(dict.findWordIndex(token));
         }
+        return wordIndices;
+    }
 
-        std::cerr << "Finished reading " << std::to_string(wordsNumber) << " words" << std::endl;
+    // Phrase has words with expansion operators or words missing from the dictionary
+    bool needsTermExpansion(const string& phrase) const {
+        for (const auto& token : queryTokenizer.tokenize(phrase)) {
+            if (parseTermPattern(token).kind != TermPattern::Exact || !dict.containsWord(token)) {
+                return true;
+            }
+        }
+        return false;
     }
 
-    size_t size() const {
-        return intToRecord.size();
+    const Index& getIndex() const {
+        return index;
     }
 
-    void addWord(const string& word, int index, int frequency)
-    {
-        WordRecord record(word, index, frequency);
-        intToRecord[index] = record;
-        wordToRecord[word] = record;
+    // Top-k searches then run over the live segments instead of the loaded index.
+    // Full ScoredPhraseSearch and impact search keep using the loaded index.
+    void attachSegments(const std::shared_ptr<SegmentedIndex>& segments) {
+        segmentedIndex = segments;
     }
 
-    bool containsWord(const string& word) const {
-        return (wordToRecord.find(word) != wordToRecord.end());
+    // Searches then report to std::cerr the ranking function used and the documents found
+    void setVerbose(bool isVerbose) {
+        verbose = isVerbose;
     }
 
-    WordRecord getWordRecord(int index) const {
-        return intToRecord.at(index);
+    bool hasImpactIndex() const {
+        return !impactIndex.empty();
     }
 
-    WordRecord getWordRecord(const string& word) const {
-        return wordToRecord.at(word);
+    bool hasStaticRank() const {
+        return !staticRank.empty();
     }
 
-private:
-    std::unordered_map<int, WordRecord> intToRecord;
-    std::unordered_map<string, WordRecord> wordToRecord;
-};
+    // Top documents of repeated queries are served without intersection and scoring
+    void enableResultCache(size_t memoryBudget, size_t shardsNumber) {
+        resultCache = std::make_shared<ResultCache>(memoryBudget, shardsNumber,
+            [](const QueryKey& key, const CachedResult& result) {
+                return sizeof(CachedResult) + cacheEntryOverhead + key.scorer.size()
+                    + key.wordIndices.size() * sizeof(int)
+                    + result.documentScores.size() * sizeof(DocumentScore);
+            });
+    }
 
-class Index {
-public:
-    Index()
-    { }
+    // Decoded posting lists of hot words are reused by ProfiledPhraseSearch
+    void enablePostingCache(size_t memoryBudget, size_t shardsNumber) {
+        postingCache = std::make_shared<PostingCache>(memoryBudget, shardsNumber,
+            [](int, const std::shared_ptr<const PostingList>& postingList) {
+                return sizeof(PostingList) + cacheEntryOverhead + postingList->size() * 2 * sizeof(int);
+            });
+    }
 
-    void readFromFile(const string& filename) {
-        std::ifstream input(filename);
+    struct DocumentScore {
+        DocumentScore(double score, int documentIndex)
+            : score(score)
+            , documentIndex(documentIndex)
+        { }
+
+        DocumentScore()
+        { }
 
-        if (!input.is_open()) {
-            throw std::logic_error("Can't open file " + filename);
+        bool operator < (const DocumentScore &ds) const {
+            return score > ds.score;
         }
 
-        std::cerr << "Reading index from " << filename << std::endl;
+        double score = 0.0;
+        int documentIndex = 0;
+    };
+
+    // Time spent by a query in every phase of ProfiledPhraseSearch
+    struct QueryProfile {
+        enum Phase { Tokenize, Lookup, Intersection, Scoring, Top, phasesNumber };
 
-        while (!input.eof()) {
-            int wordIndex;
-            input >> wordIndex;
-            string line;
-            std::getline(input, line);
-            std::stringstream stream(line);
-            int documentIndex;
-            char separator;
-            int frequency;
-            while (stream >> documentIndex >> separator >> frequency) {
-                addWordDocument(wordIndex, documentIndex, frequency);
-                documents.insert(documentIndex);
-                updateMaxWordDocumentFrequency(documentIndex, frequency);
-                averageDocumentLength += frequency;
-            }
-            averageDocumentLength /= documentsNumber();
+        static const char* getPhaseName(size_t phase) {
+            static const char* names[phasesNumber] = {"tokenize", "lookup", "intersection", "scoring", "top"};
+            return names[phase];
+        }
+
+        double microseconds[phasesNumber] = {};
+        size_t documentsNumber = 0;
+    };
+
+    // Scratch buffers for the queries of one worker thread. They are cleared, not freed,
+    // between queries, so once grown to the sizes of the workload a query searched with
+    // the context does no heap allocations. Concurrent queries need separate contexts.
+    struct QueryContext {
+        string token;
+        string tokensText;
+        vector<size_t> tokenEnds;
+        vector<int> wordIndices;
+        string missingWord;
+        QueryKey queryKey;
+        vector<PostingList> decodedLists;
+        vector<std::shared_ptr<const PostingList>> cachedLists;
+        vector<const PostingList*> postingLists;
+        vector<RoaringSet> roaringSets;
+        QueryPlan plan;
+        vector<int> documents;
+        vector<int> intersectionBuffer;
+        vector<int> frequencies;
+        vector<double> scores;
+        EvaluatorBuffers evaluatorBuffers;
+        ImpactIndex::SearchContext impactContext;
+        vector<DocumentScore> documentScores;
+    };
+
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> ScoredPhraseSearch(const string& phrase) const {
+        if (verbose) {
+            std::cerr << "Using " << ScoreEvaluator::getName() << std::endl;
+        }
+
+        QueryProfile profile;
+        vector<DocumentScore> documentScores =
+            ProfiledPhraseSearch<ScoreEvaluator>(phrase, std::numeric_limits<size_t>::max(), profile);
+
+        if (verbose) {
+            std::cerr << "Found " << profile.documentsNumber << " documents" << std::endl;
         }
 
-        std::cerr << "Finished reading " << documents.size() << " documents" << std::endl;
+        return documentScores;
     }
 
-    size_t documentsNumber() const {
-        return documents.size();
+    // Top of ScoredPhraseSearch over the loaded index, with the time of every phase
+    // written to the profile: phrase tokenization, dictionary lookup, decoding and
+    // intersection of posting lists, scoring of the documents found and top selection
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> ProfiledPhraseSearch(const string& phrase, size_t topNumber, QueryProfile& profile) const {
+        QueryContext context;
+        return ProfiledPhraseSearch<ScoreEvaluator>(phrase, topNumber, profile, context);
     }
 
-    size_t getWordDocumentsNumber(int wordIndex) const {
-        return wordDocumentFrequency.at(wordIndex).size();
+    // Same search with all temporary buffers taken from the context. The result
+    // lives in the context and is valid until its next query.
+    template<typename ScoreEvaluator>
+    const vector<DocumentScore>& ProfiledPhraseSearch(const string& phrase, size_t topNumber, QueryProfile& profile,
+                                                      QueryContext& context) const {
+        profile = QueryProfile();
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point phaseStart = Clock::now();
+        auto finishPhase = [&](QueryProfile::Phase phase) {
+            Clock::time_point phaseFinish = Clock::now();
+            profile.microseconds[phase] =
+                std::chrono::duration<double, std::micro>(phaseFinish - phaseStart).count();
+            phaseStart = phaseFinish;
+        };
+
+        context.tokensText.clear();
+        context.tokenEnds.clear();
+        queryTokenizer.forEachToken(phrase, context.token, [&context](const textnorm::TokenView& token) {
+            context.tokensText.append(token.data, token.size);
+            context.tokenEnds.push_back(context.tokensText.size());
+        });
+        finishPhase(QueryProfile::Tokenize);
+
+        vector<int>& wordIndices = context.wordIndices;
+        wordIndices.clear();
+        context.missingWord.clear();
+        for (size_t i = 0; i < context.tokenEnds.size(); ++i) {
+            size_t tokenBegin = (i == 0) ? 0 : context.tokenEnds[i - 1];
+            int wordIndex = dict.findWordIndex(context.tokensText.data() + tokenBegin,
+                                               context.tokenEnds[i] - tokenBegin);
+            if (wordIndex < 0) {
+                context.missingWord.assign(context.tokensText, tokenBegin, context.tokenEnds[i] - tokenBegin);
+                wordIndices.clear();
+                break;
+            }
+            wordIndices.push_back(wordIndex);
+        }
+        if (resultCache) {
+            static const string scorer = ScoreEvaluator::getName();
+            context.queryKey.wordIndices.assign(wordIndices.begin(), wordIndices.end());
+            std::sort(context.queryKey.wordIndices.begin(), context.queryKey.wordIndices.end());
+            context.queryKey.scorer = scorer;
+            if (findCachedResult(context.queryKey, topNumber, context.documentScores)) {
+                profile.documentsNumber = context.documentScores.size();
+                finishPhase(QueryProfile::Lookup);
+                return context.documentScores;
+            }
+        }
+        finishPhase(QueryProfile::Lookup);
+
+        ScoreEvaluator evaluator(dict, index);
+        evaluator.useBuffers(context.evaluatorBuffers);
+        evaluator.prepare(wordIndices);
+        const size_t wordsNumber = wordIndices.size();
+        // Lists are only ever added to the pools, so their vectors are not freed
+        if (context.decodedLists.size() < wordsNumber) {
+            context.decodedLists.resize(wordsNumber);
+            context.cachedLists.resize(wordsNumber);
+        }
+        // Dense lists are intersected as sets and never decoded, their posting lists stay null
+        context.postingLists.assign(wordsNumber, nullptr);
+        vector<int>& documents = context.documents;
+        planConjunction(index, wordIndices, context.plan);
+        executePlan(context);
+        profile.documentsNumber = documents.size();
+        finishPhase(QueryProfile::Intersection);
+
+        vector<DocumentScore>& documentScores = context.documentScores;
+        documentScores.clear();
+        if (documents.empty()) {
+            // Lists of the steps after the abort were not decoded, and there is nothing to score
+            releaseCachedLists(context);
+            cacheResult(context.queryKey, topNumber, documentScores);
+            finishPhase(QueryProfile::Scoring);
+            finishPhase(QueryProfile::Top);
+            return documentScores;
+        }
+
+        vector<int>& frequencies = context.frequencies;
+        frequencies.resize(wordsNumber * documents.size());
+        for (size_t i = 0; i < wordsNumber; ++i) {
+            if (context.postingLists[i] == nullptr) {
+                int* wordFrequencies = frequencies.data() + i * documents.size();
+                PostingCursor cursor = index.getPostingCursor(wordIndices[i]);
+                for (size_t j = 0; j < documents.size(); ++j) {
+                    cursor.nextGEQ(documents[j]);
+                    wordFrequencies[j] = cursor.frequency();
+                }
+                continue;
+            }
+            const PostingList& postingList = *context.postingLists[i];
+            const int* begin = postingList.documents.data();
+            const int* end = begin + postingList.documents.size();
+            const int* position = begin;
+            int* wordFrequencies = frequencies.data() + i * documents.size();
+            for (size_t j = 0; j < documents.size(); ++j) {
+                position = gallopingLowerBound(position, end, documents[j]);
+                wordFrequencies[j] = postingList.frequencies[position - begin];
+            }
+        }
+        releaseCachedLists(context);
+
+        vector<double>& scores = context.scores;
+        evaluator.evaluateScores(documents, frequencies, scores);
+        finishPhase(QueryProfile::Scoring);
+
+        for (size_t j = 0; j < documents.size(); ++j) {
+            documentScores.push_back(DocumentScore(scores[j], documents[j]));
+        }
+        if (topNumber < documentScores.size()) {
+            std::partial_sort(documentScores.begin(), documentScores.begin() + topNumber, documentScores.end());
+            documentScores.resize(topNumber);
+        } else {
+            std::sort(documentScores.begin(), documentScores.end());
+        }
+        cacheResult(context.queryKey, topNumber, documentScores);
+        finishPhase(QueryProfile::Top);
+        return documentScores;
     }
 
-    vector<int> getWordDocuments(int wordIndex) const {
-        vector<int> documents;
-        for (const auto& doc : wordDocumentFrequency.at(wordIndex)) {
-            documents.push_back(doc.first);
+    // Top of ProfiledPhraseSearch with its query plan and the time of every phase written to output
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> ExplainPhraseSearch(const string& phrase, size_t topNumber, std::ostream& output) const {
+        QueryProfile profile;
+        QueryContext context;
+        vector<DocumentScore> documentScores =
+            ProfiledPhraseSearch<ScoreEvaluator>(phrase, topNumber, profile, context);
+
+        output << "Using " << ScoreEvaluator::getName() << std::endl;
+        if (!context.missingWord.empty()) {
+            output << "No plan: word " << context.missingWord << " is not in the dictionary" << std::endl;
+        } else {
+            printQueryPlan(context.plan, dict, output);
+        }
+        output << std::fixed << std::setprecision(1);
+        for (size_t phase = 0; phase < QueryProfile::phasesNumber; ++phase) {
+            output << (phase == 0 ? "" : ", ") << QueryProfile::getPhaseName(phase) << ' '
+                   << profile.microseconds[phase] << " us";
         }
-        return documents;
+        output.unsetf(std::ios::fixed);
+        output << std::setprecision(6) << std::endl;
+        output << "Found " << profile.documentsNumber << " documents" << std::endl;
+        return documentScores;
     }
 
-    void addWordDocument(int wordIndex, int documentIndex, int frequency) {
-        wordDocumentFrequency[wordIndex][documentIndex] = frequency;
+    // Same documents as the top of ScoredPhraseSearch, found with Block-Max WAND pruning
+    // over the conjunctive query: once topNumber documents are scored, candidates whose
+    // sum of block-max upper bounds can't beat the worst of them are skipped block by block
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> TopScoredPhraseSearch(const string& phrase, size_t topNumber) const {
+        if (verbose) {
+            std::cerr << "Using " << ScoreEvaluator::getName() << std::endl;
+        }
+
+        vector<WordRecord> tokensRecords = transformPhrase(phrase);
+        vector<DocumentScore> documentScores;
+        if (tokensRecords.empty() || topNumber == 0) {
+            return documentScores;
+        }
+        size_t scoredDocuments = 0;
+        documentScores = searchShards([&](const Index& shard, const DeletionBitmap* deleted, size_t& shardScoredDocuments) {
+            return topScoredSearch<ScoreEvaluator>(shard, deleted, tokensRecords, topNumber, AnyDocumentFilter(),
+                                                   NoDocumentPrior(), shardScoredDocuments);
+        }, topNumber, scoredDocuments);
+
+        if (verbose) {
+            std::cerr << "Scored " << scoredDocuments << " documents" << std::endl;
+        }
+
+        return documentScores;
     }
 
-    int getWordDocumentFrequency(int wordIndex, int documentIndex) const {
-        return wordDocumentFrequency.at(wordIndex).at(documentIndex);
+    // Top documents containing every phrase word by their score plus the static rank scaled
+    // by staticRankWeight. The pruned search of TopScoredPhraseSearch bounds candidates by
+    // the greatest static rank of the documents left, so over an index ordered by static rank
+    // it stops as soon as the documents of high rank are exhausted. Needs the static rank.
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> StaticRankPhraseSearch(const string& phrase, size_t topNumber,
+                                                 double staticRankWeight = defaultStaticRankWeight) const {
+        if (verbose) {
+            std::cerr << "Using " << ScoreEvaluator::getName() << " with static rank" << std::endl;
+        }
+
+        vector<WordRecord> tokensRecords = transformPhrase(phrase);
+        vector<DocumentScore> documentScores;
+        if (tokensRecords.empty() || topNumber == 0 || staticRank.empty()) {
+            return documentScores;
+        }
+
+        size_t scoredDocuments = 0;
+        StaticRankPrior prior(staticRank, staticRankWeight);
+        documentScores = searchShards([&](const Index& shard, const DeletionBitmap* deleted, size_t& shardScoredDocuments) {
+            return topScoredSearch<ScoreEvaluator>(shard, deleted, tokensRecords, topNumber, AnyDocumentFilter(),
+                                                   prior, shardScoredDocuments);
+        }, topNumber, scoredDocuments);
+
+        if (verbose) {
+            std::cerr << "Scored " << scoredDocuments << " documents" << std::endl;
+        }
+
+        return documentScores;
     }
 
-    int getMaxWordDocumentFrequency(int documentIndex) const {
-        return maxWordDocumentFrequency.at(documentIndex);
+    // Top documents where the phrase words occur in order with at most slop other words
+    // between them, exactly one after another by default. Candidates come from the same
+    // pruned conjunctive search as in TopScoredPhraseSearch, positions are checked only
+    // for documents containing all words. Needs an index with positions.
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> ExactPhraseSearch(const string& phrase, size_t topNumber, size_t slop = 0) const {
+        if (verbose) {
+            std::cerr << "Using " << ScoreEvaluator::getName() << " for the phrase" << std::endl;
+        }
+
+        vector<WordRecord> tokensRecords = transformPhrase(phrase);
+        vector<DocumentScore> documentScores;
+        if (tokensRecords.empty() || topNumber == 0 || !hasPositions()) {
+            return documentScores;
+        }
+
+        size_t scoredDocuments = 0;
+        documentScores = searchShards([&](const Index& shard, const DeletionBitmap* deleted, size_t& shardScoredDocuments) {
+            return topScoredSearch<ScoreEvaluator>(shard, deleted, tokensRecords, topNumber, PhraseMatcher(slop),
+                                                   NoDocumentPrior(), shardScoredDocuments);
+        }, topNumber, scoredDocuments);
+
+        if (verbose) {
+            std::cerr << "Scored " << scoredDocuments << " documents" << std::endl;
+        }
+
+        return documentScores;
     }
 
-    double getAverageDocumentLength() const {
-        return averageDocumentLength;
+    bool hasPositions() const {
+        return segmentedIndex ? segmentedIndex->hasPositions() : index.hasPositions();
     }
 
-private:
+    // Index has posting lists of titles or anchors besides the body
+    bool hasFields() const {
+        return index.fieldsNumber() > 1;
+    }
+
+    // Documents having every phrase word in any of their fields, ranked by BM25F. Posting
+    // lists of every word in all fields are merged into one cursor, so all fields are
+    // matched and scored in a single pass over the documents.
+    vector<DocumentScore> FieldedPhraseSearch(const string& phrase, size_t topNumber) const {
+        if (verbose) {
+            std::cerr << "Using " << BM25FDocumentScoreEvaluator::getName() << " over " << index.fieldsNumber()
+                      << " fields" << std::endl;
+        }
+
+        vector<WordRecord> tokensRecords = transformPhrase(phrase);
+        vector<DocumentScore> documentScores;
+        if (tokensRecords.empty() || topNumber == 0) {
+            return documentScores;
+        }
 
-    void updateMaxWordDocumentFrequency(int documentIndex, int frequency) {
-        maxWordDocumentFrequency[documentIndex] = std::max(maxWordDocumentFrequency[documentIndex], frequency);
+        size_t scoredDocuments = 0;
+        documentScores = searchShards([&](const Index& shard, const DeletionBitmap* deleted, size_t& shardScoredDocuments) {
+            return fieldedSearch(shard, deleted, tokensRecords, topNumber, shardScoredDocuments);
+        }, topNumber, scoredDocuments);
+
+        if (verbose) {
+            std::cerr << "Scored " << scoredDocuments << " documents" << std::endl;
+        }
+
+        return documentScores;
     }
 
-    double averageDocumentLength = 0.0;
-    std::unordered_set<int> documents;
-    std::unordered_map<int, std::unordered_map<int, int>> wordDocumentFrequency;
-    std::unordered_map<int, int> maxWordDocumentFrequency;
-};
+    // Documents containing any of the phrase words, ranked by the sum of contributions
+    // of the words they contain. Posting cursors are merged document-at-a-time through
+    // a heap ordered by their current documents, so the union is never materialized.
+    // Words missing from the dictionary are ignored.
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> DisjunctivePhraseSearch(const string& phrase, size_t topNumber) const {
+        if (verbose) {
+            std::cerr << "Using " << ScoreEvaluator::getName() << " for any word" << std::endl;
+        }
 
-vector<string> tokenize(const string& text, const string& delimiters) {
-    std::unordered_set<char> delimiters_set(delimiters.begin(), delimiters.end());
-    vector<string> tokens;
-    string currentToken = "";
-    for (size_t i = 0; i <= text.length(); ++i) {
-        char c = text[i];
-        if ((i != text.length()) && (delimiters_set.find(c) == delimiters_set.end())) {
-            currentToken += c;
-        } else {
-            if (!currentToken.empty()) {
-                tokens.push_back(currentToken);
-            }
-            currentToken = "";
+        vector<WordRecord> tokensRecords = transformPhraseKnownWords(phrase);
+        vector<DocumentScore> documentScores;
+        if (tokensRecords.empty() || topNumber == 0) {
+            return documentScores;
         }
+
+        size_t scoredDocuments = 0;
+        documentScores = searchShards([&](const Index& shard, const DeletionBitmap* deleted, size_t& shardScoredDocuments) {
+            return disjunctiveSearch<ScoreEvaluator>(shard, deleted, tokensRecords, topNumber, shardScoredDocuments);
+        }, topNumber, scoredDocuments);
+
+        if (verbose) {
+            std::cerr << "Found " << scoredDocuments << " documents" << std::endl;
+        }
+
+        return documentScores;
     }
-    return tokens;
-}
 
-const string delimeters = " ,\n\t";
+    // Documents containing every phrase word, where words with operators and words missing
+    // from the dictionary match any word of their expansion. Contributions of all
+    // expansion words found in the document add up into its score.
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> ExpandedPhraseSearch(const string& phrase, size_t topNumber) const {
+        if (verbose) {
+            std::cerr << "Using " << ScoreEvaluator::getName() << " with expanded words" << std::endl;
+        }
 
-class SearchEngine {
-public:
-    SearchEngine()
-    { }
+        vector<WordRecord> tokensRecords;
+        vector<size_t> groupEnds;
+        vector<DocumentScore> documentScores;
+        if (!expandPhrase(phrase, tokensRecords, groupEnds) || topNumber == 0) {
+            return documentScores;
+        }
 
-    SearchEngine(const Dictionary& dict, const Index& index)
-        : dict(dict)
-        , index(index)
-    { }
+        size_t scoredDocuments = 0;
+        documentScores = searchShards([&](const Index& shard, const DeletionBitmap* deleted, size_t& shardScoredDocuments) {
+            return expandedSearch<ScoreEvaluator>(shard, deleted, tokensRecords, groupEnds, topNumber,
+                                                  shardScoredDocuments);
+        }, topNumber, scoredDocuments);
 
-    SearchEngine(const string& dictPath, const string& indexPath) {
-        dict.readFromFile(dictPath);
-        index.readFromFile(indexPath);
+        if (verbose) {
+            std::cerr << "Found " << scoredDocuments << " documents" << std::endl;
+        }
+
+        return documentScores;
     }
 
-    struct DocumentScore {
-        DocumentScore(double score, int documentIndex)
-            : score(score)
-            , documentIndex(documentIndex)
-        { }
+    // Documents containing any of the phrase words, ranked score-at-a-time by precomputed
+    // quantized BM25 impacts. Stops once the top is stable or after postingsBudget postings.
+    vector<DocumentScore> ImpactPhraseSearch(const string& phrase, size_t topNumber, size_t postingsBudget = 0) const {
+        QueryContext context;
+        return ImpactPhraseSearch(phrase, topNumber, context, postingsBudget);
+    }
 
-        DocumentScore()
-        { }
+    // Same search with the accumulators and other buffers taken from the context,
+    // so that a query costs only the postings it processes
+    const vector<DocumentScore>& ImpactPhraseSearch(const string& phrase, size_t topNumber, QueryContext& context,
+                                                    size_t postingsBudget = 0) const {
+        if (verbose) {
+            std::cerr << "Using impact-ordered BM25 for any word" << std::endl;
+        }
 
-        bool operator < (const DocumentScore &ds) const {
-            return score > ds.score;
+        vector<DocumentScore>& documentScores = context.documentScores;
+        documentScores.clear();
+        if (impactIndex.empty()) {
+            return documentScores;
         }
 
-        double score = 0.0;
-        int documentIndex = 0;
-    };
+        vector<int> wordIndices = getWordIndices(transformPhraseKnownWords(phrase));
+        for (const auto& documentImpact : impactIndex.search(wordIndices, topNumber, context.impactContext,
+                                                             postingsBudget)) {
+            documentScores.push_back(DocumentScore(documentImpact.impact * impactIndex.getQuantumScore(),
+                                                   documentImpact.document));
+        }
+        return documentScores;
+    }
 
-    template<typename DocumentScoreEvaluator>
-    vector<DocumentScore> ScoredPhraseSearch(const string& phrase) const {
-        DocumentScoreEvaluator evaluator(dict, index);
+private:
 
-        std::cerr << "Using " << evaluator.getName() << std::endl;
+    // Candidates are bounded by the upper bounds of their word scores plus the upper bound
+    // of the priors of the documents left, which is constant for NoDocumentPrior
+    template<typename ScoreEvaluator, typename DocumentFilter, typename DocumentPrior>
+    vector<DocumentScore> topScoredSearch(const Index& shard, const DeletionBitmap* deleted,
+                                          const vector<WordRecord>& tokensRecords, size_t topNumber,
+                                          DocumentFilter filter, const DocumentPrior& prior,
+                                          size_t& scoredDocuments) const {
+        ScoreEvaluator evaluator(dict, shard);
+        evaluator.prepare(tokensRecords);
+
+        vector<PostingCursor> cursors;
+        double queryUpperBound = 0.0;
+        for (size_t i = 0; i < tokensRecords.size(); ++i) {
+            int wordIndex = tokensRecords[i].index;
+            cursors.push_back(shard.getPostingCursor(wordIndex));
+            queryUpperBound += evaluator.evaluateUpperBound(i, shard.getPostingStatistics(wordIndex));
+        }
 
-        vector<WordRecord> tokensRecords = transformPhrase(phrase);
-        vector<int> documents = findDocumentsIntersection(tokensRecords);
+        // Shortest posting list proposes candidates, the others are moved to them
+        vector<size_t> order(cursors.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+            [&](size_t lhs, size_t rhs) { return cursors[lhs].size() < cursors[rhs].size(); });
+        PostingCursor& lead = cursors[order[0]];
+
+        // Top is the lowest score
+        std::priority_queue<DocumentScore> topScores;
+        vector<int> frequencies(cursors.size());
+        bool exhausted = false;
+        while (lead.valid() && !exhausted) {
+            bool isFull = (topScores.size() == topNumber);
+            double threshold = isFull ? topScores.top().score : 0.0;
+            int candidate = lead.document();
+            double priorUpperBound = prior.getUpperBound(candidate);
+            if (isFull && queryUpperBound + priorUpperBound <= threshold) {
+                break;
+            }
 
-        std::cerr << "Found " << documents.size() << " documents" << std::endl;
+            if (isFull) {
+                double blockUpperBound = priorUpperBound;
+                int blocksEnd = std::numeric_limits<int>::max();
+                for (size_t i = 0; i < cursors.size() && !exhausted; ++i) {
+                    size_t block = cursors[i].findBlock(candidate);
+                    if (block == cursors[i].blocksNumber()) {
+                        exhausted = true;
+                        break;
+                    }
+                    const BlockEntry& entry = cursors[i].getBlock(block);
+                    blockUpperBound += evaluator.evaluateUpperBound(i, entry.statistics);
+                    blocksEnd = std::min(blocksEnd, static_cast<int>(entry.lastDocument));
+                }
+                if (exhausted) {
+                    break;
+                }
+                if (blockUpperBound <= threshold) {
+                    if (blocksEnd == std::numeric_limits<int>::max()) {
+                        break;
+                    }
+                    lead.nextGEQ(blocksEnd + 1);
+                    continue;
+                }
+            }
+
+            bool aligned = true;
+            for (size_t j = 1; j < order.size(); ++j) {
+                PostingCursor& cursor = cursors[order[j]];
+                cursor.nextGEQ(candidate);
+                if (!cursor.valid()) {
+                    exhausted = true;
+                    aligned = false;
+                    break;
+                }
+                if (cursor.document() > candidate) {
+                    lead.nextGEQ(cursor.document());
+                    aligned = false;
+                    break;
+                }
+            }
+            if (!aligned) {
+                continue;
+            }
+            if (isDeleted(deleted, candidate) || !filter.matches(cursors)) {
+                lead.next();
+                continue;
+            }
+
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                frequencies[i] = cursors[i].frequency();
+            }
+            double score = evaluator.evaluateScore(candidate, frequencies) + prior.getScore(candidate);
+            ++scoredDocuments;
+            if (!isFull) {
+                topScores.push(DocumentScore(score, candidate));
+            } else if (score > threshold) {
+                topScores.pop();
+                topScores.push(DocumentScore(score, candidate));
+            }
+            lead.next();
+        }
 
         vector<DocumentScore> documentScores;
-        for (int document : documents) {
-            double score = evaluator.evaluateScore(document, tokensRecords);
-            documentScores.push_back(DocumentScore(score, document));
+        while (!topScores.empty()) {
+            documentScores.push_back(topScores.top());
+            topScores.pop();
         }
-        std::sort(documentScores.begin(), documentScores.end());
         return documentScores;
     }
 
-private:
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> disjunctiveSearch(const Index& shard, const DeletionBitmap* deleted,
+                                            const vector<WordRecord>& tokensRecords, size_t topNumber,
+                                            size_t& scoredDocuments) const {
+        ScoreEvaluator evaluator(dict, shard);
+        evaluator.prepare(tokensRecords);
+
+        typedef std::pair<int, size_t> CursorPosition;
+        std::priority_queue<CursorPosition, vector<CursorPosition>, std::greater<CursorPosition>> cursorsHeap;
+        vector<PostingCursor> cursors;
+        for (size_t i = 0; i < tokensRecords.size(); ++i) {
+            cursors.push_back(shard.getPostingCursor(tokensRecords[i].index));
+            if (cursors[i].valid()) {
+                cursorsHeap.push(CursorPosition(cursors[i].document(), i));
+            }
+        }
 
-    vector<WordRecord> transformPhrase(const string& phrase) const {
-        vector<WordRecord> tokensRecords;
-        vector<string> tokens = tokenize(phrase, delimeters);
+        // Top is the lowest score
+        std::priority_queue<DocumentScore> topScores;
+        while (!cursorsHeap.empty()) {
+            int document = cursorsHeap.top().first;
+            bool live = !isDeleted(deleted, document);
+            double score = 0.0;
+            while (!cursorsHeap.empty() && cursorsHeap.top().first == document) {
+                size_t i = cursorsHeap.top().second;
+                cursorsHeap.pop();
+                if (live) {
+                    score += evaluator.evaluateWordScore(i, document, cursors[i].frequency());
+                }
+                cursors[i].next();
+                if (cursors[i].valid()) {
+                    cursorsHeap.push(CursorPosition(cursors[i].document(), i));
+                }
+            }
+            if (!live) {
+                continue;
+            }
 
-        if (tokens.empty()) {
-            return tokensRecords;
+            ++scoredDocuments;
+            if (topScores.size() < topNumber) {
+                topScores.push(DocumentScore(score, document));
+            } else if (score > topScores.top().score) {
+                topScores.pop();
+                topScores.push(DocumentScore(score, document));
+            }
         }
 
-        for (size_t i = 0; i < tokens.size(); ++i) {
-            if (!dict.containsWord(tokens[i])) {
-                return vector<WordRecord>();
-            }
-            tokensRecords.push_back(dict.getWordRecord(tokens[i]));
+        vector<DocumentScore> documentScores;
+        while (!topScores.empty()) {
+            documentScores.push_back(topScores.top());
+            topScores.pop();
         }
-        return tokensRecords;
+        return documentScores;
     }
 
-    vector<int> findDocumentsIntersection(const vector<WordRecord>& records) const {
-        vector<int> searchResults;
+    // Word groups are disjunctions of cursors, their documents are the least documents
+    // of the cursors. Groups are moved to the largest of their documents until all agree.
+    template<typename ScoreEvaluator>
+    vector<DocumentScore> expandedSearch(const Index& shard, const DeletionBitmap* deleted,
+                                         const vector<WordRecord>& tokensRecords, const vector<size_t>& groupEnds,
+                                         size_t topNumber, size_t& scoredDocuments) const {
+        ScoreEvaluator evaluator(dict, shard);
+        evaluator.prepare(tokensRecords);
+
+        vector<PostingCursor> cursors;
+        for (const auto& record : tokensRecords) {
+            cursors.push_back(shard.getPostingCursor(record.index));
+        }
+
+        // Top is the lowest score
+        std::priority_queue<DocumentScore> topScores;
+        int candidate = 0;
+        bool exhausted = false;
+        while (!exhausted) {
+            bool aligned = true;
+            for (size_t group = 0; group < groupEnds.size(); ++group) {
+                int groupDocument = std::numeric_limits<int>::max();
+                for (size_t i = (group == 0 ? 0 : groupEnds[group - 1]); i < groupEnds[group]; ++i) {
+                    cursors[i].nextGEQ(candidate);
+                    if (cursors[i].valid()) {
+                        groupDocument = std::min(groupDocument, cursors[i].document());
+                    }
+                }
+                if (groupDocument == std::numeric_limits<int>::max()) {
+                    exhausted = true;
+                    break;
+                }
+                if (groupDocument > candidate) {
+                    candidate = groupDocument;
+                    aligned = false;
+                }
+            }
+            if (exhausted || !aligned) {
+                continue;
+            }
+            if (isDeleted(deleted, candidate)) {
+                ++candidate;
+                continue;
+            }
+
+            double score = 0.0;
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                if (cursors[i].valid() && cursors[i].document() == candidate) {
+                    score += evaluator.evaluateWordScore(i, candidate, cursors[i].frequency());
+                }
+            }
+            ++scoredDocuments;
+            if (topScores.size() < topNumber) {
+                topScores.push(DocumentScore(score, candidate));
+            } else if (score > topScores.top().score) {
+                topScores.pop();
+                topScores.push(DocumentScore(score, candidate));
+            }
+            ++candidate;
+        }
 
-        if (records.empty()) {
-            return searchResults;
+        vector<DocumentScore> documentScores;
+        while (!topScores.empty()) {
+            documentScores.push_back(topScores.top());
+            topScores.pop();
         }
-        searchResults = index.getWordDocuments(records[0].index);
-        for (size_t i = 1; i < records.size(); ++i) {
-            vector<int> wordDocuments = index.getWordDocuments(records[i].index);
-            std::unordered_set<int> wordDocumentsSet(wordDocuments.begin(), wordDocuments.end());
+        return documentScores;
+    }
 
-            vector<int> filteredSearchResults;
-            for (const auto& result : searchResults) {
-                if (wordDocumentsSet.find(result) != wordDocumentsSet.end()) {
-                    filteredSearchResults.push_back(result);
+    // Cursors are moved to the largest of their documents until all agree, the cursor
+    // of the shortest lists is moved first as it skips the most
+    vector<DocumentScore> fieldedSearch(const Index& shard, const DeletionBitmap* deleted,
+                                        const vector<WordRecord>& tokensRecords, size_t topNumber,
+                                        size_t& scoredDocuments) const {
+        BM25FDocumentScoreEvaluator evaluator(dict, shard);
+        evaluator.prepare(tokensRecords);
+
+        vector<FieldsCursor> cursors;
+        for (const auto& record : tokensRecords) {
+            cursors.push_back(FieldsCursor(shard, record.index));
+        }
+        vector<size_t> order(cursors.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+            [&](size_t lhs, size_t rhs) { return cursors[lhs].size() < cursors[rhs].size(); });
+
+        // Top is the lowest score
+        std::priority_queue<DocumentScore> topScores;
+        vector<int> fieldFrequencies(cursors.size() * documentFieldsNumber);
+        int candidate = 0;
+        bool exhausted = false;
+        while (!exhausted) {
+            bool aligned = true;
+            for (size_t i : order) {
+                FieldsCursor& cursor = cursors[i];
+                cursor.nextGEQ(candidate);
+                if (!cursor.valid()) {
+                    exhausted = true;
+                    break;
+                }
+                if (cursor.document() > candidate) {
+                    candidate = cursor.document();
+                    aligned = false;
+                    break;
                 }
             }
-            searchResults = filteredSearchResults;
+            if (exhausted || !aligned) {
+                continue;
+            }
+            if (isDeleted(deleted, candidate)) {
+                ++candidate;
+                continue;
+            }
+
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                for (int field = 0; field < documentFieldsNumber; ++field) {
+                    fieldFrequencies[i * documentFieldsNumber + field] =
+                        cursors[i].frequency(static_cast<DocumentField>(field));
+                }
+            }
+            double score = evaluator.evaluateScore(candidate, fieldFrequencies);
+            ++scoredDocuments;
+            if (topScores.size() < topNumber) {
+                topScores.push(DocumentScore(score, candidate));
+            } else if (score > topScores.top().score) {
+                topScores.pop();
+                topScores.push(DocumentScore(score, candidate));
+            }
+            ++candidate;
+        }
+
+        vector<DocumentScore> documentScores;
+        while (!topScores.empty()) {
+            documentScores.push_back(topScores.top());
+            topScores.pop();
         }
-        return searchResults;
+        return documentScores;
     }
 
-    Dictionary dict;
-    Index index;
-};
+    // Runs the search over the index, over all of its shards or over all live segments
+    // in parallel threads, and merges the top documents found. Deleted documents
+    // of a segment are skipped by the shard search.
+    template<typename ShardSearch>
+    vector<DocumentScore> searchShards(ShardSearch shardSearch, size_t topNumber, size_t& scoredDocuments) const {
+        typedef std::pair<const Index*, const DeletionBitmap*> SearchedPart;
+        vector<SearchedPart> parts;
+        std::shared_ptr<const SegmentsSnapshot> snapshot;
+        if (segmentedIndex) {
+            snapshot = segmentedIndex->getSnapshot();
+            for (const auto& segment : snapshot->segments) {
+                parts.push_back(SearchedPart(&segment.index, segment.deleted.get()));
+            }
+        } else if (shards.empty()) {
+            parts.push_back(SearchedPart(&index, nullptr));
+        } else {
+            for (const auto& shard : shards) {
+                parts.push_back(SearchedPart(&shard, nullptr));
+            }
+        }
 
-class DocumentScoreEvaluator {
-public:
-    DocumentScoreEvaluator(const Dictionary& dict, const Index& index)
-        : dict(dict)
-        , index(index)
-    { }
+        vector<DocumentScore> documentScores;
+        vector<vector<DocumentScore>> shardScores(parts.size());
+        vector<size_t> shardScoredDocuments(parts.size(), 0);
+        vector<std::thread> threads;
+        for (size_t i = 1; i < parts.size(); ++i) {
+            threads.push_back(std::thread([&, i] {
+                shardScores[i] = shardSearch(*parts[i].first, parts[i].second, shardScoredDocuments[i]);
+            }));
+        }
+        if (!parts.empty()) {
+            shardScores[0] = shardSearch(*parts[0].first, parts[0].second, shardScoredDocuments[0]);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (size_t i = 0; i < parts.size(); ++i) {
+            documentScores.insert(documentScores.end(), shardScores[i].begin(), shardScores[i].end());
+            scoredDocuments += shardScoredDocuments[i];
+        }
 
-    virtual double evaluateScore(int documentIndex, const vector<WordRecord>& keywords) const = 0;
-    virtual string getName() const = 0;
+        std::sort(documentScores.begin(), documentScores.end());
+        if (documentScores.size() > topNumber) {
+            documentScores.erase(documentScores.begin() + topNumber, documentScores.end());
+        }
+        return documentScores;
+    }
 
-protected:
-    Dictionary dict;
-    Index index;
-};
+    // Top documents of a query; complete when the query matches no more documents
+    struct CachedResult {
+        vector<DocumentScore> documentScores;
+        bool complete = false;
+    };
 
-class BooleanDocumentScoreEvaluator : public DocumentScoreEvaluator {
-public:
-    BooleanDocumentScoreEvaluator(const Dictionary& dict, const Index& index)
-        : DocumentScoreEvaluator(dict, index)
-    { }
+    typedef ShardedCache<QueryKey, CachedResult, QueryKeyHash> ResultCache;
+    typedef ShardedCache<int, std::shared_ptr<const PostingList>> PostingCache;
+
+    // Approximate memory taken by a cache entry besides the key and value
+    static const size_t cacheEntryOverhead = 96;
 
-    double evaluateScore(int documentIndex, const vector<WordRecord>& keywords) const override {
-        return 1.0;
+    // Results over segments change with every update and are never cached
+    bool findCachedResult(const QueryKey& key, size_t topNumber, vector<DocumentScore>& documentScores) const {
+        CachedResult result;
+        if (!resultCache || segmentedIndex || !resultCache->find(key, result)) {
+            return false;
+        }
+        if (result.documentScores.size() < topNumber && !result.complete) {
+            return false;
+        }
+        documentScores.assign(result.documentScores.begin(),
+                              result.documentScores.begin() + std::min(topNumber, result.documentScores.size()));
+        return true;
     }
 
-    string getName() const override {
-        return "Boolean ScoreEvaluator";
+    // Top of topNumber documents, complete if there are no more documents
+    void cacheResult(const QueryKey& key, size_t topNumber, const vector<DocumentScore>& documentScores) const {
+        if (!resultCache || segmentedIndex) {
+            return;
+        }
+        CachedResult result;
+        result.complete = documentScores.size() < topNumber;
+        result.documentScores = documentScores;
+        resultCache->insert(key, result);
     }
-};
 
-class TFIDFDocumentScoreEvaluator : public DocumentScoreEvaluator {
-public:
-    TFIDFDocumentScoreEvaluator(const Dictionary& dict, const Index& index)
-        : DocumentScoreEvaluator(dict, index)
-    { }
+    std::shared_ptr<const PostingList> getPostingList(int wordIndex) const {
+        std::shared_ptr<const PostingList> postingList;
+        if (postingCache && postingCache->find(wordIndex, postingList)) {
+            return postingList;
+        }
+        postingList = std::make_shared<PostingList>(index.getPostingList(wordIndex));
+        if (postingCache) {
+            postingCache->insert(wordIndex, postingList);
+        }
+        return postingList;
+    }
 
-    double evaluateScore(int documentIndex, const vector<WordRecord>& keywords) const override {
-        double score = 0.0;
-        for (size_t i = 0; i < keywords.size(); ++i) {
-            size_t wordDocumentsNumber = index.getWordDocumentsNumber(keywords[i].index);
-            size_t wordDocumentFrequency = index.getWordDocumentFrequency(keywords[i].index, documentIndex);
-            double idf = log((index.documentsNumber() - wordDocumentsNumber + 0.5) / (wordDocumentsNumber + 0.5));
-            double tf = 0.5 + 0.5 * wordDocumentFrequency / index.getMaxWordDocumentFrequency(documentIndex);
-            score += idf * tf;
+    // Intersects the lists of the context in the order of its plan, choosing between merge
+    // and galloping by the candidates actually found. Stops at the first empty intersection.
+    void executePlan(QueryContext& context) const {
+        typedef std::chrono::steady_clock Clock;
+        vector<PlanStep>& steps = context.plan.steps;
+        vector<int>& documents = context.documents;
+        documents.clear();
+        for (size_t i = 0; i < steps.size(); ++i) {
+            Clock::time_point stepStart = Clock::now();
+            PlanStep& step = steps[i];
+            if (step.isRoaring && i == 0) {
+                // All words are dense, their sets are intersected at once
+                size_t setsNumber = std::min(steps.size(), RoaringSet::maxIntersectedSets);
+                context.roaringSets.clear();
+                for (size_t j = 0; j < setsNumber; ++j) {
+                    context.roaringSets.push_back(index.getRoaringSet(steps[j].wordIndex));
+                }
+                RoaringSet::intersect(context.roaringSets.data(), setsNumber, documents);
+                for (size_t j = 0; j + 1 < setsNumber; ++j) {
+                    steps[j].executed = true;
+                    steps[j].strategy = BitmapStrategy;
+                    steps[j].candidates = documents.size();
+                }
+                i = setsNumber - 1;
+            } else if (step.isRoaring) {
+                index.getRoaringSet(step.wordIndex).filter(documents, context.intersectionBuffer);
+                documents.swap(context.intersectionBuffer);
+            } else {
+                const vector<int>& list = loadPostingList(context, step.keyword).documents;
+                if (i == 0) {
+                    documents.assign(list.begin(), list.end());
+                } else {
+                    step.strategy = intersectCandidates(documents, list, context.intersectionBuffer);
+                    documents.swap(context.intersectionBuffer);
+                }
+            }
+            steps[i].executed = true;
+            steps[i].candidates = documents.size();
+            steps[i].microseconds =
+                std::chrono::duration<double, std::micro>(Clock::now() - stepStart).count();
+            if (documents.empty()) {
+                break;
+            }
         }
-        return score;
     }
 
-    string getName() const override {
-        return "TFIDF ScoreEvaluator";
+    static void releaseCachedLists(QueryContext& context) {
+        for (auto& cachedList : context.cachedLists) {
+            cachedList.reset();
+        }
     }
-};
 
-class BM25DocumentScoreEvaluator : public DocumentScoreEvaluator {
-public:
-    BM25DocumentScoreEvaluator(const Dictionary& dict, const Index& index)
-        : DocumentScoreEvaluator(dict, index)
-    { }
+    const PostingList& loadPostingList(QueryContext& context, size_t keyword) const {
+        int wordIndex = context.wordIndices[keyword];
+        if (postingCache) {
+            context.cachedLists[keyword] = getPostingList(wordIndex);
+            context.postingLists[keyword] = context.cachedLists[keyword].get();
+        } else {
+            index.decodePostingList(wordIndex, context.decodedLists[keyword]);
+            context.postingLists[keyword] = &context.decodedLists[keyword];
+        }
+        return *context.postingLists[keyword];
+    }
 
-    double evaluateScore(int documentIndex, const vector<WordRecord>& keywords) const override {
-        double score = 0.0;
-        for (size_t i = 0; i < keywords.size(); ++i) {
-            size_t wordDocumentsNumber = index.getWordDocumentsNumber(keywords[i].index);
+    static vector<int> getWordIndices(const vector<WordRecord>& tokensRecords) {
+        vector<int> wordIndices;
+        for (const auto& record : tokensRecords) {
+            wordIndices.push_back(record.index);
+        }
+        return wordIndices;
+    }
 
-            double wordDocumentFrequency = index.getWordDocumentFrequency(keywords[i].index, documentIndex) * 1.0
-                / index.getMaxWordDocumentFrequency(documentIndex);
+    vector<WordRecord> transformPhraseKnownWords(const string& phrase) const {
+        vector<WordRecord> tokensRecords;
+        for (const auto& token : queryTokenizer.tokenize(phrase)) {
+            if (dict.containsWord(token)) {
+                tokensRecords.push_back(dict.getWordRecord(token));
+            }
+        }
+        return tokensRecords;
+    }
 
-            double idf = log((index.documentsNumber() - wordDocumentsNumber + 0.5)
-                    / (wordDocumentsNumber + 0.5));
+    // Expansions of all phrase words one after another, groupEnds[i] is the end of
+    // the expansion of word i. False if some word expands to nothing.
+    bool expandPhrase(const string& phrase, vector<WordRecord>& tokensRecords, vector<size_t>& groupEnds) const {
+        if (!termExpander) {
+            throw std::logic_error("Term expansion is not enabled");
+        }
 
-            score += idf * (wordDocumentFrequency * (k + 1)) 
-                / (wordDocumentFrequency + k * (1 - b + b * index.documentsNumber() / index.getAverageDocumentLength()));
+        vector<string> tokens = queryTokenizer.tokenize(phrase);
+        for (const auto& token : tokens) {
+            vector<WordRecord> expansion = termExpander->expand(token);
+            if (expansion.empty()) {
+                if (verbose) {
+                    std::cerr << "No words for " << token << std::endl;
+                }
+                return false;
+            }
+            if (verbose) {
+                std::cerr << "Expanded " << token << " to";
+                for (const auto& record : expansion) {
+                    std::cerr << " " << record.word;
+                }
+                std::cerr << std::endl;
+            }
+            tokensRecords.insert(tokensRecords.end(), expansion.begin(), expansion.end());
+            groupEnds.push_back(tokensRecords.size());
         }
-        return score;
+        return !tokens.empty();
     }
 
-    string getName() const override {
-        return "BM25 ScoreEvaluator";
+    vector<WordRecord> transformPhrase(const string& phrase) const {
+        vector<WordRecord> tokensRecords;
+        vector<string> tokens = queryTokenizer.tokenize(phrase);
+
+        if (tokens.empty()) {
+            return tokensRecords;
+        }
+
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (!dict.containsWord(tokens[i])) {
+                return vector<WordRecord>();
+            }
+            tokensRecords.push_back(dict.getWordRecord(tokens[i]));
+        }
+        return tokensRecords;
     }
 
-private:
-    static constexpr double b = 0.75;
-    static constexpr double k = 1.5;
+    Dictionary dict;
+    Index index;
+    vector<Index> shards;
+    ImpactIndex impactIndex;
+    StaticRank staticRank;
+    textnorm::Tokenizer documentTokenizer;
+    textnorm::Tokenizer queryTokenizer;
+    std::shared_ptr<ResultCache> resultCache;
+    std::shared_ptr<PostingCache> postingCache;
+    std::shared_ptr<const TermExpander> termExpander;
+    std::shared_ptr<SegmentedIndex> segmentedIndex;
+    bool verbose = false;
 };
 
 } // namespace irindexer
@@ -0,0 +1,492 @@
+#ifndef SEGMENTED_INDEX_HPP
+#define SEGMENTED_INDEX_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "index.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Deleted documents of a segment, indexed by document
+typedef vector<bool> DeletionBitmap;
+
+inline bool isDeleted(const DeletionBitmap* deleted, int document) {
+    return deleted != nullptr && static_cast<size_t>(document) < deleted->size() && (*deleted)[document];
+}
+
+// Immutable segment with the documents deleted from it so far
+struct Segment {
+    Index index;
+    std::shared_ptr<const DeletionBitmap> deleted;
+    string filename;
+};
+
+// Segments searched by one query. Their indices share statistics of all segments,
+// so a document gets the same score in any of them.
+struct SegmentsSnapshot {
+    vector<Segment> segments;
+};
+
+// Added documents become visible to queries at most this often, so that queries between
+// additions don't rebuild the in-memory segment and the statistics of all segments
+const std::chrono::milliseconds segmentsRefreshInterval(1000);
+
+// Log-structured index: new documents go into an in-memory segment, which is
+// flushed as an immutable segment file once it holds flushDocuments documents.
+// Deletions only set bits in the bitmaps of segments holding the document,
+// so a document is live in at most one segment. A background thread merges
+// mergeFactor segments of the same size tier into one, dropping deleted documents.
+// Segment files and deletions are listed in the manifest of the directory.
+// Deletions and flushes are visible to the next query, added documents once the
+// snapshot is refreshed, at most segmentsRefreshInterval after they were added.
+class SegmentedIndex {
+public:
+    // Opens the segments of the directory, or starts it with the initial index
+    // when the directory has no manifest yet
+    SegmentedIndex(const string& directory, const Index& initialIndex, size_t flushDocuments, size_t mergeFactor)
+        : directory(directory)
+        , flushDocuments(std::max<size_t>(flushDocuments, 1))
+        , mergeFactor(std::max<size_t>(mergeFactor, 2))
+    {
+        ::mkdir(directory.c_str(), 0755);
+        std::ifstream manifest(manifestPath());
+        if (manifest.is_open()) {
+            readManifest(manifest);
+        } else {
+            Segment segment;
+            segment.filename = newSegmentFilename();
+            initialIndex.writeToFile(segmentPath(segment.filename));
+            segment.index.readBinaryFile(segmentPath(segment.filename));
+            segment.deleted = std::make_shared<DeletionBitmap>();
+            segments.push_back(segment);
+            writeManifest();
+        }
+        withPositions = std::any_of(segments.begin(), segments.end(),
+            [](const Segment& segment) { return segment.index.hasPositions(); });
+
+        mergeThread = std::thread(&SegmentedIndex::mergeSegments, this);
+    }
+
+    ~SegmentedIndex() {
+        {
+            std::lock_guard<std::mutex> lock(segmentsMutex);
+            stopped = true;
+        }
+        mergeNeeded.notify_all();
+        mergeThread.join();
+    }
+
+    SegmentedIndex(const SegmentedIndex&) = delete;
+    SegmentedIndex& operator = (const SegmentedIndex&) = delete;
+
+    // Words are word indices in the order of the document, -1 for unknown words.
+    // A document added again replaces its previous version.
+    void addDocument(int document, const vector<int>& words) {
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        deleteLocked(document);
+        MemoryDocument& memoryDocument = memoryDocuments[document];
+        for (size_t position = 0; position < words.size(); ++position) {
+            if (words[position] >= 0) {
+                memoryDocument[words[position]].push_back(position);
+            }
+        }
+        memoryChanged = true;
+        if (memoryDocuments.size() >= flushDocuments) {
+            flushLocked();
+        }
+    }
+
+    void deleteDocument(int document) {
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        deleteLocked(document);
+        writeManifest();
+    }
+
+    // Writes the in-memory segment as an immutable segment file
+    void flush() {
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        flushLocked();
+    }
+
+    bool hasPositions() const {
+        return withPositions;
+    }
+
+    size_t segmentsNumber() const {
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        return segments.size();
+    }
+
+    // Current segments, including the in-memory one. Built again after flushes and merges,
+    // and for added documents only once segmentsRefreshInterval passed since the previous build.
+    std::shared_ptr<const SegmentsSnapshot> getSnapshot() const {
+        std::lock_guard<std::mutex> lock(segmentsMutex);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (!snapshot || (memoryChanged && now - refreshTime >= segmentsRefreshInterval)) {
+            std::shared_ptr<SegmentsSnapshot> current = std::make_shared<SegmentsSnapshot>();
+            current->segments = segments;
+            if (!memoryDocuments.empty()) {
+                Segment memorySegment;
+                memorySegment.index = Index(buildMemoryWriter());
+                memorySegment.deleted = std::make_shared<DeletionBitmap>();
+                current->segments.push_back(memorySegment);
+            }
+            shareStatistics(current->segments);
+            snapshot = current;
+            memoryChanged = false;
+            refreshTime = now;
+        }
+        return snapshot;
+    }
+
+private:
+    // Positions of words in the document
+    typedef std::map<int, vector<int>> MemoryDocument;
+
+    string manifestPath() const {
+        return directory + "/segments.txt";
+    }
+
+    string segmentPath(const string& filename) const {
+        return directory + "/" + filename;
+    }
+
+    string newSegmentFilename() {
+        return "segment_" + std::to_string(nextSegmentNumber++) + ".bin";
+    }
+
+    // Manifest lines are "SEGMENT_FILE [DELETED_DOCUMENT ...]"
+    void readManifest(std::ifstream& manifest) {
+        std::cerr << "Opening segments of " << directory << std::endl;
+
+        string line;
+        while (std::getline(manifest, line)) {
+            std::istringstream lineStream(line);
+            Segment segment;
+            if (!(lineStream >> segment.filename)) {
+                continue;
+            }
+            segment.index.readBinaryFile(segmentPath(segment.filename));
+            std::shared_ptr<DeletionBitmap> deleted = std::make_shared<DeletionBitmap>();
+            int document;
+            while (lineStream >> document) {
+                markDeleted(*deleted, document);
+            }
+            segment.deleted = deleted;
+            segments.push_back(segment);
+
+            size_t number = 0;
+            if (std::sscanf(segment.filename.c_str(), "segment_%zu.bin", &number) == 1) {
+                nextSegmentNumber = std::max(nextSegmentNumber, number + 1);
+            }
+        }
+
+        std::cerr << "Opened " << segments.size() << " segments" << std::endl;
+    }
+
+    // Written to a temporary file first, so a crash leaves either the old or the new manifest
+    void writeManifest() const {
+        string temporaryPath = manifestPath() + ".tmp";
+        {
+            std::ofstream manifest(temporaryPath);
+            if (!manifest.is_open()) {
+                throw std::logic_error("Can't open file " + temporaryPath);
+            }
+            for (const auto& segment : segments) {
+                manifest << segment.filename;
+                for (size_t document = 0; document < segment.deleted->size(); ++document) {
+                    if ((*segment.deleted)[document]) {
+                        manifest << ' ' << document;
+                    }
+                }
+                manifest << '\n';
+            }
+        }
+        if (std::rename(temporaryPath.c_str(), manifestPath().c_str()) != 0) {
+            throw std::logic_error("Can't replace manifest " + manifestPath());
+        }
+    }
+
+    static void markDeleted(DeletionBitmap& deleted, int document) {
+        if (static_cast<size_t>(document) >= deleted.size()) {
+            deleted.resize(document + 1, false);
+        }
+        deleted[document] = true;
+    }
+
+    static bool containsDocument(const Index& index, int document) {
+        return document >= 0 && static_cast<size_t>(document) < index.documentSlots()
+            && index.getDocumentLength(document) > 0;
+    }
+
+    // Bitmaps are copied on write, so snapshots taken before keep seeing the document.
+    // The current snapshot is replaced by a copy with the document deleted,
+    // as its segments are the current ones followed by the in-memory one.
+    void deleteLocked(int document) {
+        memoryDocuments.erase(document);
+        for (auto& segment : segments) {
+            deleteFromSegment(segment, document);
+        }
+        if (snapshot) {
+            std::shared_ptr<SegmentsSnapshot> current = std::make_shared<SegmentsSnapshot>(*snapshot);
+            for (size_t i = 0; i < segments.size(); ++i) {
+                current->segments[i].deleted = segments[i].deleted;
+            }
+            if (current->segments.size() > segments.size()) {
+                deleteFromSegment(current->segments.back(), document);
+            }
+            snapshot = current;
+        }
+    }
+
+    static void deleteFromSegment(Segment& segment, int document) {
+        if (containsDocument(segment.index, document) && !isDeleted(segment.deleted.get(), document)) {
+            std::shared_ptr<DeletionBitmap> deleted = std::make_shared<DeletionBitmap>(*segment.deleted);
+            markDeleted(*deleted, document);
+            segment.deleted = deleted;
+        }
+    }
+
+    void flushLocked() {
+        if (memoryDocuments.empty()) {
+            return;
+        }
+        Segment segment;
+        segment.filename = newSegmentFilename();
+        Index(buildMemoryWriter()).writeToFile(segmentPath(segment.filename));
+        segment.index.readBinaryFile(segmentPath(segment.filename));
+        segment.deleted = std::make_shared<DeletionBitmap>();
+        segments.push_back(segment);
+        memoryDocuments.clear();
+        snapshot.reset();
+        writeManifest();
+        mergeNeeded.notify_all();
+    }
+
+    IndexWriter buildMemoryWriter() const {
+        std::map<int, vector<IndexWriter::Posting>> wordsPostings;
+        std::map<int, vector<vector<int>>> wordsPositions;
+        for (const auto& memoryDocument : memoryDocuments) {
+            for (const auto& wordPositions : memoryDocument.second) {
+                int word = wordPositions.first;
+                wordsPostings[word].push_back(IndexWriter::Posting(memoryDocument.first, wordPositions.second.size()));
+                if (withPositions) {
+                    wordsPositions[word].push_back(wordPositions.second);
+                }
+            }
+        }
+        IndexWriter writer;
+        for (auto& wordPostings : wordsPostings) {
+            writer.addPostingList(wordPostings.first, std::move(wordPostings.second),
+                                  std::move(wordsPositions[wordPostings.first]));
+        }
+        return writer;
+    }
+
+    // Deleted documents are still counted, as they are until their segments are merged
+    static void shareStatistics(vector<Segment>& segments) {
+        size_t documentsNumber = 0;
+        vector<double> totalLengths(documentFieldsNumber, 0.0);
+        size_t wordsNumber = 0;
+        for (const auto& segment : segments) {
+            documentsNumber += segment.index.documentsNumber();
+            for (int field = 0; field < documentFieldsNumber; ++field) {
+                totalLengths[field] += segment.index.getAverageFieldLength(static_cast<DocumentField>(field))
+                                     * segment.index.documentsNumber();
+            }
+            wordsNumber = std::max(wordsNumber, segment.index.wordsNumber());
+        }
+        vector<size_t> wordDocumentsNumbers(wordsNumber, 0);
+        for (const auto& segment : segments) {
+            for (size_t word = 0; word < segment.index.wordsNumber(); ++word) {
+                wordDocumentsNumbers[word] += segment.index.getWordDocumentsNumber(word);
+            }
+        }
+        vector<double> averageLengths(documentFieldsNumber, 0.0);
+        for (int field = 0; field < documentFieldsNumber && documentsNumber > 0; ++field) {
+            averageLengths[field] = totalLengths[field] / documentsNumber;
+        }
+        for (auto& segment : segments) {
+            segment.index.setCollectionStatistics(documentsNumber, averageLengths, wordDocumentsNumbers);
+        }
+    }
+
+    // Segments of tier t hold less than flushDocuments * mergeFactor^(t + 1) documents
+    size_t getTier(const Segment& segment) const {
+        size_t tier = 0;
+        for (size_t limit = flushDocuments * mergeFactor; segment.index.documentsNumber() >= limit; limit *= mergeFactor) {
+            ++tier;
+        }
+        return tier;
+    }
+
+    // Oldest mergeFactor segments of the lowest tier having that many, empty if there are none
+    vector<size_t> selectMerge() const {
+        std::map<size_t, vector<size_t>> tiers;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            vector<size_t>& tier = tiers[getTier(segments[i])];
+            tier.push_back(i);
+            if (tier.size() == mergeFactor) {
+                return tier;
+            }
+        }
+        return vector<size_t>();
+    }
+
+    // A failed merge leaves the segments as they are and is retried after the next flush
+    void mergeSegments() {
+        std::unique_lock<std::mutex> lock(segmentsMutex);
+        bool mergeFailed = false;
+        while (!stopped) {
+            vector<size_t> selected = selectMerge();
+            if (selected.empty() || mergeFailed) {
+                mergeFailed = false;
+                mergeNeeded.wait(lock);
+                continue;
+            }
+
+            vector<Segment> sources;
+            for (size_t i : selected) {
+                sources.push_back(segments[i]);
+            }
+            Segment merged;
+            merged.filename = newSegmentFilename();
+
+            lock.unlock();
+            std::cerr << "Merging " << sources.size() << " segments into " << merged.filename << std::endl;
+            try {
+                writeMergedSegment(sources, segmentPath(merged.filename));
+                merged.index.readBinaryFile(segmentPath(merged.filename));
+            } catch (const std::exception& error) {
+                abandonMerge(merged, error);
+                lock.lock();
+                mergeFailed = true;
+                continue;
+            }
+            lock.lock();
+
+            // Documents deleted while the segments were merged are deleted from the merged one
+            std::shared_ptr<DeletionBitmap> deleted = std::make_shared<DeletionBitmap>();
+            vector<Segment> remaining;
+            for (size_t i = 0; i < segments.size(); ++i) {
+                auto source = std::find_if(sources.begin(), sources.end(),
+                    [&](const Segment& segment) { return segment.filename == segments[i].filename; });
+                if (source == sources.end()) {
+                    remaining.push_back(segments[i]);
+                    continue;
+                }
+                const DeletionBitmap& current = *segments[i].deleted;
+                for (size_t document = 0; document < current.size(); ++document) {
+                    if (current[document] && !isDeleted(source->deleted.get(), document)) {
+                        markDeleted(*deleted, document);
+                    }
+                }
+            }
+            merged.deleted = deleted;
+            remaining.insert(remaining.begin() + selected[0], merged);
+            segments.swap(remaining);
+            try {
+                writeManifest();
+            } catch (const std::exception& error) {
+                segments.swap(remaining);
+                abandonMerge(merged, error);
+                mergeFailed = true;
+                continue;
+            }
+            snapshot.reset();
+
+            for (const auto& source : sources) {
+                std::remove(segmentPath(source.filename).c_str());
+            }
+        }
+    }
+
+    void abandonMerge(const Segment& merged, const std::exception& error) const {
+        std::cerr << "Failed to merge segments into " << merged.filename << ": " << error.what() << std::endl;
+        std::remove(segmentPath(merged.filename).c_str());
+    }
+
+    void writeMergedSegment(const vector<Segment>& sources, const string& path) const {
+        size_t wordsNumber = 0;
+        for (const auto& source : sources) {
+            wordsNumber = std::max(wordsNumber, source.index.wordsNumber());
+        }
+
+        IndexWriter writer;
+        vector<IndexWriter::Posting> postings;
+        vector<vector<int>> positions;
+        for (size_t word = 0; word < wordsNumber; ++word) {
+            for (const auto& source : sources) {
+                for (PostingCursor cursor = source.index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+                    if (isDeleted(source.deleted.get(), cursor.document())) {
+                        continue;
+                    }
+                    postings.push_back(IndexWriter::Posting(cursor.document(), cursor.frequency()));
+                    if (withPositions) {
+                        positions.push_back(vector<int>());
+                        cursor.readPositions(positions.back());
+                    }
+                }
+            }
+            if (!postings.empty()) {
+                writer.addPostingList(word, std::move(postings), std::move(positions));
+                postings.clear();
+                positions.clear();
+            }
+            for (int field = TitleField; field < documentFieldsNumber; ++field) {
+                DocumentField documentField = static_cast<DocumentField>(field);
+                for (const auto& source : sources) {
+                    for (PostingCursor cursor = source.index.getFieldPostingCursor(documentField, word);
+                         cursor.valid(); cursor.next()) {
+                        if (!isDeleted(source.deleted.get(), cursor.document())) {
+                            postings.push_back(IndexWriter::Posting(cursor.document(), cursor.frequency()));
+                        }
+                    }
+                }
+                if (!postings.empty()) {
+                    writer.addFieldPostingList(documentField, word, std::move(postings));
+                    postings.clear();
+                }
+            }
+        }
+        Index(writer).writeToFile(path);
+    }
+
+    string directory;
+    size_t flushDocuments;
+    size_t mergeFactor;
+    bool withPositions = false;
+    size_t nextSegmentNumber = 0;
+
+    mutable std::mutex segmentsMutex;
+    std::condition_variable mergeNeeded;
+    bool stopped = false;
+    vector<Segment> segments;
+    std::map<int, MemoryDocument> memoryDocuments;
+    mutable bool memoryChanged = false;
+    mutable std::chrono::steady_clock::time_point refreshTime;
+    mutable std::shared_ptr<const SegmentsSnapshot> snapshot;
+    std::thread mergeThread;
+};
+
+} // namespace irindexer
+
+#endif // SEGMENTED_INDEX_HPP
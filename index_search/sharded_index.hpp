@@ -0,0 +1,95 @@
+#ifndef SHARDED_INDEX_HPP
+#define SHARDED_INDEX_HPP
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "index.hpp"
+
+namespace irindexer {
+
+using std::vector;
+
+// Splits the collection into shards of contiguous document ranges with about the same
+// total length of documents. Shards keep document indices of the collection and share
+// its statistics, so every document gets the same score in its shard as in the collection.
+inline vector<Index> partitionIndex(const Index& index, size_t shardsNumber) {
+    std::cerr << "Partitioning index into " << shardsNumber << " shards" << std::endl;
+
+    shardsNumber = std::max<size_t>(shardsNumber, 1);
+    size_t documentSlots = index.documentSlots();
+    double totalLength = 0.0;
+    for (size_t document = 0; document < documentSlots; ++document) {
+        totalLength += index.getDocumentLength(document);
+    }
+
+    // Shard s holds documents in [shardEnds[s - 1], shardEnds[s])
+    vector<int> shardEnds;
+    double length = 0.0;
+    for (size_t document = 0; document < documentSlots; ++document) {
+        length += index.getDocumentLength(document);
+        if (shardEnds.size() + 1 < shardsNumber && length >= totalLength * (shardEnds.size() + 1) / shardsNumber) {
+            shardEnds.push_back(document + 1);
+        }
+    }
+    while (shardEnds.size() < shardsNumber) {
+        shardEnds.push_back(documentSlots);
+    }
+
+    vector<IndexWriter> writers(shardsNumber);
+    vector<vector<IndexWriter::Posting>> shardPostings(shardsNumber);
+    vector<vector<vector<int>>> shardPositions(shardsNumber);
+    bool hasPositions = index.hasPositions();
+    for (size_t word = 0; word < index.wordsNumber(); ++word) {
+        size_t shard = 0;
+        for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next()) {
+            while (cursor.document() >= shardEnds[shard]) {
+                ++shard;
+            }
+            shardPostings[shard].push_back(IndexWriter::Posting(cursor.document(), cursor.frequency()));
+            if (hasPositions) {
+                shardPositions[shard].push_back(vector<int>());
+                cursor.readPositions(shardPositions[shard].back());
+            }
+        }
+        for (size_t i = 0; i < shardsNumber; ++i) {
+            if (!shardPostings[i].empty()) {
+                writers[i].setPostingCodec(index.getPostingCodec(word));
+                writers[i].addPostingList(word, std::move(shardPostings[i]), std::move(shardPositions[i]));
+                shardPostings[i].clear();
+                shardPositions[i].clear();
+            }
+        }
+
+        for (size_t field = TitleField; field < index.fieldsNumber(); ++field) {
+            DocumentField documentField = static_cast<DocumentField>(field);
+            shard = 0;
+            for (PostingCursor cursor = index.getFieldPostingCursor(documentField, word); cursor.valid();
+                 cursor.next()) {
+                while (cursor.document() >= shardEnds[shard]) {
+                    ++shard;
+                }
+                shardPostings[shard].push_back(IndexWriter::Posting(cursor.document(), cursor.frequency()));
+            }
+            for (size_t i = 0; i < shardsNumber; ++i) {
+                if (!shardPostings[i].empty()) {
+                    writers[i].setPostingCodec(index.getFieldPostingCodec(documentField, word));
+                    writers[i].addFieldPostingList(documentField, word, std::move(shardPostings[i]));
+                    shardPostings[i].clear();
+                }
+            }
+        }
+    }
+
+    vector<Index> shards;
+    for (size_t i = 0; i < shardsNumber; ++i) {
+        shards.push_back(Index(writers[i]));
+        shards.back().shareCollectionStatistics(index);
+    }
+    return shards;
+}
+
+} // namespace irindexer
+
+#endif // SHARDED_INDEX_HPP
@@ -0,0 +1,221 @@
+#ifndef STATIC_RANK_HPP
+#define STATIC_RANK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Lines "N.html URL" of the urls mapping written by flatten, as pairs of document N and URL
+inline vector<std::pair<int, string>> readUrlsMapping(const string& urlsMappingPath) {
+    std::ifstream input(urlsMappingPath);
+    if (!input.is_open()) {
+        throw std::logic_error("Can't open file " + urlsMappingPath);
+    }
+    vector<std::pair<int, string>> documentUrls;
+    string filename;
+    string url;
+    while (input >> filename >> url) {
+        size_t stemLength = filename.find('.');
+        if (stemLength == 0 || filename.find_first_not_of("0123456789") != stemLength) {
+            std::cerr << "Skipping url of file without numeric document id " << filename << std::endl;
+            continue;
+        }
+        documentUrls.push_back(std::make_pair(std::stoi(filename.substr(0, stemLength)), url));
+    }
+    return documentUrls;
+}
+
+// URL without the scheme, the fragment and trailing slashes, as crawlers write one page differently
+inline string normalizeUrl(const string& url) {
+    size_t schemeEnd = url.find("://");
+    string normalized = url.substr(schemeEnd == string::npos ? 0 : schemeEnd + 3);
+    normalized = normalized.substr(0, normalized.find('#'));
+    while (!normalized.empty() && normalized.back() == '/') {
+        normalized.pop_back();
+    }
+    return normalized;
+}
+
+// Query-independent scores of documents in [0, 1], stored as lines "DOCUMENT SCORE".
+// Documents without a score get 0. Upper bounds of the scores of all documents from
+// a given one on let searches over documents ordered by static rank stop early.
+class StaticRank {
+public:
+    void readFromFile(const string& filename) {
+        std::ifstream input(filename);
+        if (!input.is_open()) {
+            throw std::logic_error("Can't open file " + filename);
+        }
+        scores.clear();
+        int document;
+        double score;
+        while (input >> document >> score) {
+            if (document < 0) {
+                throw std::logic_error("Negative document in static rank " + filename);
+            }
+            setScore(document, score);
+        }
+        computeUpperBounds();
+
+        std::cerr << "Read static rank of " << scores.size() << " documents" << std::endl;
+    }
+
+    void writeToFile(const string& filename) const {
+        std::ofstream output(filename);
+        if (!output.is_open()) {
+            throw std::logic_error("Can't open file " + filename);
+        }
+        for (size_t document = 0; document < scores.size(); ++document) {
+            if (scores[document] > 0.0f) {
+                output << document << ' ' << scores[document] << '\n';
+            }
+        }
+    }
+
+    // Lines "URL PAGERANK" of the pagerank file written by flat_webgraph, documents of the URLs
+    // are found by the urls mapping. PageRank spans orders of magnitude, so the scores are
+    // its logarithm scaled to [0, 1] between the least and the greatest PageRank of documents.
+    void readPageranks(const string& pageranksPath, const string& urlsMappingPath) {
+        std::unordered_map<string, int> documents;
+        for (const auto& documentUrl : readUrlsMapping(urlsMappingPath)) {
+            documents[normalizeUrl(documentUrl.second)] = documentUrl.first;
+        }
+
+        std::ifstream input(pageranksPath);
+        if (!input.is_open()) {
+            throw std::logic_error("Can't open file " + pageranksPath);
+        }
+        vector<std::pair<int, double>> pageranks;
+        string url;
+        double pagerank;
+        while (input >> url >> pagerank) {
+            auto it = documents.find(normalizeUrl(url));
+            if (it != documents.end() && pagerank > 0.0) {
+                pageranks.push_back(std::make_pair(it->second, std::log(pagerank)));
+            }
+        }
+
+        scores.clear();
+        double minLog = std::numeric_limits<double>::max();
+        double maxLog = std::numeric_limits<double>::lowest();
+        for (const auto& documentPagerank : pageranks) {
+            minLog = std::min(minLog, documentPagerank.second);
+            maxLog = std::max(maxLog, documentPagerank.second);
+        }
+        for (const auto& documentPagerank : pageranks) {
+            setScore(documentPagerank.first,
+                     maxLog > minLog ? (documentPagerank.second - minLog) / (maxLog - minLog) : 1.0);
+        }
+        computeUpperBounds();
+
+        std::cerr << "Found PageRank of " << pageranks.size() << " documents" << std::endl;
+    }
+
+    // Moves scores to the new documents of lines "NEW_DOCUMENT OLD_DOCUMENT" written by reordering
+    void renumberDocuments(const string& mappingPath) {
+        std::ifstream input(mappingPath);
+        if (!input.is_open()) {
+            throw std::logic_error("Can't open file " + mappingPath);
+        }
+        vector<float> oldScores;
+        oldScores.swap(scores);
+        int newDocument, oldDocument;
+        while (input >> newDocument >> oldDocument) {
+            if (newDocument < 0 || oldDocument < 0) {
+                throw std::logic_error("Negative document in mapping " + mappingPath);
+            }
+            if (static_cast<size_t>(oldDocument) < oldScores.size()) {
+                setScore(newDocument, oldScores[oldDocument]);
+            }
+        }
+        computeUpperBounds();
+    }
+
+    bool empty() const {
+        return scores.empty();
+    }
+
+    double getScore(int document) const {
+        return static_cast<size_t>(document) < scores.size() ? scores[document] : 0.0;
+    }
+
+    // Greatest score of the documents not less than document
+    double getUpperBound(int document) const {
+        return static_cast<size_t>(document) < upperBounds.size() ? upperBounds[document] : 0.0;
+    }
+
+private:
+    void setScore(int document, double score) {
+        if (static_cast<size_t>(document) >= scores.size()) {
+            scores.resize(document + 1, 0.0f);
+        }
+        scores[document] = static_cast<float>(score);
+    }
+
+    void computeUpperBounds() {
+        upperBounds.resize(scores.size());
+        float upperBound = 0.0f;
+        for (size_t document = scores.size(); document-- > 0;) {
+            upperBound = std::max(upperBound, scores[document]);
+            upperBounds[document] = upperBound;
+        }
+    }
+
+    vector<float> scores;
+    vector<float> upperBounds;
+};
+
+// Weight of the static rank in [0, 1] added to BM25 scores, about the idf of a word
+// found in one of 30 documents
+const double defaultStaticRankWeight = 3.0;
+
+// Document priors add a query-independent score to the score of every document found by
+// conjunctive search, getUpperBound bounds the priors of all documents from the given one on.
+
+// Adds nothing
+struct NoDocumentPrior {
+    double getScore(int) const {
+        return 0.0;
+    }
+
+    double getUpperBound(int) const {
+        return 0.0;
+    }
+};
+
+// Adds the static rank scaled by weight
+class StaticRankPrior {
+public:
+    StaticRankPrior(const StaticRank& staticRank, double weight)
+        : staticRank(staticRank)
+        , weight(weight)
+    { }
+
+    double getScore(int document) const {
+        return weight * staticRank.getScore(document);
+    }
+
+    double getUpperBound(int document) const {
+        return weight * staticRank.getUpperBound(document);
+    }
+
+private:
+    const StaticRank& staticRank;
+    double weight;
+};
+
+} // namespace irindexer
+
+#endif // STATIC_RANK_HPP
@@ -0,0 +1,336 @@
+#ifndef TERM_EXPANSION_HPP
+#define TERM_EXPANSION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dictionary.hpp"
+#include "intersection.hpp"
+
+namespace irindexer {
+
+using std::string;
+using std::vector;
+
+// Query word with an optional expansion operator:
+//   foo*      words starting with foo
+//   f?o*bar   words matching the wildcard, ? is any character and * any substring
+//   foo~      words within edit distance 1 of foo, foo~2 within distance 2
+struct TermPattern {
+    enum Kind { Exact, Prefix, Wildcard, Fuzzy };
+
+    Kind kind = Exact;
+    string text;
+    int maxDistance = 0;
+};
+
+inline TermPattern parseTermPattern(const string& token) {
+    TermPattern pattern;
+    pattern.text = token;
+
+    size_t tilde = token.rfind('~');
+    if (tilde != string::npos && tilde > 0
+            && (tilde + 1 == token.size() || (tilde + 2 == token.size() && (token[tilde + 1] == '1'
+                                                                           || token[tilde + 1] == '2')))) {
+        pattern.kind = TermPattern::Fuzzy;
+        pattern.text = token.substr(0, tilde);
+        pattern.maxDistance = (tilde + 1 == token.size()) ? 1 : token[tilde + 1] - '0';
+        return pattern;
+    }
+
+    size_t wildcard = token.find_first_of("*?");
+    if (wildcard == string::npos) {
+        return pattern;
+    }
+    if (wildcard + 1 == token.size() && token[wildcard] == '*') {
+        pattern.kind = TermPattern::Prefix;
+        pattern.text = token.substr(0, wildcard);
+    } else {
+        pattern.kind = TermPattern::Wildcard;
+    }
+    return pattern;
+}
+
+// Glob matching of a word against a wildcard pattern with ? and *
+inline bool matchWildcard(const char* word, const char* wordEnd, const char* pattern, const char* patternEnd) {
+    const char* starPattern = nullptr;
+    const char* starWord = nullptr;
+    while (word != wordEnd) {
+        if (pattern != patternEnd && (*pattern == '?' || *pattern == *word)) {
+            ++word;
+            ++pattern;
+        } else if (pattern != patternEnd && *pattern == '*') {
+            starPattern = pattern++;
+            starWord = word;
+        } else if (starPattern) {
+            pattern = starPattern + 1;
+            word = ++starWord;
+        } else {
+            return false;
+        }
+    }
+    while (pattern != patternEnd && *pattern == '*') {
+        ++pattern;
+    }
+    return pattern == patternEnd;
+}
+
+// Expands query words with operators into dictionary words. Lookup structures
+// are built once from the dictionary:
+//   words sorted lexicographically, prefixes are ranges of them;
+//   bigram index of words padded with boundary marks, candidates of a wildcard
+//   are intersections of its bigram lists, verified against the pattern;
+//   edit distance is evaluated by walking the sorted words as an implicit trie,
+//   sharing rows of the Levenshtein matrix along common prefixes and skipping
+//   whole subtrees once every cell of the row exceeds the distance.
+// Every expansion is bounded by maxExpansions words, the closest and the most
+// frequent ones are kept.
+class TermExpander {
+public:
+    TermExpander(const Dictionary& dict, size_t maxExpansions)
+        : dict(dict)
+        , maxExpansions(maxExpansions)
+        , bigramWords(bigramsNumber)
+    {
+        std::cerr << "Building term expansion index" << std::endl;
+
+        for (size_t index = 0; index < dict.indexSlots(); ++index) {
+            if (dict.containsIndex(index)) {
+                sortedWords.push_back(index);
+            }
+        }
+        std::sort(sortedWords.begin(), sortedWords.end(),
+            [&](int lhs, int rhs) { return compareWords(lhs, rhs) < 0; });
+
+        for (size_t rank = 0; rank < sortedWords.size(); ++rank) {
+            const char* begin;
+            const char* end;
+            dict.getWordBounds(sortedWords[rank], begin, end);
+            unsigned char previous = boundaryMark;
+            for (const char* c = begin; c <= end; ++c) {
+                unsigned char current = (c == end) ? boundaryMark : static_cast<unsigned char>(*c);
+                vector<int>& words = bigramWords[previous * 256 + current];
+                if (words.empty() || words.back() != static_cast<int>(rank)) {
+                    words.push_back(rank);
+                }
+                previous = current;
+            }
+        }
+
+        std::cerr << "Finished building term expansion index" << std::endl;
+    }
+
+    // Dictionary words of the query word. Words without operators expand to themselves,
+    // unknown ones to their closest words within edit distance 2.
+    vector<WordRecord> expand(const string& token) const {
+        TermPattern pattern = parseTermPattern(token);
+        switch (pattern.kind) {
+        case TermPattern::Prefix:
+            return expandPrefix(pattern.text);
+        case TermPattern::Wildcard:
+            return expandWildcard(pattern.text);
+        case TermPattern::Fuzzy:
+            return expandFuzzy(pattern.text, pattern.maxDistance);
+        default:
+            if (dict.containsWord(pattern.text)) {
+                return vector<WordRecord>(1, dict.getWordRecord(pattern.text));
+            }
+            return expandFuzzy(pattern.text, 2);
+        }
+    }
+
+    vector<WordRecord> expandPrefix(const string& prefix) const {
+        vector<Candidate> candidates;
+        size_t rank = std::lower_bound(sortedWords.begin(), sortedWords.end(), prefix,
+            [&](int index, const string& value) {
+                return compareWord(index, value.data(), value.size()) < 0;
+            }) - sortedWords.begin();
+        for (; rank < sortedWords.size() && hasPrefix(sortedWords[rank], prefix.data(), prefix.size()); ++rank) {
+            candidates.push_back(Candidate(sortedWords[rank], 0));
+        }
+        return selectCandidates(candidates);
+    }
+
+    vector<WordRecord> expandWildcard(const string& pattern) const {
+        vector<const vector<int>*> lists;
+        string padded = string(1, boundaryMark) + pattern + string(1, boundaryMark);
+        for (size_t i = 0; i + 1 < padded.size(); ++i) {
+            if (isWildcard(padded[i]) || isWildcard(padded[i + 1])) {
+                continue;
+            }
+            lists.push_back(&bigramWords[static_cast<unsigned char>(padded[i]) * 256
+                                         + static_cast<unsigned char>(padded[i + 1])]);
+        }
+
+        vector<Candidate> candidates;
+        auto addMatching = [&](int rank) {
+            const char* begin;
+            const char* end;
+            dict.getWordBounds(sortedWords[rank], begin, end);
+            if (matchWildcard(begin, end, pattern.data(), pattern.data() + pattern.size())) {
+                candidates.push_back(Candidate(sortedWords[rank], 0));
+            }
+        };
+        if (lists.empty()) {
+            for (size_t rank = 0; rank < sortedWords.size(); ++rank) {
+                addMatching(rank);
+            }
+        } else {
+            std::sort(lists.begin(), lists.end(),
+                [](const vector<int>* lhs, const vector<int>* rhs) { return lhs->size() < rhs->size(); });
+            vector<int> ranks(lists[0]->begin(), lists[0]->end());
+            vector<int> buffer;
+            for (size_t i = 1; i < lists.size() && !ranks.empty(); ++i) {
+                intersectCandidates(ranks, *lists[i], buffer);
+                ranks.swap(buffer);
+            }
+            for (int rank : ranks) {
+                addMatching(rank);
+            }
+        }
+        return selectCandidates(candidates);
+    }
+
+    vector<WordRecord> expandFuzzy(const string& word, int maxDistance) const {
+        vector<Candidate> candidates;
+        size_t length = word.size();
+
+        // rows[d] is the row of the Levenshtein matrix for the first d characters of the current word
+        vector<vector<int>> rows(1, vector<int>(length + 1));
+        for (size_t j = 0; j <= length; ++j) {
+            rows[0][j] = j;
+        }
+
+        const char* previousBegin = nullptr;
+        const char* previousEnd = nullptr;
+        size_t rank = 0;
+        while (rank < sortedWords.size()) {
+            const char* begin;
+            const char* end;
+            dict.getWordBounds(sortedWords[rank], begin, end);
+            size_t common = 0;
+            while (common + 1 < rows.size() && previousBegin + common != previousEnd && begin + common != end
+                       && previousBegin[common] == begin[common]) {
+                ++common;
+            }
+            rows.resize(common + 1);
+            previousBegin = begin;
+            previousEnd = end;
+
+            bool pruned = false;
+            for (size_t depth = common; begin + depth != end; ++depth) {
+                rows.push_back(vector<int>(length + 1));
+                const vector<int>& previousRow = rows[depth];
+                vector<int>& row = rows[depth + 1];
+                row[0] = depth + 1;
+                int rowMinimum = row[0];
+                for (size_t j = 1; j <= length; ++j) {
+                    int substitution = previousRow[j - 1] + (begin[depth] == word[j - 1] ? 0 : 1);
+                    row[j] = std::min(std::min(previousRow[j], row[j - 1]) + 1, substitution);
+                    rowMinimum = std::min(rowMinimum, row[j]);
+                }
+                if (rowMinimum > maxDistance) {
+                    rank = skipPrefix(rank, begin, depth + 1);
+                    pruned = true;
+                    break;
+                }
+            }
+            if (pruned) {
+                continue;
+            }
+            int distance = rows.back()[length];
+            if (distance <= maxDistance) {
+                candidates.push_back(Candidate(sortedWords[rank], distance));
+            }
+            ++rank;
+        }
+        return selectCandidates(candidates);
+    }
+
+private:
+    struct Candidate {
+        Candidate(int index, int distance)
+            : index(index)
+            , distance(distance)
+        { }
+
+        int index;
+        int distance;
+    };
+
+    static const unsigned char boundaryMark = 0;
+    static const size_t bigramsNumber = 256 * 256;
+
+    static bool isWildcard(char c) {
+        return c == '*' || c == '?';
+    }
+
+    int compareWord(int index, const char* value, size_t length) const {
+        const char* begin;
+        const char* end;
+        dict.getWordBounds(index, begin, end);
+        size_t wordLength = end - begin;
+        int result = std::memcmp(begin, value, std::min(wordLength, length));
+        if (result != 0) {
+            return result;
+        }
+        return (wordLength < length) ? -1 : (wordLength > length ? 1 : 0);
+    }
+
+    int compareWords(int lhs, int rhs) const {
+        const char* begin;
+        const char* end;
+        dict.getWordBounds(rhs, begin, end);
+        return compareWord(lhs, begin, end - begin);
+    }
+
+    bool hasPrefix(int index, const char* prefix, size_t length) const {
+        const char* begin;
+        const char* end;
+        dict.getWordBounds(index, begin, end);
+        return static_cast<size_t>(end - begin) >= length && std::memcmp(begin, prefix, length) == 0;
+    }
+
+    // First rank after rank whose word doesn't start with the first length characters of prefix
+    size_t skipPrefix(size_t rank, const char* prefix, size_t length) const {
+        return std::partition_point(sortedWords.begin() + rank, sortedWords.end(),
+            [&](int index) { return hasPrefix(index, prefix, length); }) - sortedWords.begin();
+    }
+
+    vector<WordRecord> selectCandidates(vector<Candidate>& candidates) const {
+        size_t selected = std::min(maxExpansions, candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + selected, candidates.end(),
+            [&](const Candidate& lhs, const Candidate& rhs) {
+                if (lhs.distance != rhs.distance) {
+                    return lhs.distance < rhs.distance;
+                }
+                int lhsFrequency = dict.getWordFrequency(lhs.index);
+                int rhsFrequency = dict.getWordFrequency(rhs.index);
+                if (lhsFrequency != rhsFrequency) {
+                    return lhsFrequency > rhsFrequency;
+                }
+                return lhs.index < rhs.index;
+            });
+
+        vector<WordRecord> records;
+        for (size_t i = 0; i < selected; ++i) {
+            records.push_back(dict.getWordRecord(candidates[i].index));
+        }
+        return records;
+    }
+
+    Dictionary dict;
+    size_t maxExpansions;
+    // Word indices in lexicographic order of words
+    vector<int> sortedWords;
+    // Ranks in sortedWords of the words containing every bigram
+    vector<vector<int>> bigramWords;
+};
+
+} // namespace irindexer
+
+#endif // TERM_EXPANSION_HPP
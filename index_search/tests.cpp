@@ -0,0 +1,465 @@
+// Checks of the optimized search paths against straightforward ones over a generated
+// collection: posting codecs and decoding kernels, pruned, planned, sharded and
+// impact-ordered top documents, and visibility of updates of a segmented index.
+// Run by ctest, exits with a non-zero status if any check failed.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "impact_index.hpp"
+#include "posting_codecs.hpp"
+#include "roaring.hpp"
+#include "search_engine.hpp"
+#include "segmented_index.hpp"
+
+using namespace irindexer;
+
+typedef SearchEngine::DocumentScore DocumentScore;
+
+namespace {
+
+size_t failures = 0;
+
+void check(bool condition, const string& message) {
+    if (!condition) {
+        std::cerr << "FAILED: " << message << std::endl;
+        ++failures;
+    }
+}
+
+// Words of the collection are named "wordaa", "wordab", ..., word i is found
+// in a document with probability falling with i, so that the first lists are dense
+struct Collection {
+    vector<string> words;
+    vector<vector<IndexWriter::Posting>> postingLists;
+    int documentSlots = 0;
+};
+
+Collection generateCollection(size_t wordsNumber, int documentsNumber) {
+    std::mt19937 random(20240917);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    Collection collection;
+    collection.postingLists.resize(wordsNumber);
+    for (size_t word = 0; word < wordsNumber; ++word) {
+        collection.words.push_back(string("word") + char('a' + word / 26) + char('a' + word % 26));
+    }
+    // Documents are spread over several Roaring containers
+    for (int i = 0; i < documentsNumber; ++i) {
+        int document = 3 * i;
+        for (size_t word = 0; word < wordsNumber; ++word) {
+            if (uniform(random) < 0.9 / std::pow(word + 1.0, 1.3)) {
+                int frequency = 1 + random() % (1 + word % 7);
+                collection.postingLists[word].push_back(IndexWriter::Posting(document, frequency));
+            }
+        }
+        collection.documentSlots = document + 1;
+    }
+    return collection;
+}
+
+void writeDictionary(const Collection& collection, const string& path) {
+    std::ofstream output(path);
+    for (size_t word = 0; word < collection.words.size(); ++word) {
+        output << collection.words[word] << ' ' << word << ' ' << collection.postingLists[word].size() << '\n';
+    }
+}
+
+void writeIndex(const Collection& collection, PostingCodec codec, bool denseListBitmaps, const string& path) {
+    IndexWriter writer;
+    writer.setPostingCodec(codec);
+    writer.setDenseListBitmaps(denseListBitmaps);
+    for (size_t word = 0; word < collection.postingLists.size(); ++word) {
+        writer.addPostingList(word, collection.postingLists[word]);
+    }
+    Index(writer).writeToFile(path);
+}
+
+void removeDirectory(const string& path) {
+    DIR* directory = ::opendir(path.c_str());
+    if (directory == nullptr) {
+        return;
+    }
+    while (dirent* entry = ::readdir(directory)) {
+        string name = entry->d_name;
+        if (name != "." && name != "..") {
+            string entryPath = path + "/" + name;
+            if (std::remove(entryPath.c_str()) != 0) {
+                removeDirectory(entryPath);
+            }
+        }
+    }
+    ::closedir(directory);
+    ::rmdir(path.c_str());
+}
+
+// Values of every byte length, more of the short ones as in posting lists
+vector<uint32_t> generateValues(std::mt19937& random, size_t count) {
+    vector<uint32_t> values(count);
+    for (auto& value : values) {
+        value = static_cast<uint32_t>(random()) >> (8 * (random() % 4) + random() % 8);
+    }
+    return values;
+}
+
+void checkCodecs() {
+    std::mt19937 random(7);
+    vector<StreamVByteKernel> kernels = getStreamVByteKernels();
+    for (int codec = 0; codec < postingCodecsNumber; ++codec) {
+        string codecName = getPostingCodecName(static_cast<PostingCodec>(codec));
+        for (size_t count = 1; count <= postingsBlockSize; count += count < 20 ? 1 : 9) {
+            vector<uint32_t> gaps = generateValues(random, count);
+            vector<uint32_t> frequencies = generateValues(random, count);
+            vector<uint8_t> block;
+            encodePostingsBlock(static_cast<PostingCodec>(codec), gaps.data(), frequencies.data(), count, block);
+            for (const auto& kernel : kernels) {
+                // Exactly the block bytes, so that a kernel reading past the end is caught by sanitizers
+                vector<uint8_t> input(block);
+                vector<uint32_t> decodedGaps(count, 0);
+                vector<uint32_t> decodedFrequencies(count);
+                decodePostingsBlock(static_cast<PostingCodec>(codec), input.data(), input.data() + input.size(),
+                                    count, decodedGaps.data(), decodedFrequencies.data(), kernel.decode);
+                string what = codecName + " block of " + std::to_string(count) + " postings by " + kernel.name;
+                check(decodedFrequencies == frequencies, what + " decodes frequencies");
+                check(codec == RoaringCodec || decodedGaps == gaps, what + " decodes gaps");
+            }
+        }
+    }
+
+    vector<int> documents;
+    for (int document = 0; document < 300000; document += 1 + random() % (document < 100000 ? 2 : 40)) {
+        documents.push_back(document);
+    }
+    vector<uint8_t> data;
+    encodeRoaring(documents, data);
+    check(RoaringSet::isValid(data.data(), data.size()), "Roaring set of encodeRoaring is valid");
+    RoaringSet set(data.data());
+    vector<uint32_t> extracted(documents.size() + 1);
+    size_t extractedNumber = set.extract(0, extracted.size(), extracted.data());
+    check(set.size() == documents.size() && extractedNumber == documents.size()
+          && std::equal(documents.begin(), documents.end(), extracted.begin()), "Roaring set keeps its documents");
+}
+
+// Every codec stores the posting lists of the collection as they were added
+void checkPostingLists(const Collection& collection, const string& directory) {
+    for (int codec = 0; codec < postingCodecsNumber; ++codec) {
+        for (bool denseListBitmaps : {false, true}) {
+            string path = directory + "/codec.bin";
+            writeIndex(collection, static_cast<PostingCodec>(codec), denseListBitmaps, path);
+            Index index;
+            index.readBinaryFile(path);
+            string what = string(getPostingCodecName(static_cast<PostingCodec>(codec)))
+                          + (denseListBitmaps ? " with dense bitmaps" : "");
+            for (size_t word = 0; word < collection.postingLists.size(); ++word) {
+                const vector<IndexWriter::Posting>& postings = collection.postingLists[word];
+                size_t i = 0;
+                for (PostingCursor cursor = index.getPostingCursor(word); cursor.valid(); cursor.next(), ++i) {
+                    if (i >= postings.size() || cursor.document() != postings[i].first
+                            || cursor.frequency() != postings[i].second) {
+                        break;
+                    }
+                }
+                check(i == postings.size(), what + " keeps postings of word " + std::to_string(word));
+
+                // Skips land on the first posting not less than the target
+                PostingCursor cursor = index.getPostingCursor(word);
+                for (size_t j = 0; j < postings.size() && cursor.valid(); j += 1 + j / 2) {
+                    cursor.nextGEQ(postings[j].first - 1);
+                    if (!cursor.valid() || cursor.document() != postings[j].first) {
+                        check(false, what + " skips postings of word " + std::to_string(word));
+                        break;
+                    }
+                }
+            }
+            std::remove(path.c_str());
+        }
+    }
+}
+
+// Documents containing all words scored one by one, by decreasing score
+vector<DocumentScore> searchExhaustively(const Dictionary& dict, const Index& index, const vector<int>& wordIndices) {
+    std::map<int, vector<int>> documentFrequencies;
+    for (size_t i = 0; i < wordIndices.size(); ++i) {
+        for (PostingCursor cursor = index.getPostingCursor(wordIndices[i]); cursor.valid(); cursor.next()) {
+            vector<int>& frequencies = documentFrequencies[cursor.document()];
+            frequencies.resize(wordIndices.size(), 0);
+            frequencies[i] = cursor.frequency();
+        }
+    }
+    BM25DocumentScoreEvaluator evaluator(dict, index);
+    evaluator.prepare(wordIndices);
+    vector<DocumentScore> documentScores;
+    for (const auto& document : documentFrequencies) {
+        if (std::find(document.second.begin(), document.second.end(), 0) == document.second.end()) {
+            documentScores.push_back(DocumentScore(evaluator.evaluateScore(document.first, document.second),
+                                                   document.first));
+        }
+    }
+    std::sort(documentScores.begin(), documentScores.end());
+    return documentScores;
+}
+
+bool isSameScore(double lhs, double rhs) {
+    return std::fabs(lhs - rhs) <= 1e-9 * std::max(1.0, std::fabs(rhs));
+}
+
+// Documents of equal scores may be taken in any order, so the found documents need to
+// have their exhaustive scores, and these need to be the top of the exhaustive ones
+void checkTop(const vector<DocumentScore>& found, const vector<DocumentScore>& expected, size_t topNumber,
+              const string& what) {
+    size_t expectedSize = std::min(topNumber, expected.size());
+    if (found.size() != expectedSize) {
+        check(false, what + " finds " + std::to_string(found.size()) + " documents instead of "
+                     + std::to_string(expectedSize));
+        return;
+    }
+    std::unordered_map<int, double> scores;
+    for (const auto& documentScore : expected) {
+        scores[documentScore.documentIndex] = documentScore.score;
+    }
+    for (size_t i = 0; i < found.size(); ++i) {
+        auto score = scores.find(found[i].documentIndex);
+        if (score == scores.end() || !isSameScore(found[i].score, score->second)
+                || !isSameScore(found[i].score, expected[i].score)) {
+            check(false, what + " differs at place " + std::to_string(i));
+            return;
+        }
+    }
+}
+
+struct Query {
+    string phrase;
+    vector<int> wordIndices;
+};
+
+vector<Query> generateQueries(const Collection& collection, size_t queriesNumber) {
+    std::mt19937 random(11);
+    vector<Query> queries;
+    for (size_t i = 0; i < queriesNumber; ++i) {
+        Query query;
+        size_t wordsNumber = 1 + i % 3;
+        while (query.wordIndices.size() < wordsNumber) {
+            // Dense words are asked for more often, as in query logs
+            int word = random() % (1 + random() % collection.words.size());
+            if (std::find(query.wordIndices.begin(), query.wordIndices.end(), word) == query.wordIndices.end()) {
+                query.phrase += (query.wordIndices.empty() ? "" : " ") + collection.words[word];
+                query.wordIndices.push_back(word);
+            }
+        }
+        queries.push_back(query);
+    }
+    return queries;
+}
+
+const size_t topNumbers[] = {1, 10, 100};
+
+// Block-Max WAND, planned intersection and their sharded runs against exhaustive scoring
+void checkTopDocuments(SearchEngine& engine, const Dictionary& dict, const vector<Query>& queries,
+                       const string& codecName) {
+    SearchEngine::QueryContext context;
+    for (const auto& query : queries) {
+        vector<DocumentScore> expected = searchExhaustively(dict, engine.getIndex(), query.wordIndices);
+        string what = " of \"" + query.phrase + "\" over " + codecName;
+        for (size_t topNumber : topNumbers) {
+            string top = " top " + std::to_string(topNumber) + what;
+            checkTop(engine.TopScoredPhraseSearch<BM25DocumentScoreEvaluator>(query.phrase, topNumber),
+                     expected, topNumber, "Block-Max WAND" + top);
+            SearchEngine::QueryProfile profile;
+            checkTop(engine.ProfiledPhraseSearch<BM25DocumentScoreEvaluator>(query.phrase, topNumber, profile, context),
+                     expected, topNumber, "planned intersection" + top);
+        }
+        checkTop(engine.ScoredPhraseSearch<BM25DocumentScoreEvaluator>(query.phrase), expected, expected.size(),
+                 "planned intersection" + what);
+    }
+
+    for (size_t shardsNumber : {2, 3, 7}) {
+        engine.splitIntoShards(shardsNumber);
+        for (const auto& query : queries) {
+            vector<DocumentScore> expected = searchExhaustively(dict, engine.getIndex(), query.wordIndices);
+            for (size_t topNumber : topNumbers) {
+                checkTop(engine.TopScoredPhraseSearch<BM25DocumentScoreEvaluator>(query.phrase, topNumber),
+                         expected, topNumber, "Block-Max WAND over " + std::to_string(shardsNumber)
+                         + " shards top " + std::to_string(topNumber) + " of \"" + query.phrase + "\" over "
+                         + codecName);
+            }
+        }
+    }
+    engine.splitIntoShards(1);
+}
+
+// Early stopped impact search against the search processing all segments
+void checkImpactOrdering(const Index& index, const vector<Query>& queries, const string& directory) {
+    string path = directory + "/impacts.bin";
+    ImpactIndexWriter(index).writeToFile(path);
+    ImpactIndex impactIndex;
+    impactIndex.readFromFile(path, index);
+
+    ImpactIndex::SearchContext context;
+    for (const auto& query : queries) {
+        // Accumulating all postings, as the top of every document is never stable
+        vector<DocumentImpact> all = impactIndex.search(query.wordIndices, index.documentSlots());
+        std::unordered_map<int, uint32_t> impacts;
+        for (const auto& documentImpact : all) {
+            impacts[documentImpact.document] = documentImpact.impact;
+        }
+        for (size_t topNumber : topNumbers) {
+            string what = "impact top " + std::to_string(topNumber) + " of \"" + query.phrase + "\"";
+            const vector<DocumentImpact>& found = impactIndex.search(query.wordIndices, topNumber, context);
+            check(found.size() == std::min(topNumber, all.size()), what + " finds all documents");
+            vector<uint32_t> foundImpacts;
+            for (const auto& documentImpact : found) {
+                auto impact = impacts.find(documentImpact.document);
+                check(impact != impacts.end() && documentImpact.impact <= impact->second,
+                      what + " finds documents with their partial impacts");
+                foundImpacts.push_back(impact == impacts.end() ? 0 : impact->second);
+            }
+            std::sort(foundImpacts.begin(), foundImpacts.end(), std::greater<uint32_t>());
+            bool isTop = true;
+            for (size_t i = 0; i < foundImpacts.size() && i < all.size(); ++i) {
+                isTop = isTop && foundImpacts[i] == all[i].impact;
+            }
+            check(isTop, what + " finds the documents of the greatest impacts");
+            check(std::count(context.accumulators.begin(), context.accumulators.end(), 0U)
+                  == static_cast<ptrdiff_t>(context.accumulators.size()), what + " clears its accumulators");
+        }
+    }
+    std::remove(path.c_str());
+}
+
+bool isFound(const SearchEngine& engine, const string& phrase, int document) {
+    for (const auto& documentScore : engine.TopScoredPhraseSearch<BM25DocumentScoreEvaluator>(phrase, 1 << 20)) {
+        if (documentScore.documentIndex == document) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Added documents are visible after a flush and deleted ones at once, before and after
+// merges of the segments and after the directory is opened again
+void checkSegments(SearchEngine& engine, const Collection& collection, const string& directory) {
+    const string segmentsDirectory = directory + "/segments";
+    const int rareWord = collection.words.size() - 1;
+    const string& rare = collection.words[rareWord];
+    const string& common = collection.words[0];
+    const string& second = collection.words[1];
+    const int added = collection.documentSlots + 10;
+    const int deleted = collection.postingLists[0][5].first;
+    const int replaced = collection.postingLists[1][3].first;
+    int kept = collection.postingLists[0][6].first;
+    for (size_t i = 7; kept == deleted || kept == replaced; ++i) {
+        kept = collection.postingLists[0][i].first;
+    }
+    const size_t batchDocuments = 8;
+
+    auto checkVisibility = [&](const string& state) {
+        check(isFound(engine, rare, added), "added document is found " + state);
+        check(!isFound(engine, common, deleted), "deleted document is not found " + state);
+        check(!isFound(engine, second, replaced) && isFound(engine, rare, replaced),
+              "replaced document is found by its new words only " + state);
+        check(isFound(engine, common, kept),
+              "documents left are found " + state);
+        for (size_t i = 0; i < batchDocuments; ++i) {
+            check(isFound(engine, rare + " " + common, added + 1 + i), "batch document is found " + state);
+        }
+    };
+
+    {
+        auto segments = std::make_shared<SegmentedIndex>(segmentsDirectory, engine.getIndex(), 2, 2);
+        engine.attachSegments(segments);
+        check(isFound(engine, common, deleted), "initial index is searched in segments");
+
+        segments->addDocument(added, vector<int>(2, rareWord));
+        segments->flush();
+        check(isFound(engine, rare, added), "added document is found after a flush");
+
+        segments->deleteDocument(deleted);
+        check(!isFound(engine, common, deleted), "deleted document is not found at once");
+
+        segments->addDocument(replaced, vector<int>(1, rareWord));
+        segments->flush();
+        check(!isFound(engine, second, replaced) && isFound(engine, rare, replaced),
+              "replaced document is found by its new words only");
+
+        vector<int> words;
+        words.push_back(rareWord);
+        words.push_back(0);
+        for (size_t i = 0; i < batchDocuments; ++i) {
+            segments->addDocument(added + 1 + i, words);
+        }
+        // Ten small documents fit in at most two segments of different tiers besides the initial one
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (segments->segmentsNumber() > 3 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        check(segments->segmentsNumber() <= 3, "small segments are merged");
+        checkVisibility("after merges");
+        engine.attachSegments(nullptr);
+    }
+
+    auto segments = std::make_shared<SegmentedIndex>(segmentsDirectory, Index(), 2, 2);
+    engine.attachSegments(segments);
+    checkVisibility("after reopening");
+    engine.attachSegments(nullptr);
+}
+
+} // namespace
+
+int main() {
+    char directoryTemplate[] = "/tmp/irindexer_tests.XXXXXX";
+    if (::mkdtemp(directoryTemplate) == nullptr) {
+        std::cerr << "Can't create a temporary directory" << std::endl;
+        return 1;
+    }
+    const string directory = directoryTemplate;
+
+    try {
+        Collection collection = generateCollection(60, 30000);
+        vector<Query> queries = generateQueries(collection, 60);
+        string dictPath = directory + "/dict.txt";
+        writeDictionary(collection, dictPath);
+        Dictionary dict;
+        dict.readFromFile(dictPath);
+
+        checkCodecs();
+        std::cout << "Codecs and kernels: " << (failures == 0 ? "ok" : "failed") << std::endl;
+
+        checkPostingLists(collection, directory);
+        std::cout << "Posting lists: " << (failures == 0 ? "ok" : "failed") << std::endl;
+
+        for (int codec = 0; codec < postingCodecsNumber; ++codec) {
+            string indexPath = directory + "/index.bin";
+            writeIndex(collection, static_cast<PostingCodec>(codec), true, indexPath);
+            SearchEngine engine(dictPath, indexPath);
+            checkTopDocuments(engine, dict, queries, getPostingCodecName(static_cast<PostingCodec>(codec)));
+            if (codec == VarByteCodec) {
+                checkImpactOrdering(engine.getIndex(), queries, directory);
+                std::cout << "Impact ordering: " << (failures == 0 ? "ok" : "failed") << std::endl;
+                checkSegments(engine, collection, directory);
+                std::cout << "Segments: " << (failures == 0 ? "ok" : "failed") << std::endl;
+            }
+        }
+        std::cout << "Top documents: " << (failures == 0 ? "ok" : "failed") << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "FAILED: " << e.what() << std::endl;
+        ++failures;
+    }
+
+    removeDirectory(directory);
+    return failures == 0 ? 0 : 1;
+}
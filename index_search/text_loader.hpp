@@ -0,0 +1,149 @@
+#ifndef TEXT_LOADER_HPP
+#define TEXT_LOADER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace irindexer {
+
+using std::vector;
+
+// Scans whitespace-separated tokens of a text buffer in place, one line at a time
+class TextScanner {
+public:
+    TextScanner(const char* begin, const char* end)
+        : position(begin)
+        , end(end)
+    { }
+
+    bool finished() const {
+        return position == end;
+    }
+
+    // Skips spaces and tabs, true if the line has more tokens
+    bool hasToken() {
+        while (position != end && (*position == ' ' || *position == '\t' || *position == '\r')) {
+            ++position;
+        }
+        return position != end && *position != '\n';
+    }
+
+    bool readInt(int& value) {
+        if (!hasToken()) {
+            return false;
+        }
+        bool negative = (*position == '-');
+        if (negative) {
+            ++position;
+        }
+        if (position == end || !isDigit(*position)) {
+            return false;
+        }
+        int64_t result = 0;
+        while (position != end && isDigit(*position)) {
+            result = result * 10 + (*position - '0');
+            ++position;
+        }
+        value = static_cast<int>(negative ? -result : result);
+        return true;
+    }
+
+    // Token up to the next whitespace, returned as [begin, end) of the buffer
+    bool readToken(const char*& tokenBegin, const char*& tokenEnd) {
+        if (!hasToken()) {
+            return false;
+        }
+        tokenBegin = position;
+        while (position != end && !isSpace(*position)) {
+            ++position;
+        }
+        tokenEnd = position;
+        return true;
+    }
+
+    bool readChar(char expected) {
+        if (position == end || *position != expected) {
+            return false;
+        }
+        ++position;
+        return true;
+    }
+
+    void nextLine() {
+        const char* lineEnd = static_cast<const char*>(std::memchr(position, '\n', end - position));
+        position = (lineEnd == nullptr) ? end : lineEnd + 1;
+    }
+
+private:
+    static bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    const char* position;
+    const char* end;
+};
+
+// Splits the buffer into up to chunksNumber chunks of whole lines
+inline vector<std::pair<const char*, const char*>> splitIntoLineChunks(const char* data, size_t size,
+                                                                      size_t chunksNumber) {
+    vector<std::pair<const char*, const char*>> chunks;
+    const char* end = data + size;
+    const char* chunkBegin = data;
+    for (size_t i = 1; i <= chunksNumber && chunkBegin != end; ++i) {
+        const char* chunkEnd = (i == chunksNumber) ? end : std::max(chunkBegin, data + size * i / chunksNumber);
+        const char* lineEnd = static_cast<const char*>(std::memchr(chunkEnd, '\n', end - chunkEnd));
+        chunkEnd = (lineEnd == nullptr) ? end : lineEnd + 1;
+        chunks.push_back(std::make_pair(chunkBegin, chunkEnd));
+        chunkBegin = chunkEnd;
+    }
+    return chunks;
+}
+
+// Parses chunks of whole lines on all cores: parseChunk(begin, end, result) fills
+// the result of every chunk, results are returned in the order of chunks.
+// An exception thrown by any chunk parser is rethrown.
+template<typename ChunkResult, typename ChunkParser>
+vector<ChunkResult> parseLineChunks(const char* data, size_t size, ChunkParser parseChunk) {
+    size_t threadsNumber = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    // Small files are not worth the threads
+    threadsNumber = std::min<size_t>(threadsNumber, size / (1 << 20) + 1);
+    vector<std::pair<const char*, const char*>> chunks = splitIntoLineChunks(data, size, threadsNumber);
+
+    vector<ChunkResult> results(chunks.size());
+    vector<std::exception_ptr> errors(chunks.size());
+    auto parse = [&](size_t i) {
+        try {
+            parseChunk(chunks[i].first, chunks[i].second, results[i]);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    vector<std::thread> threads;
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        threads.push_back(std::thread(parse, i));
+    }
+    if (!chunks.empty()) {
+        parse(0);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    return results;
+}
+
+} // namespace irindexer
+
+#endif // TEXT_LOADER_HPP
@@ -0,0 +1,42 @@
+#ifndef VARBYTE_HPP
+#define VARBYTE_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace irindexer {
+
+// Variable-byte code: 7 payload bits per byte, high bit set on every byte
+// except the last one. Small numbers (document gaps, frequencies) take one byte.
+inline void encodeVarByte(uint32_t value, std::vector<uint8_t>& output) {
+    while (value >= 0x80) {
+        output.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<uint8_t>(value));
+}
+
+inline const uint8_t* decodeVarByte(const uint8_t* input, uint32_t& value) {
+    uint32_t result = *input & 0x7f;
+    size_t shift = 7;
+    while (*input++ & 0x80) {
+        result |= static_cast<uint32_t>(*input & 0x7f) << shift;
+        shift += 7;
+    }
+    value = result;
+    return input;
+}
+
+// Skips count codes without decoding them
+inline const uint8_t* skipVarBytes(const uint8_t* input, size_t count) {
+    while (count > 0) {
+        if (!(*input++ & 0x80)) {
+            --count;
+        }
+    }
+    return input;
+}
+
+} // namespace irindexer
+
+#endif // VARBYTE_HPP